@@ -0,0 +1,77 @@
+/* Cost of the ports pool over the 50000-55000 range: filled to saturation
+ * with random picks, filled with direct takes of requested ports, and
+ * churned at saturation by returning and taking ports again.
+ *
+ * Usage: ports_pool_bench [rounds]
+ */
+#include <glib.h>
+#include <stdio.h>
+#include "ports_pool.h"
+
+#define PORTS_POOL_BENCH_MIN 50000
+#define PORTS_POOL_BENCH_MAX 55000
+
+static double ports_pool_bench_ns(gint64 elapsed, guint64 ops)
+{
+	return ops > 0 ? (double)elapsed * 1000.0 / ops : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+	guint rounds = argc > 1 ? (guint)g_ascii_strtoull(argv[1], NULL, 10) : 100;
+	guint size = PORTS_POOL_BENCH_MAX - PORTS_POOL_BENCH_MIN + 1;
+	port_t *taken = g_new(port_t, size);
+	gint64 random_fill = 0, direct_fill = 0, churn = 0;
+	guint64 random_ops = 0, direct_ops = 0, churn_ops = 0;
+
+	for (guint round = 0; round < rounds; round++) {
+		ports_pool *pp = NULL;
+		ports_pool_init(&pp, PORTS_POOL_BENCH_MIN, PORTS_POOL_BENCH_MAX, 0);
+
+		/* Random picks until the pool is exhausted */
+		guint count = 0;
+		gint64 start = g_get_monotonic_time();
+		port_t port;
+		while ((port = ports_pool_get(pp, 0)) != 0) {
+			taken[count++] = port;
+		}
+		random_fill += g_get_monotonic_time() - start;
+		random_ops += count;
+		if (count != size) {
+			fprintf(stderr, "Random fill handed out %u ports out of %u\n", count, size);
+			return 1;
+		}
+
+		/* Return and take again at saturation */
+		start = g_get_monotonic_time();
+		for (guint i = 0; i < size; i++) {
+			guint pick = g_random_int_range(0, size);
+			ports_pool_return(pp, taken[pick]);
+			taken[pick] = ports_pool_get(pp, 0);
+		}
+		churn += g_get_monotonic_time() - start;
+		churn_ops += size;
+		ports_pool_free(pp);
+
+		/* Direct takes in ascending order, each one out of the middle of the free ring */
+		ports_pool_init(&pp, PORTS_POOL_BENCH_MIN, PORTS_POOL_BENCH_MAX, 0);
+		start = g_get_monotonic_time();
+		for (port = PORTS_POOL_BENCH_MIN; port <= PORTS_POOL_BENCH_MAX; port++) {
+			if (ports_pool_get(pp, port) != port) {
+				fprintf(stderr, "Direct take of port %"G_GINT64_FORMAT" failed\n", port);
+				return 1;
+			}
+		}
+		direct_fill += g_get_monotonic_time() - start;
+		direct_ops += size;
+		ports_pool_free(pp);
+	}
+
+	printf("range:          %d-%d, %u rounds\n", PORTS_POOL_BENCH_MIN, PORTS_POOL_BENCH_MAX, rounds);
+	printf("random fill:    %.1f ns/port\n", ports_pool_bench_ns(random_fill, random_ops));
+	printf("direct fill:    %.1f ns/port\n", ports_pool_bench_ns(direct_fill, direct_ops));
+	printf("churn when full: %.1f ns/return+get\n", ports_pool_bench_ns(churn, churn_ops));
+
+	g_free(taken);
+	return 0;
+}
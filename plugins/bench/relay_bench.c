@@ -0,0 +1,127 @@
+/* Per-packet cost of the RTP relay path: the socket looked up by name in the
+ * session table and sent through GSocket, as the relay used to do, against
+ * the cached fd loaded from the session slot table and sent with send().
+ *
+ * Usage: relay_bench [packets]
+ */
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../socket_names.h"
+
+#define RELAY_BENCH_PACKET_SIZE 1200
+#define RELAY_BENCH_DRAIN_EVERY 64
+
+typedef struct relay_bench_socket {
+	GSocket *socket;
+	int port;
+} relay_bench_socket;
+
+static int relay_bench_udp_pair(int *rcv)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	*rcv = socket(AF_INET, SOCK_DGRAM, 0);
+	if (*rcv < 0 || bind(*rcv, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		getsockname(*rcv, (struct sockaddr *)&addr, &len) < 0) {
+		return -1;
+	}
+
+	int snd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (snd < 0 || connect(snd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		return -1;
+	}
+	return snd;
+}
+
+static void relay_bench_drain(int rcv)
+{
+	char buf[RELAY_BENCH_PACKET_SIZE];
+	while (recv(rcv, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+	}
+}
+
+static void relay_bench_socket_free(gpointer data)
+{
+	relay_bench_socket *sck = (relay_bench_socket *)data;
+	g_object_unref(sck->socket);
+	g_free(sck);
+}
+
+int main(int argc, char *argv[])
+{
+	guint packets = argc > 1 ? (guint)g_ascii_strtoull(argv[1], NULL, 10) : 1000000;
+	char buf[RELAY_BENCH_PACKET_SIZE];
+	int rcv = -1;
+
+	memset(buf, 0x80, sizeof(buf));
+
+	int snd = relay_bench_udp_pair(&rcv);
+	if (snd < 0) {
+		fprintf(stderr, "Couldn't set up the loopback sockets: %s\n", g_strerror(errno));
+		return 1;
+	}
+
+	/* The session socket table, filled like janus_source_create_sockets does */
+	GHashTable *sockets = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, relay_bench_socket_free);
+	const char *names[] = { SOCKET_VIDEO_RTP_SRV, SOCKET_VIDEO_RTP_CLI, SOCKET_VIDEO_RTCP_RCV_SRV,
+		SOCKET_VIDEO_RTCP_RCV_CLI, SOCKET_VIDEO_RTCP_SND_SRV, SOCKET_AUDIO_RTP_SRV, SOCKET_AUDIO_RTP_CLI,
+		SOCKET_AUDIO_RTCP_RCV_SRV, SOCKET_AUDIO_RTCP_RCV_CLI, SOCKET_AUDIO_RTCP_SND_SRV };
+	for (guint i = 0; i < G_N_ELEMENTS(names); i++) {
+		relay_bench_socket *sck = g_new0(relay_bench_socket, 1);
+		int fd = dup(snd);
+		sck->socket = g_socket_new_from_fd(fd, NULL);
+		if (sck->socket == NULL) {
+			fprintf(stderr, "Couldn't wrap the sender fd\n");
+			return 1;
+		}
+		g_hash_table_insert(sockets, (gpointer)names[i], sck);
+	}
+
+	/* Before: lookup by name and GSocket send for every packet */
+	gint64 start = g_get_monotonic_time();
+	for (guint i = 0; i < packets; i++) {
+		int video = i & 1;
+		relay_bench_socket *sck = (video ? g_hash_table_lookup(sockets, SOCKET_VIDEO_RTP_CLI) :
+			g_hash_table_lookup(sockets, SOCKET_AUDIO_RTP_CLI));
+		g_socket_send(sck->socket, buf, sizeof(buf), NULL, NULL);
+		if (i % RELAY_BENCH_DRAIN_EVERY == 0) {
+			relay_bench_drain(rcv);
+		}
+	}
+	gint64 lookup = g_get_monotonic_time() - start;
+
+	/* After: slot load and send() on the cached fd */
+	volatile gint relay_fd[2] = { snd, snd };
+	start = g_get_monotonic_time();
+	for (guint i = 0; i < packets; i++) {
+		int fd = g_atomic_int_get(&relay_fd[i & 1]);
+		if (fd >= 0) {
+			send(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		}
+		if (i % RELAY_BENCH_DRAIN_EVERY == 0) {
+			relay_bench_drain(rcv);
+		}
+	}
+	gint64 cached = g_get_monotonic_time() - start;
+
+	printf("packets:        %u x %d bytes\n", packets, RELAY_BENCH_PACKET_SIZE);
+	printf("lookup+GSocket: %.1f ns/packet\n", (double)lookup * 1000.0 / packets);
+	printf("cached fd:      %.1f ns/packet\n", (double)cached * 1000.0 / packets);
+
+	g_hash_table_destroy(sockets);
+	close(snd);
+	close(rcv);
+	return 0;
+}
@@ -0,0 +1,303 @@
+/* RTSP session setup throughput against a running plugin: clients run
+ * DESCRIBE, SETUP of every stream, PLAY and TEARDOWN back to back on one
+ * connection each, over and over, and the time each request took is
+ * reported per method. Media is asked for interleaved on the connection so
+ * no UDP ports are involved.
+ *
+ * Usage: rtsp_bench rtsp://host:port/id [clients] [seconds]
+ */
+#include <glib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#define RTSP_BENCH_MAX_STREAMS 4
+#define RTSP_BENCH_BUFFER 16384
+
+typedef enum rtsp_bench_method {
+	RTSP_BENCH_DESCRIBE = 0,
+	RTSP_BENCH_SETUP,
+	RTSP_BENCH_PLAY,
+	RTSP_BENCH_TEARDOWN,
+	RTSP_BENCH_METHODS
+} rtsp_bench_method;
+
+static const char *rtsp_bench_methods[RTSP_BENCH_METHODS] = { "DESCRIBE", "SETUP", "PLAY", "TEARDOWN" };
+
+typedef struct rtsp_bench_stats {
+	guint64 count[RTSP_BENCH_METHODS];
+	gint64 total[RTSP_BENCH_METHODS];
+	gint64 max[RTSP_BENCH_METHODS];
+	guint64 sessions;
+	guint64 failures;
+} rtsp_bench_stats;
+
+typedef struct rtsp_bench_client {
+	int fd;
+	guint cseq;
+	char buf[RTSP_BENCH_BUFFER];
+	gsize len;
+	rtsp_bench_stats stats;
+} rtsp_bench_client;
+
+static gchar *url = NULL, *host = NULL, *port = NULL;
+static volatile gint running = 0;
+
+static gboolean rtsp_bench_parse_url(const gchar * rtsp_url)
+{
+	if (!g_str_has_prefix(rtsp_url, "rtsp://")) {
+		return FALSE;
+	}
+	const gchar *authority = rtsp_url + strlen("rtsp://");
+	const gchar *path = strchr(authority, '/');
+	gchar *hostport = path ? g_strndup(authority, path - authority) : g_strdup(authority);
+	gchar *colon = strrchr(hostport, ':');
+	if (colon) {
+		*colon = '\0';
+		port = g_strdup(colon + 1);
+	} else {
+		port = g_strdup("554");
+	}
+	host = hostport;
+	url = g_strdup(rtsp_url);
+	return TRUE;
+}
+
+static int rtsp_bench_connect(void)
+{
+	struct addrinfo hints, *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* Drops the interleaved media frames in front of the buffer */
+static void rtsp_bench_skip_interleaved(rtsp_bench_client * client)
+{
+	while (client->len >= 4 && client->buf[0] == '$') {
+		gsize frame = 4 + (((guint8)client->buf[2] << 8) | (guint8)client->buf[3]);
+		if (client->len < frame) {
+			return;
+		}
+		memmove(client->buf, client->buf + frame, client->len - frame);
+		client->len -= frame;
+	}
+}
+
+/* Sends a request and reads its response: the status code, with the body and the headers in the buffer */
+static gint rtsp_bench_request(rtsp_bench_client * client, rtsp_bench_method method, const gchar * target,
+	const gchar * headers, gchar ** response)
+{
+	gchar *request = g_strdup_printf("%s %s RTSP/1.0\r\nCSeq: %u\r\nUser-Agent: rtsp_bench\r\n%s\r\n",
+		rtsp_bench_methods[method], target, ++client->cseq, headers ? headers : "");
+	gint64 start = g_get_monotonic_time();
+	gsize request_len = strlen(request);
+	gssize sent = send(client->fd, request, request_len, MSG_NOSIGNAL);
+	g_free(request);
+	if (sent != (gssize)request_len) {
+		return -1;
+	}
+
+	for (;;) {
+		rtsp_bench_skip_interleaved(client);
+		client->buf[client->len] = '\0';
+		gchar *end = client->len > 0 && client->buf[0] != '$' ? strstr(client->buf, "\r\n\r\n") : NULL;
+		if (end != NULL) {
+			gsize head = end + 4 - client->buf;
+			gsize body = 0;
+			gchar *length = g_strstr_len(client->buf, head, "Content-Length:");
+			if (length != NULL) {
+				body = (gsize)g_ascii_strtoull(length + strlen("Content-Length:"), NULL, 10);
+			}
+			if (client->len >= head + body) {
+				gint status = 0;
+				sscanf(client->buf, "RTSP/1.0 %d", &status);
+				if (response) {
+					*response = g_strndup(client->buf, head + body);
+				}
+				memmove(client->buf, client->buf + head + body, client->len - head - body);
+				client->len -= head + body;
+
+				gint64 elapsed = g_get_monotonic_time() - start;
+				client->stats.count[method]++;
+				client->stats.total[method] += elapsed;
+				client->stats.max[method] = MAX(client->stats.max[method], elapsed);
+				return status;
+			}
+		}
+		if (client->len >= RTSP_BENCH_BUFFER - 1) {
+			return -1;
+		}
+		gssize got = recv(client->fd, client->buf + client->len, RTSP_BENCH_BUFFER - 1 - client->len, 0);
+		if (got <= 0) {
+			return -1;
+		}
+		client->len += got;
+	}
+}
+
+/* Value of a response header, up to the first ';' */
+static gchar * rtsp_bench_header(const gchar * response, const gchar * name)
+{
+	gchar *line = strstr(response, name);
+	if (line == NULL) {
+		return NULL;
+	}
+	line += strlen(name);
+	while (*line == ' ') {
+		line++;
+	}
+	return g_strndup(line, strcspn(line, ";\r\n"));
+}
+
+static gboolean rtsp_bench_session(rtsp_bench_client * client)
+{
+	gchar *response = NULL, *session = NULL, *headers = NULL;
+	gchar *controls[RTSP_BENCH_MAX_STREAMS] = { NULL };
+	guint streams = 0;
+	gboolean ok = FALSE;
+
+	if (rtsp_bench_request(client, RTSP_BENCH_DESCRIBE, url, "Accept: application/sdp\r\n", &response) != 200) {
+		goto done;
+	}
+	/* Stream controls of the SDP, relative to the URL */
+	for (gchar *a = strstr(response, "a=control:"); a != NULL && streams < RTSP_BENCH_MAX_STREAMS; a = strstr(a + 1, "a=control:")) {
+		gchar *control = g_strndup(a + strlen("a=control:"), strcspn(a + strlen("a=control:"), "\r\n"));
+		if (!strcmp(control, "*")) {
+			g_free(control);
+			continue;
+		}
+		controls[streams++] = g_str_has_prefix(control, "rtsp://") ? control : g_strdup_printf("%s/%s", url, control);
+		if (controls[streams - 1] != control) {
+			g_free(control);
+		}
+	}
+	g_free(response);
+	response = NULL;
+	if (streams == 0) {
+		goto done;
+	}
+
+	for (guint i = 0; i < streams; i++) {
+		headers = g_strdup_printf("Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u\r\n%s%s%s", i * 2, i * 2 + 1,
+			session ? "Session: " : "", session ? session : "", session ? "\r\n" : "");
+		gint status = rtsp_bench_request(client, RTSP_BENCH_SETUP, controls[i], headers, &response);
+		g_free(headers);
+		if (status != 200) {
+			goto done;
+		}
+		if (session == NULL) {
+			session = rtsp_bench_header(response, "Session:");
+		}
+		g_free(response);
+		response = NULL;
+	}
+	if (session == NULL) {
+		goto done;
+	}
+
+	headers = g_strdup_printf("Session: %s\r\nRange: npt=0-\r\n", session);
+	gint status = rtsp_bench_request(client, RTSP_BENCH_PLAY, url, headers, NULL);
+	g_free(headers);
+	if (status != 200) {
+		goto done;
+	}
+
+	headers = g_strdup_printf("Session: %s\r\n", session);
+	status = rtsp_bench_request(client, RTSP_BENCH_TEARDOWN, url, headers, NULL);
+	g_free(headers);
+	ok = status == 200;
+
+done:
+	g_free(response);
+	g_free(session);
+	for (guint i = 0; i < streams; i++) {
+		g_free(controls[i]);
+	}
+	return ok;
+}
+
+static gpointer rtsp_bench_client_thread(gpointer data)
+{
+	rtsp_bench_client *client = (rtsp_bench_client *)data;
+
+	while (g_atomic_int_get(&running)) {
+		client->fd = rtsp_bench_connect();
+		client->len = 0;
+		if (client->fd < 0 || !rtsp_bench_session(client)) {
+			client->stats.failures++;
+		} else {
+			client->stats.sessions++;
+		}
+		if (client->fd >= 0) {
+			close(client->fd);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || !rtsp_bench_parse_url(argv[1])) {
+		fprintf(stderr, "Usage: %s rtsp://host:port/id [clients] [seconds]\n", argv[0]);
+		return 1;
+	}
+	guint clients_count = argc > 2 ? (guint)g_ascii_strtoull(argv[2], NULL, 10) : 16;
+	guint seconds = argc > 3 ? (guint)g_ascii_strtoull(argv[3], NULL, 10) : 10;
+	if (clients_count == 0) {
+		clients_count = 1;
+	}
+	if (seconds == 0) {
+		seconds = 1;
+	}
+
+	rtsp_bench_client *clients = g_new0(rtsp_bench_client, clients_count);
+	GThread **threads = g_new0(GThread *, clients_count);
+	g_atomic_int_set(&running, 1);
+	for (guint i = 0; i < clients_count; i++) {
+		threads[i] = g_thread_new("rtsp client", rtsp_bench_client_thread, &clients[i]);
+	}
+	g_usleep((gulong)seconds * G_USEC_PER_SEC);
+	g_atomic_int_set(&running, 0);
+
+	rtsp_bench_stats total;
+	memset(&total, 0, sizeof(total));
+	for (guint i = 0; i < clients_count; i++) {
+		g_thread_join(threads[i]);
+		for (guint m = 0; m < RTSP_BENCH_METHODS; m++) {
+			total.count[m] += clients[i].stats.count[m];
+			total.total[m] += clients[i].stats.total[m];
+			total.max[m] = MAX(total.max[m], clients[i].stats.max[m]);
+		}
+		total.sessions += clients[i].stats.sessions;
+		total.failures += clients[i].stats.failures;
+	}
+
+	printf("%u clients, %u s: %.1f sessions/s, %"G_GUINT64_FORMAT" failed\n", clients_count, seconds,
+		(double)total.sessions / seconds, total.failures);
+	for (guint m = 0; m < RTSP_BENCH_METHODS; m++) {
+		printf("%-9s %10"G_GUINT64_FORMAT" requests  avg %8.2f ms  max %8.2f ms\n", rtsp_bench_methods[m], total.count[m],
+			total.count[m] ? (double)total.total[m] / total.count[m] / 1000.0 : 0.0, (double)total.max[m] / 1000.0);
+	}
+
+	g_free(threads);
+	g_free(clients);
+	g_free(url);
+	g_free(host);
+	g_free(port);
+	return total.sessions > 0 ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+/* Cost of handling one WebRTC offer: the one-pass sdp_model against the
+ * GRegex helpers it replaced, which compiled a regex for every query.
+ * Both run what the plugin does with an offer: look up the payload type of
+ * each codec in priority order, rewrite the video m-line for the preferred
+ * codec, then read back the video and audio codecs of the answer.
+ *
+ * Usage: sdp_bench [iterations]
+ */
+#include <glib.h>
+#include <string.h>
+#include <stdio.h>
+#include "sdp_utils.h"
+
+/* Chrome offer, sendonly audio and video, trimmed of the candidates */
+static const gchar *chrome_offer =
+	"v=0\r\n"
+	"o=- 4611731400430051336 2 IN IP4 127.0.0.1\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=group:BUNDLE 0 1\r\n"
+	"a=extmap-allow-mixed\r\n"
+	"a=msid-semantic: WMS stream\r\n"
+	"m=audio 9 UDP/TLS/RTP/SAVPF 111 63 103 104 9 0 8 106 105 13 110 112 113 126\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:a2Tn\r\n"
+	"a=ice-pwd:5PZb8hT2G4nPJ4O2vb6kM5mT\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 3A:9B:28:4C:1E:7D:0F:55:6A:B2:9C:44:D1:E8:73:0A:9F:12:6B:C3:58:E4:21:7F:AA:30:4D:96:1B:C8:E5:02\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:0\r\n"
+	"a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=sendonly\r\n"
+	"a=msid:stream audio0\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtpmap:111 opus/48000/2\r\n"
+	"a=rtcp-fb:111 transport-cc\r\n"
+	"a=fmtp:111 minptime=10;useinbandfec=1\r\n"
+	"a=rtpmap:63 red/48000/2\r\n"
+	"a=fmtp:63 111/111\r\n"
+	"a=rtpmap:103 ISAC/16000\r\n"
+	"a=rtpmap:104 ISAC/32000\r\n"
+	"a=rtpmap:9 G722/8000\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:106 CN/32000\r\n"
+	"a=rtpmap:105 CN/16000\r\n"
+	"a=rtpmap:13 CN/8000\r\n"
+	"a=rtpmap:110 telephone-event/48000\r\n"
+	"a=rtpmap:112 telephone-event/32000\r\n"
+	"a=rtpmap:113 telephone-event/16000\r\n"
+	"a=rtpmap:126 telephone-event/8000\r\n"
+	"a=ssrc:1856223512 cname:Zx1mWq3hP9kLr0aB\r\n"
+	"m=video 9 UDP/TLS/RTP/SAVPF 96 97 102 103 104 105 106 107 108 109 127 125 39 40 98 99 100 101 112 113\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=rtcp:9 IN IP4 0.0.0.0\r\n"
+	"a=ice-ufrag:a2Tn\r\n"
+	"a=ice-pwd:5PZb8hT2G4nPJ4O2vb6kM5mT\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=fingerprint:sha-256 3A:9B:28:4C:1E:7D:0F:55:6A:B2:9C:44:D1:E8:73:0A:9F:12:6B:C3:58:E4:21:7F:AA:30:4D:96:1B:C8:E5:02\r\n"
+	"a=setup:actpass\r\n"
+	"a=mid:1\r\n"
+	"a=extmap:14 urn:ietf:params:rtp-hdrext:toffset\r\n"
+	"a=extmap:2 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:13 urn:3gpp:video-orientation\r\n"
+	"a=extmap:3 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=extmap:4 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=sendonly\r\n"
+	"a=msid:stream video0\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtcp-rsize\r\n"
+	"a=rtpmap:96 VP8/90000\r\n"
+	"a=rtcp-fb:96 goog-remb\r\n"
+	"a=rtcp-fb:96 transport-cc\r\n"
+	"a=rtcp-fb:96 ccm fir\r\n"
+	"a=rtcp-fb:96 nack\r\n"
+	"a=rtcp-fb:96 nack pli\r\n"
+	"a=rtpmap:97 rtx/90000\r\n"
+	"a=fmtp:97 apt=96\r\n"
+	"a=rtpmap:102 H264/90000\r\n"
+	"a=rtcp-fb:102 goog-remb\r\n"
+	"a=rtcp-fb:102 transport-cc\r\n"
+	"a=rtcp-fb:102 ccm fir\r\n"
+	"a=rtcp-fb:102 nack\r\n"
+	"a=rtcp-fb:102 nack pli\r\n"
+	"a=fmtp:102 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42001f\r\n"
+	"a=rtpmap:103 rtx/90000\r\n"
+	"a=fmtp:103 apt=102\r\n"
+	"a=rtpmap:104 H264/90000\r\n"
+	"a=rtcp-fb:104 goog-remb\r\n"
+	"a=rtcp-fb:104 transport-cc\r\n"
+	"a=rtcp-fb:104 ccm fir\r\n"
+	"a=rtcp-fb:104 nack\r\n"
+	"a=rtcp-fb:104 nack pli\r\n"
+	"a=fmtp:104 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42001f\r\n"
+	"a=rtpmap:105 rtx/90000\r\n"
+	"a=fmtp:105 apt=104\r\n"
+	"a=rtpmap:106 H264/90000\r\n"
+	"a=rtcp-fb:106 goog-remb\r\n"
+	"a=rtcp-fb:106 transport-cc\r\n"
+	"a=rtcp-fb:106 ccm fir\r\n"
+	"a=rtcp-fb:106 nack\r\n"
+	"a=rtcp-fb:106 nack pli\r\n"
+	"a=fmtp:106 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f\r\n"
+	"a=rtpmap:107 rtx/90000\r\n"
+	"a=fmtp:107 apt=106\r\n"
+	"a=rtpmap:108 H264/90000\r\n"
+	"a=rtcp-fb:108 goog-remb\r\n"
+	"a=rtcp-fb:108 transport-cc\r\n"
+	"a=rtcp-fb:108 ccm fir\r\n"
+	"a=rtcp-fb:108 nack\r\n"
+	"a=rtcp-fb:108 nack pli\r\n"
+	"a=fmtp:108 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=42e01f\r\n"
+	"a=rtpmap:109 rtx/90000\r\n"
+	"a=fmtp:109 apt=108\r\n"
+	"a=rtpmap:127 H264/90000\r\n"
+	"a=rtcp-fb:127 goog-remb\r\n"
+	"a=rtcp-fb:127 transport-cc\r\n"
+	"a=rtcp-fb:127 ccm fir\r\n"
+	"a=rtcp-fb:127 nack\r\n"
+	"a=rtcp-fb:127 nack pli\r\n"
+	"a=fmtp:127 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=4d001f\r\n"
+	"a=rtpmap:125 rtx/90000\r\n"
+	"a=fmtp:125 apt=127\r\n"
+	"a=rtpmap:39 H264/90000\r\n"
+	"a=rtcp-fb:39 goog-remb\r\n"
+	"a=rtcp-fb:39 transport-cc\r\n"
+	"a=rtcp-fb:39 ccm fir\r\n"
+	"a=rtcp-fb:39 nack\r\n"
+	"a=rtcp-fb:39 nack pli\r\n"
+	"a=fmtp:39 level-asymmetry-allowed=1;packetization-mode=0;profile-level-id=4d001f\r\n"
+	"a=rtpmap:40 rtx/90000\r\n"
+	"a=fmtp:40 apt=39\r\n"
+	"a=rtpmap:98 VP9/90000\r\n"
+	"a=rtcp-fb:98 goog-remb\r\n"
+	"a=rtcp-fb:98 transport-cc\r\n"
+	"a=rtcp-fb:98 ccm fir\r\n"
+	"a=rtcp-fb:98 nack\r\n"
+	"a=rtcp-fb:98 nack pli\r\n"
+	"a=fmtp:98 profile-id=0\r\n"
+	"a=rtpmap:99 rtx/90000\r\n"
+	"a=fmtp:99 apt=98\r\n"
+	"a=rtpmap:100 VP9/90000\r\n"
+	"a=rtcp-fb:100 goog-remb\r\n"
+	"a=rtcp-fb:100 transport-cc\r\n"
+	"a=rtcp-fb:100 ccm fir\r\n"
+	"a=rtcp-fb:100 nack\r\n"
+	"a=rtcp-fb:100 nack pli\r\n"
+	"a=fmtp:100 profile-id=2\r\n"
+	"a=rtpmap:101 rtx/90000\r\n"
+	"a=fmtp:101 apt=100\r\n"
+	"a=rtpmap:112 red/90000\r\n"
+	"a=rtpmap:113 ulpfec/90000\r\n"
+	"a=ssrc-group:FID 2231627014 632943048\r\n"
+	"a=ssrc:2231627014 cname:Zx1mWq3hP9kLr0aB\r\n"
+	"a=ssrc:632943048 cname:Zx1mWq3hP9kLr0aB\r\n";
+
+/* Firefox offer, sendonly audio and video, trimmed of the candidates */
+static const gchar *firefox_offer =
+	"v=0\r\n"
+	"o=mozilla...THIS_IS_SDPARTA-99.0 5213907349235786371 0 IN IP4 0.0.0.0\r\n"
+	"s=-\r\n"
+	"t=0 0\r\n"
+	"a=fingerprint:sha-256 D1:4E:07:9A:3C:66:B0:21:8F:5D:E2:73:1A:C9:48:0B:95:2F:6E:D7:13:A8:4C:F0:39:7B:62:E5:0D:84:BA:1F\r\n"
+	"a=group:BUNDLE 0 1\r\n"
+	"a=ice-options:trickle\r\n"
+	"a=msid-semantic:WMS *\r\n"
+	"m=audio 9 UDP/TLS/RTP/SAVPF 109 9 0 8 101\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=sendonly\r\n"
+	"a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+	"a=extmap:2/recvonly urn:ietf:params:rtp-hdrext:csrc-audio-level\r\n"
+	"a=extmap:3 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=fmtp:109 maxplaybackrate=48000;stereo=1;useinbandfec=1\r\n"
+	"a=fmtp:101 0-15\r\n"
+	"a=ice-pwd:0b3c5fd0a4e1c2d97f86b3a5e4c1d2f0\r\n"
+	"a=ice-ufrag:7f3a1c9e\r\n"
+	"a=mid:0\r\n"
+	"a=msid:{5d1c3a7e-2b9f-4e60-8c1d-7a3f0b2e9c41} {8e2f4b6a-1c3d-4f5e-9a7b-0c2d4e6f8a1b}\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtpmap:109 opus/48000/2\r\n"
+	"a=rtpmap:9 G722/8000/1\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:101 telephone-event/8000/1\r\n"
+	"a=setup:actpass\r\n"
+	"a=ssrc:2870147163 cname:{b5a3c1d7-9e2f-4a60-8b1c-3d5e7f9a1b2c}\r\n"
+	"m=video 9 UDP/TLS/RTP/SAVPF 120 124 121 125 126 127 97 98\r\n"
+	"c=IN IP4 0.0.0.0\r\n"
+	"a=sendonly\r\n"
+	"a=extmap:3 urn:ietf:params:rtp-hdrext:sdes:mid\r\n"
+	"a=extmap:4 http://www.webrtc.org/experiments/rtp-hdrext/abs-send-time\r\n"
+	"a=extmap:5 urn:ietf:params:rtp-hdrext:toffset\r\n"
+	"a=extmap:6/recvonly http://www.webrtc.org/experiments/rtp-hdrext/playout-delay\r\n"
+	"a=extmap:7 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01\r\n"
+	"a=fmtp:126 profile-level-id=42e01f;level-asymmetry-allowed=1;packetization-mode=1\r\n"
+	"a=fmtp:97 profile-level-id=42e01f;level-asymmetry-allowed=1\r\n"
+	"a=fmtp:120 max-fs=12288;max-fr=60\r\n"
+	"a=fmtp:124 apt=120\r\n"
+	"a=fmtp:121 max-fs=12288;max-fr=60\r\n"
+	"a=fmtp:125 apt=121\r\n"
+	"a=fmtp:127 apt=126\r\n"
+	"a=fmtp:98 apt=97\r\n"
+	"a=ice-pwd:0b3c5fd0a4e1c2d97f86b3a5e4c1d2f0\r\n"
+	"a=ice-ufrag:7f3a1c9e\r\n"
+	"a=mid:1\r\n"
+	"a=msid:{5d1c3a7e-2b9f-4e60-8c1d-7a3f0b2e9c41} {3c5e7a9b-2d4f-4a6c-8e0b-1d3f5a7c9e2b}\r\n"
+	"a=rtcp-fb:120 nack\r\n"
+	"a=rtcp-fb:120 nack pli\r\n"
+	"a=rtcp-fb:120 ccm fir\r\n"
+	"a=rtcp-fb:120 goog-remb\r\n"
+	"a=rtcp-fb:120 transport-cc\r\n"
+	"a=rtcp-fb:121 nack\r\n"
+	"a=rtcp-fb:121 nack pli\r\n"
+	"a=rtcp-fb:121 ccm fir\r\n"
+	"a=rtcp-fb:121 goog-remb\r\n"
+	"a=rtcp-fb:121 transport-cc\r\n"
+	"a=rtcp-fb:126 nack\r\n"
+	"a=rtcp-fb:126 nack pli\r\n"
+	"a=rtcp-fb:126 ccm fir\r\n"
+	"a=rtcp-fb:126 goog-remb\r\n"
+	"a=rtcp-fb:126 transport-cc\r\n"
+	"a=rtcp-fb:97 nack\r\n"
+	"a=rtcp-fb:97 nack pli\r\n"
+	"a=rtcp-fb:97 ccm fir\r\n"
+	"a=rtcp-fb:97 goog-remb\r\n"
+	"a=rtcp-fb:97 transport-cc\r\n"
+	"a=rtcp-mux\r\n"
+	"a=rtcp-rsize\r\n"
+	"a=rtpmap:120 VP8/90000\r\n"
+	"a=rtpmap:124 rtx/90000\r\n"
+	"a=rtpmap:121 VP9/90000\r\n"
+	"a=rtpmap:125 rtx/90000\r\n"
+	"a=rtpmap:126 H264/90000\r\n"
+	"a=rtpmap:127 rtx/90000\r\n"
+	"a=rtpmap:97 H264/90000\r\n"
+	"a=rtpmap:98 rtx/90000\r\n"
+	"a=setup:actpass\r\n"
+	"a=ssrc:3412769071 cname:{b5a3c1d7-9e2f-4a60-8b1c-3d5e7f9a1b2c}\r\n"
+	"a=ssrc:1729402648 cname:{b5a3c1d7-9e2f-4a60-8b1c-3d5e7f9a1b2c}\r\n"
+	"a=ssrc-group:FID 3412769071 1729402648\r\n";
+
+static const idilia_codec sdp_bench_priority[] = { IDILIA_CODEC_H264, IDILIA_CODEC_VP8, IDILIA_CODEC_VP9 };
+
+/* The GRegex helpers as they were before sdp_model, only renamed */
+
+static gchar * regex_str_replace_once(const gchar * input, const gchar * old_string, const gchar * new_string)
+{
+	gchar * result = NULL;
+	gchar * first_occurence = strstr(input, old_string);
+
+	if (first_occurence) {
+		gchar * prefix = g_strndup(input, first_occurence - input);
+		gchar * postfix = first_occurence + strlen(old_string);
+		result = g_strconcat(prefix, new_string, postfix, NULL);
+		g_free(prefix);
+	}
+
+	return result;
+}
+
+static gint regex_get_codec_pt(const gchar * sdp, idilia_codec codec)
+{
+	gint pt = -1;
+	const gchar * codec_str = get_codec_name(codec);
+	gchar * expr_str = g_strdup_printf("a=rtpmap:[0-9]+[ \t]+%s/", codec_str);
+
+	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
+	g_free(expr_str);
+
+	if (regex != NULL) {
+		GMatchInfo *matchInfo;
+		g_regex_match(regex, sdp, 0, &matchInfo);
+
+		if (g_match_info_matches(matchInfo)) {
+			gchar *result = g_match_info_fetch(matchInfo, 0);
+
+			if (result) {
+				gchar * sscanf_str = g_strdup_printf("a=rtpmap:%%d%%*[ \t]%s/", codec_str);
+				sscanf(result, sscanf_str, &pt);
+
+				g_free(sscanf_str);
+				g_free(result);
+			}
+		}
+		g_match_info_free(matchInfo);
+		g_regex_unref(regex);
+	}
+
+	return pt;
+}
+
+static gint regex_get_codec_pt_for_type(const gchar * sdp, const gchar * type)
+{
+	gchar * expr_str = g_strdup_printf("m=%s[ \t]+[0-9]+[ \t]+UDP/TLS/RTP/SAVPF[ \t]+[0-9]+", type);
+	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
+	gint codec_pt = -1;
+
+	g_free(expr_str);
+
+	if (regex != NULL) {
+		GMatchInfo *matchInfo;
+		g_regex_match(regex, sdp, 0, &matchInfo);
+
+		if (g_match_info_matches(matchInfo)) {
+			gchar *result = g_match_info_fetch(matchInfo, 0);
+
+			if (result) {
+				gchar * sscanf_str = g_strdup_printf("m=%s%%*[ \t]%%*d%%*[ \t]UDP/TLS/RTP/SAVPF%%*[ \t]%%d", type);
+				sscanf(result, sscanf_str, &codec_pt);
+
+				g_free(sscanf_str);
+				g_free(result);
+			}
+		}
+		g_match_info_free(matchInfo);
+		g_regex_unref(regex);
+	}
+
+	return codec_pt;
+}
+
+static idilia_codec regex_pt_to_codec_id(const char * sdp, gint pt)
+{
+	gchar *name = NULL;
+	gchar * expr_str = g_strdup_printf("a=rtpmap:%d[ \t]+[a-zA-Z0-9]+", pt);
+	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
+
+	g_free(expr_str);
+
+	if (regex != NULL) {
+		GMatchInfo *matchInfo;
+		g_regex_match(regex, sdp, 0, &matchInfo);
+
+		if (g_match_info_matches(matchInfo)) {
+			gchar *result = g_match_info_fetch(matchInfo, 0);
+
+			if (result) {
+				gchar * sscanf_str = g_strdup_printf("a=rtpmap:%d%%*[ \t]%%s", pt);
+				name = g_malloc(strlen(result));
+				sscanf(result, sscanf_str, name);
+				g_free(sscanf_str);
+				g_free(result);
+			}
+		}
+		g_match_info_free(matchInfo);
+		g_regex_unref(regex);
+	}
+
+	idilia_codec codec = sdp_codec_name_to_id(name);
+	g_free(name);
+
+	return codec;
+}
+
+static gchar * regex_set_video_codec(const gchar * sdp_offer, idilia_codec video_codec)
+{
+	gchar * sdp_answer = NULL;
+	gint current_codec_pt = regex_get_codec_pt_for_type(sdp_offer, "video");
+	gint desired_codec_pt = regex_get_codec_pt(sdp_offer, video_codec);
+
+	if (current_codec_pt == desired_codec_pt || video_codec == IDILIA_CODEC_INVALID) {
+		return g_strdup(sdp_offer);
+	}
+
+	GRegex *regex = g_regex_new("m=video[ \t]+[0-9]+[ \t]+UDP/TLS/RTP/SAVPF[ \t]+[0-9]+[ \t]+[0-9]+", 0, 0, NULL);
+	gint codec1 = -1, codec2 = -1;
+	gint port_video = -1;
+	if (regex != NULL) {
+		GMatchInfo *matchInfo;
+		g_regex_match(regex, sdp_offer, 0, &matchInfo);
+
+		if (g_match_info_matches(matchInfo)) {
+			gchar *result = g_match_info_fetch(matchInfo, 0);
+
+			if (result) {
+				sscanf(result, "m=video%*[ \t]%d%*[ \t]UDP/TLS/RTP/SAVPF%*[ \t]%d%*[ \t]%d", &port_video, &codec1, &codec2);
+				if (codec2 != desired_codec_pt) {
+					codec1 = codec2;
+				}
+
+				gchar *new_line = g_strdup_printf("m=video %d UDP/TLS/RTP/SAVPF %d %d", port_video, desired_codec_pt, codec1);
+				sdp_answer = regex_str_replace_once(sdp_offer, result, new_line);
+
+				g_free(new_line);
+				g_free(result);
+			}
+		} else {
+			sdp_answer = g_strdup(sdp_offer);
+		}
+		g_match_info_free(matchInfo);
+		g_regex_unref(regex);
+	}
+
+	return sdp_answer;
+}
+
+static idilia_codec sdp_bench_regex(const gchar * offer)
+{
+	idilia_codec preferred = IDILIA_CODEC_INVALID;
+	for (guint i = 0; i < G_N_ELEMENTS(sdp_bench_priority); i++) {
+		if (regex_get_codec_pt(offer, sdp_bench_priority[i]) != -1) {
+			preferred = sdp_bench_priority[i];
+			break;
+		}
+	}
+
+	gchar *answer = regex_set_video_codec(offer, preferred);
+	idilia_codec video = regex_pt_to_codec_id(answer, regex_get_codec_pt_for_type(answer, "video"));
+	idilia_codec audio = regex_pt_to_codec_id(answer, regex_get_codec_pt_for_type(answer, "audio"));
+	g_free(answer);
+
+	return audio == IDILIA_CODEC_OPUS ? video : IDILIA_CODEC_INVALID;
+}
+
+static idilia_codec sdp_bench_model(const gchar * offer)
+{
+	sdp_model *model = sdp_parse(offer);
+	idilia_codec preferred = IDILIA_CODEC_INVALID;
+	for (guint i = 0; i < G_N_ELEMENTS(sdp_bench_priority); i++) {
+		if (sdp_model_get_codec_pt(model, sdp_bench_priority[i]) != -1) {
+			preferred = sdp_bench_priority[i];
+			break;
+		}
+	}
+
+	gchar *sdp = sdp_model_set_video_codec(model, preferred);
+	sdp_model_free(model);
+
+	sdp_model *answer = sdp_parse(sdp);
+	idilia_codec video = sdp_model_get_video_codec(answer);
+	idilia_codec audio = sdp_model_get_audio_codec(answer);
+	sdp_model_free(answer);
+	g_free(sdp);
+
+	return audio == IDILIA_CODEC_OPUS ? video : IDILIA_CODEC_INVALID;
+}
+
+static void sdp_bench_run(const gchar * name, const gchar * offer, guint iterations)
+{
+	idilia_codec before = sdp_bench_regex(offer), after = sdp_bench_model(offer);
+	if (before != after) {
+		fprintf(stderr, "%s: GRegex picked %s, sdp_model picked %s\n", name, get_codec_name(before), get_codec_name(after));
+	}
+
+	gint64 start = g_get_monotonic_time();
+	for (guint i = 0; i < iterations; i++) {
+		sdp_bench_regex(offer);
+	}
+	gint64 regex = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (guint i = 0; i < iterations; i++) {
+		sdp_bench_model(offer);
+	}
+	gint64 model = g_get_monotonic_time() - start;
+
+	printf("%-8s %5"G_GSIZE_FORMAT" bytes, video %-4s  GRegex: %8.2f us/offer  sdp_model: %6.2f us/offer\n",
+		name, strlen(offer), get_codec_name(after), (double)regex / iterations, (double)model / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	guint iterations = argc > 1 ? (guint)g_ascii_strtoull(argv[1], NULL, 10) : 10000;
+	if (iterations == 0) {
+		iterations = 1;
+	}
+
+	sdp_bench_run("chrome", chrome_offer, iterations);
+	sdp_bench_run("firefox", firefox_offer, iterations);
+	return 0;
+}
@@ -0,0 +1,213 @@
+/* Session churn: handles created and destroyed back to back by several
+ * threads while others look sessions up and a watchdog reclaims them.
+ * "list" is the reclaim the plugin used to do, destroyed sessions appended
+ * to a GList and walked by the watchdog under the sessions mutex. "queue"
+ * is the current one, a time-ordered FIFO under its own mutex popped from
+ * the head, with sessions freed when their last reference goes.
+ *
+ * Usage: session_churn_bench [churn threads] [lookup threads] [seconds]
+ */
+#include <glib.h>
+#include <stdio.h>
+
+#define CHURN_BENCH_GRACE (G_USEC_PER_SEC / 5)
+#define CHURN_BENCH_WATCHDOG_INTERVAL (G_USEC_PER_SEC / 20)
+/* Handles each churn thread keeps alive, the lookups pick among them */
+#define CHURN_BENCH_LIVE 64
+
+typedef struct churn_bench_session {
+	gpointer handle;
+	gint64 destroyed;
+	volatile gint ref;
+} churn_bench_session;
+
+typedef enum churn_bench_mode {
+	CHURN_BENCH_LIST,
+	CHURN_BENCH_QUEUE
+} churn_bench_mode;
+
+static churn_bench_mode mode;
+static volatile gint running = 0;
+static GMutex sessions_mutex;
+static GHashTable *sessions = NULL;
+static GList *old_sessions = NULL;
+static GMutex reclaim_mutex;
+static GQueue reclaim_queue = G_QUEUE_INIT;
+static volatile gsize cycles = 0, lookups = 0, reclaimed = 0;
+static volatile gsize lookup_max = 0;
+
+static void churn_bench_unref(churn_bench_session *session)
+{
+	if (g_atomic_int_dec_and_test(&session->ref)) {
+		g_atomic_pointer_add(&reclaimed, 1);
+		g_free(session->handle);
+		g_free(session);
+	}
+}
+
+static void churn_bench_destroy(gpointer handle)
+{
+	g_mutex_lock(&sessions_mutex);
+	churn_bench_session *session = g_hash_table_lookup(sessions, handle);
+	g_hash_table_remove(sessions, handle);
+	session->destroyed = g_get_monotonic_time();
+	if (mode == CHURN_BENCH_LIST) {
+		old_sessions = g_list_append(old_sessions, session);
+	}
+	g_mutex_unlock(&sessions_mutex);
+
+	if (mode == CHURN_BENCH_QUEUE) {
+		g_mutex_lock(&reclaim_mutex);
+		g_queue_push_tail(&reclaim_queue, session);
+		g_mutex_unlock(&reclaim_mutex);
+	}
+}
+
+static gpointer churn_bench_churn(gpointer data)
+{
+	gpointer live[CHURN_BENCH_LIVE] = { NULL };
+	guint next = 0;
+
+	while (g_atomic_int_get(&running)) {
+		if (live[next] != NULL) {
+			churn_bench_destroy(live[next]);
+		}
+
+		churn_bench_session *session = g_new0(churn_bench_session, 1);
+		session->handle = g_malloc(1);
+		session->ref = 1;
+		g_mutex_lock(&sessions_mutex);
+		g_hash_table_insert(sessions, session->handle, session);
+		g_mutex_unlock(&sessions_mutex);
+		live[next] = session->handle;
+
+		next = (next + 1) % CHURN_BENCH_LIVE;
+		g_atomic_pointer_add(&cycles, 1);
+	}
+
+	for (guint i = 0; i < CHURN_BENCH_LIVE; i++) {
+		if (live[i] != NULL) {
+			churn_bench_destroy(live[i]);
+		}
+	}
+	return NULL;
+}
+
+/* Like a message handler: look the session up and hold it while handling */
+static gpointer churn_bench_lookup(gpointer data)
+{
+	while (g_atomic_int_get(&running)) {
+		gint64 start = g_get_monotonic_time();
+		g_mutex_lock(&sessions_mutex);
+		GHashTableIter iter;
+		gpointer value = NULL;
+		g_hash_table_iter_init(&iter, sessions);
+		churn_bench_session *session = g_hash_table_iter_next(&iter, NULL, &value) ? value : NULL;
+		if (session != NULL) {
+			session = g_hash_table_lookup(sessions, session->handle);
+			g_atomic_int_inc(&session->ref);
+		}
+		g_mutex_unlock(&sessions_mutex);
+		gsize latency = g_get_monotonic_time() - start;
+
+		if (session != NULL) {
+			churn_bench_unref(session);
+		}
+		if (latency > g_atomic_pointer_get(&lookup_max)) {
+			g_atomic_pointer_set(&lookup_max, latency);
+		}
+		g_atomic_pointer_add(&lookups, 1);
+	}
+	return NULL;
+}
+
+static void churn_bench_reclaim(gint64 now)
+{
+	if (mode == CHURN_BENCH_LIST) {
+		g_mutex_lock(&sessions_mutex);
+		GList *sl = old_sessions;
+		while (sl) {
+			churn_bench_session *session = (churn_bench_session *)sl->data;
+			GList *rm = sl;
+			sl = sl->next;
+			if (now - session->destroyed >= CHURN_BENCH_GRACE) {
+				old_sessions = g_list_delete_link(old_sessions, rm);
+				churn_bench_unref(session);
+			}
+		}
+		g_mutex_unlock(&sessions_mutex);
+		return;
+	}
+
+	GSList *expired = NULL;
+	g_mutex_lock(&reclaim_mutex);
+	while (!g_queue_is_empty(&reclaim_queue)) {
+		churn_bench_session *session = (churn_bench_session *)g_queue_peek_head(&reclaim_queue);
+		if (now - session->destroyed < CHURN_BENCH_GRACE) {
+			break;
+		}
+		g_queue_pop_head(&reclaim_queue);
+		expired = g_slist_prepend(expired, session);
+	}
+	g_mutex_unlock(&reclaim_mutex);
+	g_slist_free_full(expired, (GDestroyNotify)churn_bench_unref);
+}
+
+static gpointer churn_bench_watchdog(gpointer data)
+{
+	while (g_atomic_int_get(&running)) {
+		churn_bench_reclaim(g_get_monotonic_time());
+		g_usleep(CHURN_BENCH_WATCHDOG_INTERVAL);
+	}
+	return NULL;
+}
+
+static void churn_bench_run(churn_bench_mode run_mode, guint churners, guint lookupers, guint seconds)
+{
+	GPtrArray *threads = g_ptr_array_new();
+
+	mode = run_mode;
+	sessions = g_hash_table_new(NULL, NULL);
+	cycles = lookups = reclaimed = lookup_max = 0;
+	g_atomic_int_set(&running, 1);
+
+	g_ptr_array_add(threads, g_thread_new("watchdog", churn_bench_watchdog, NULL));
+	for (guint i = 0; i < churners; i++) {
+		g_ptr_array_add(threads, g_thread_new("churn", churn_bench_churn, NULL));
+	}
+	for (guint i = 0; i < lookupers; i++) {
+		g_ptr_array_add(threads, g_thread_new("lookup", churn_bench_lookup, NULL));
+	}
+
+	g_usleep((gulong)seconds * G_USEC_PER_SEC);
+	g_atomic_int_set(&running, 0);
+	for (guint i = 0; i < threads->len; i++) {
+		g_thread_join(g_ptr_array_index(threads, i));
+	}
+	g_ptr_array_free(threads, TRUE);
+
+	printf("%-5s  %10.0f create+destroy/s  %10.0f lookups/s  lookup max %6"G_GSIZE_FORMAT" us  %"G_GSIZE_FORMAT" reclaimed\n",
+		mode == CHURN_BENCH_LIST ? "list" : "queue", (double)cycles / seconds, (double)lookups / seconds,
+		lookup_max, reclaimed);
+
+	/* Whatever is still waiting for its grace period */
+	churn_bench_reclaim(G_MAXINT64);
+	g_hash_table_destroy(sessions);
+}
+
+int main(int argc, char *argv[])
+{
+	guint churners = argc > 1 ? (guint)g_ascii_strtoull(argv[1], NULL, 10) : 4;
+	guint lookupers = argc > 2 ? (guint)g_ascii_strtoull(argv[2], NULL, 10) : 4;
+	guint seconds = argc > 3 ? (guint)g_ascii_strtoull(argv[3], NULL, 10) : 3;
+	if (seconds == 0) {
+		seconds = 1;
+	}
+
+	g_mutex_init(&sessions_mutex);
+	g_mutex_init(&reclaim_mutex);
+
+	churn_bench_run(CHURN_BENCH_LIST, churners, lookupers, seconds);
+	churn_bench_run(CHURN_BENCH_QUEUE, churners, lookupers, seconds);
+	return 0;
+}
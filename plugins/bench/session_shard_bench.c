@@ -0,0 +1,154 @@
+/* Session lookups from many threads, the way the message handlers do
+ * them, with one thread churning sessions in and out of the table. Runs
+ * with the whole table behind one mutex, as it used to be, and split in
+ * shards chosen by the top bits of the handle hash, as it is now.
+ *
+ * Usage: session_shard_bench [lookup threads] [sessions] [seconds]
+ */
+#include <glib.h>
+#include <stdio.h>
+
+/* Same as JANUS_SOURCE_SESSION_SHARDS */
+#define SHARD_BENCH_SHARDS 16
+
+typedef struct shard_bench_shard {
+	GMutex mutex;
+	GHashTable *sessions;
+} shard_bench_shard;
+
+typedef struct shard_bench_session {
+	volatile gint ref;
+} shard_bench_session;
+
+static shard_bench_shard shards[SHARD_BENCH_SHARDS];
+static guint shards_count = 1;
+static gpointer *handles = NULL;
+static guint handles_count = 0;
+static volatile gint running = 0;
+static volatile gsize lookups = 0, churns = 0;
+
+/* Same as janus_source_handle_hash */
+static guint64 shard_bench_hash(gpointer handle)
+{
+	return ((guint64)(guintptr)handle >> 4) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+}
+
+static shard_bench_shard *shard_bench_shard_for(gpointer handle)
+{
+	return &shards[shards_count == 1 ? 0 : shard_bench_hash(handle) >> 60];
+}
+
+static gpointer shard_bench_lookup(gpointer data)
+{
+	guint32 seed = GPOINTER_TO_UINT(data) * 2654435761u + 1;
+	gsize done = 0;
+
+	while (g_atomic_int_get(&running)) {
+		seed = seed * 1664525u + 1013904223u;
+		gpointer handle = handles[seed % handles_count];
+		shard_bench_shard *shard = shard_bench_shard_for(handle);
+		g_mutex_lock(&shard->mutex);
+		shard_bench_session *session = g_hash_table_lookup(shard->sessions, handle);
+		if (session != NULL) {
+			g_atomic_int_inc(&session->ref);
+		}
+		g_mutex_unlock(&shard->mutex);
+		if (session != NULL) {
+			g_atomic_int_add(&session->ref, -1);
+		}
+		done++;
+	}
+
+	g_atomic_pointer_add(&lookups, done);
+	return NULL;
+}
+
+/* Takes sessions out of the table and puts them back, like create and destroy do */
+static gpointer shard_bench_churn(gpointer data)
+{
+	guint next = 0;
+	gsize done = 0;
+
+	while (g_atomic_int_get(&running)) {
+		gpointer handle = handles[next];
+		shard_bench_shard *shard = shard_bench_shard_for(handle);
+		g_mutex_lock(&shard->mutex);
+		gpointer session = g_hash_table_lookup(shard->sessions, handle);
+		g_hash_table_steal(shard->sessions, handle);
+		g_mutex_unlock(&shard->mutex);
+		g_mutex_lock(&shard->mutex);
+		g_hash_table_insert(shard->sessions, handle, session);
+		g_mutex_unlock(&shard->mutex);
+		next = (next + 1) % handles_count;
+		done++;
+	}
+
+	g_atomic_pointer_add(&churns, done);
+	return NULL;
+}
+
+static void shard_bench_run(guint count, guint threads, guint seconds)
+{
+	GThread **workers = g_new0(GThread *, threads);
+
+	shards_count = count;
+	for (guint i = 0; i < shards_count; i++) {
+		g_mutex_init(&shards[i].mutex);
+		shards[i].sessions = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	}
+	for (guint i = 0; i < handles_count; i++) {
+		shard_bench_session *session = g_new0(shard_bench_session, 1);
+		session->ref = 1;
+		g_hash_table_insert(shard_bench_shard_for(handles[i])->sessions, handles[i], session);
+	}
+
+	lookups = churns = 0;
+	g_atomic_int_set(&running, 1);
+	GThread *churn = g_thread_new("churn", shard_bench_churn, NULL);
+	for (guint i = 0; i < threads; i++) {
+		workers[i] = g_thread_new("lookup", shard_bench_lookup, GUINT_TO_POINTER(i));
+	}
+	g_usleep((gulong)seconds * G_USEC_PER_SEC);
+	g_atomic_int_set(&running, 0);
+	for (guint i = 0; i < threads; i++) {
+		g_thread_join(workers[i]);
+	}
+	g_thread_join(churn);
+
+	printf("%2u shard%s  %2u threads  %12.0f lookups/s  %10.0f churns/s\n", shards_count,
+		shards_count == 1 ? " " : "s", threads, (double)lookups / seconds, (double)churns / seconds);
+
+	for (guint i = 0; i < shards_count; i++) {
+		g_hash_table_destroy(shards[i].sessions);
+		g_mutex_clear(&shards[i].mutex);
+	}
+	g_free(workers);
+}
+
+int main(int argc, char *argv[])
+{
+	guint threads = argc > 1 ? (guint)g_ascii_strtoull(argv[1], NULL, 10) : 8;
+	handles_count = argc > 2 ? (guint)g_ascii_strtoull(argv[2], NULL, 10) : 1000;
+	guint seconds = argc > 3 ? (guint)g_ascii_strtoull(argv[3], NULL, 10) : 3;
+	if (handles_count == 0) {
+		handles_count = 1;
+	}
+	if (seconds == 0) {
+		seconds = 1;
+	}
+
+	/* Heap pointers, like the janus_plugin_session handles */
+	handles = g_new(gpointer, handles_count);
+	for (guint i = 0; i < handles_count; i++) {
+		handles[i] = g_malloc(64);
+	}
+
+	shard_bench_run(1, threads, seconds);
+	shard_bench_run(SHARD_BENCH_SHARDS, threads, seconds);
+
+	for (guint i = 0; i < handles_count; i++) {
+		g_free(handles[i]);
+	}
+	g_free(handles);
+	return 0;
+}
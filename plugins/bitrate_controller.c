@@ -0,0 +1,183 @@
+#include <string.h>
+#include "bitrate_controller.h"
+#include "debug.h"
+#include "utils.h"
+
+/* Used as the received rate when congestion comes before the first update */
+#define BITRATE_CONTROLLER_FALLBACK (512 * 1024)
+/* Viewers' loss older than this many intervals no longer counts */
+#define BITRATE_CONTROLLER_VIEWER_LOSS_INTERVALS 5
+
+void bitrate_controller_init(bitrate_controller * bc, const bitrate_controller_config * config)
+{
+	memset(bc, 0, sizeof(bitrate_controller));
+	janus_mutex_init(&bc->mutex);
+	bc->config = *config;
+	bc->config.interval = MAX(bc->config.interval, 100);
+	bc->config.max_bitrate = MAX(bc->config.max_bitrate, bc->config.min_bitrate);
+	bc->state = BITRATE_CONTROLLER_IDLE;
+	bc->last_update = janus_get_monotonic_time();
+}
+
+void bitrate_controller_destroy(bitrate_controller * bc)
+{
+	janus_mutex_destroy(&bc->mutex);
+}
+
+/* Back to leaving the publisher alone, for a new PeerConnection on the same session */
+void bitrate_controller_reset(bitrate_controller * bc)
+{
+	janus_mutex_lock(&bc->mutex);
+	bc->state = BITRATE_CONTROLLER_IDLE;
+	bc->estimate = 0;
+	bc->cap = 0;
+	bc->bytes_prior = 0;
+	bc->expected_prior = 0;
+	bc->received_prior = 0;
+	bc->received_rate = 0;
+	bc->loss = 0.0;
+	bc->viewer_loss = 0.0;
+	bc->viewer_loss_updated = 0;
+	bc->last_update = janus_get_monotonic_time();
+	bc->last_congestion = 0;
+	janus_mutex_unlock(&bc->mutex);
+}
+
+static guint64 bitrate_controller_max_locked(bitrate_controller * bc)
+{
+	return MAX(bc->cap > 0 ? bc->cap : bc->config.max_bitrate, bc->config.min_bitrate);
+}
+
+/* A bitrate set on the session bounds the estimate, it no longer is the estimate itself */
+void bitrate_controller_set_cap(bitrate_controller * bc, guint64 cap)
+{
+	janus_mutex_lock(&bc->mutex);
+	bc->cap = cap;
+	if (bc->estimate > bitrate_controller_max_locked(bc)) {
+		bc->estimate = bitrate_controller_max_locked(bc);
+	}
+	janus_mutex_unlock(&bc->mutex);
+}
+
+/* Multiplicative decrease, from what actually arrives rather than from an estimate the publisher never reached */
+static void bitrate_controller_decrease_locked(bitrate_controller * bc, gdouble loss, gint64 now)
+{
+	guint64 base = bc->received_rate > 0 ? bc->received_rate : BITRATE_CONTROLLER_FALLBACK;
+	if (bc->estimate > 0) {
+		base = MIN(base, bc->estimate);
+	}
+
+	gdouble factor = MIN(bc->config.decrease / 100.0, 1.0 - 0.5 * loss);
+	bc->estimate = CLAMP((guint64)(base * factor), bc->config.min_bitrate, bitrate_controller_max_locked(bc));
+	bc->state = BITRATE_CONTROLLER_HOLDING;
+	bc->last_congestion = now;
+	bc->decreases++;
+}
+
+/* The core sent the publisher a burst of NACKs: back off right away. Returns the new estimate */
+guint64 bitrate_controller_slow_link(bitrate_controller * bc)
+{
+	janus_mutex_lock(&bc->mutex);
+	bc->slow_links++;
+	bitrate_controller_decrease_locked(bc, 0.0, janus_get_monotonic_time());
+	guint64 estimate = bc->estimate;
+	janus_mutex_unlock(&bc->mutex);
+
+	return estimate;
+}
+
+void bitrate_controller_viewer_loss(bitrate_controller * bc, gdouble loss)
+{
+	janus_mutex_lock(&bc->mutex);
+	bc->viewer_loss = loss;
+	bc->viewer_loss_updated = janus_get_monotonic_time();
+	janus_mutex_unlock(&bc->mutex);
+}
+
+/* Loss of the publisher's video since the previous update */
+static gdouble bitrate_controller_interval_loss(bitrate_controller * bc, guint32 expected, guint32 received)
+{
+	guint32 expected_interval = expected - bc->expected_prior;
+	guint32 received_interval = received - bc->received_prior;
+	bc->expected_prior = expected;
+	bc->received_prior = received;
+
+	if (expected_interval == 0 || received_interval >= expected_interval || expected_interval > G_MAXINT32) {
+		return 0.0;
+	}
+	return (gdouble)(expected_interval - received_interval) / expected_interval;
+}
+
+/* Takes the totals of the publisher's media: all the bytes received, and the video packets expected and received.
+ * Runs once per interval, TRUE with the estimate to send once the publisher is under control */
+gboolean bitrate_controller_update(bitrate_controller * bc, guint64 bytes, guint32 expected, guint32 received, guint64 * estimate)
+{
+	gint64 now = janus_get_monotonic_time();
+	gint64 elapsed = now - bc->last_update;
+
+	if (elapsed < (gint64)bc->config.interval * 1000) {
+		return FALSE;
+	}
+
+	janus_mutex_lock(&bc->mutex);
+	bc->last_update = now;
+	bc->received_rate = (bytes - bc->bytes_prior) * 8 * G_USEC_PER_SEC / elapsed;
+	bc->bytes_prior = bytes;
+	bc->loss = bitrate_controller_interval_loss(bc, expected, received);
+
+	gdouble loss = bc->loss;
+	if (bc->viewer_loss_updated > 0 &&
+		now - bc->viewer_loss_updated < (gint64)bc->config.interval * 1000 * BITRATE_CONTROLLER_VIEWER_LOSS_INTERVALS) {
+		loss = MAX(loss, bc->viewer_loss);
+	}
+
+	if (loss * 100 > bc->config.loss_threshold) {
+		bitrate_controller_decrease_locked(bc, loss, now);
+	} else if (bc->state != BITRATE_CONTROLLER_IDLE && now - bc->last_congestion >= (gint64)bc->config.hold * 1000) {
+		/* Additive increase, no further than half again what the publisher currently sends */
+		guint64 probe = bc->estimate + bc->config.increase;
+		if (bc->received_rate > 0) {
+			probe = MIN(probe, MAX(bc->estimate, bc->received_rate * 3 / 2));
+		}
+		probe = MIN(probe, bitrate_controller_max_locked(bc));
+		if (probe > bc->estimate) {
+			bc->increases++;
+		}
+		bc->estimate = probe;
+		bc->state = BITRATE_CONTROLLER_PROBING;
+	}
+
+	gboolean send = bc->state != BITRATE_CONTROLLER_IDLE;
+	*estimate = bc->estimate;
+	janus_mutex_unlock(&bc->mutex);
+
+	return send;
+}
+
+void bitrate_controller_get_stats(bitrate_controller * bc, bitrate_controller_stats * stats)
+{
+	janus_mutex_lock(&bc->mutex);
+	stats->state = bc->state;
+	stats->estimate = bc->estimate;
+	stats->received_rate = bc->received_rate;
+	stats->loss = bc->loss;
+	stats->viewer_loss = bc->viewer_loss;
+	stats->since_congestion = bc->last_congestion > 0 ? janus_get_monotonic_time() - bc->last_congestion : -1;
+	stats->slow_links = bc->slow_links;
+	stats->decreases = bc->decreases;
+	stats->increases = bc->increases;
+	janus_mutex_unlock(&bc->mutex);
+}
+
+const gchar * bitrate_controller_state_name(bitrate_controller_state state)
+{
+	switch (state)
+	{
+	case BITRATE_CONTROLLER_HOLDING:
+		return "holding";
+	case BITRATE_CONTROLLER_PROBING:
+		return "probing";
+	default:
+		return "idle";
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glib.h>
+#include "mutex.h"
+
+/* Tunables shared by all the sessions, bitrates in bps and times in milliseconds */
+typedef struct bitrate_controller_config {
+	guint min_bitrate;
+	guint max_bitrate;
+	guint increase;			/* Added once per interval while probing */
+	guint decrease;			/* Percentage of the received rate kept on congestion */
+	guint loss_threshold;		/* Percentage of loss taken as congestion */
+	guint hold;			/* Time after congestion before probing again */
+	guint interval;			/* Time between two updates, and two REMBs */
+} bitrate_controller_config;
+
+typedef enum
+{
+	BITRATE_CONTROLLER_IDLE = 0,	/* No congestion seen yet, the publisher is left alone */
+	BITRATE_CONTROLLER_HOLDING,	/* Congested recently, the estimate stays put */
+	BITRATE_CONTROLLER_PROBING	/* Conditions are good, the estimate grows additively */
+} bitrate_controller_state;
+
+/* AIMD estimate of the bitrate a publisher can send at, from what arrives of its RTP and from the slow link events */
+typedef struct bitrate_controller {
+	janus_mutex mutex;
+	bitrate_controller_config config;
+	bitrate_controller_state state;
+	guint64 estimate;
+	guint64 cap;			/* Bitrate set on the session, 0 for none */
+	/* Totals of the publisher's media at the last update */
+	guint64 bytes_prior;
+	guint32 expected_prior;
+	guint32 received_prior;
+	guint64 received_rate;
+	gdouble loss;			/* Of the publisher's video over the last interval */
+	gdouble viewer_loss;		/* Folded from the RTSP viewers' reports */
+	gint64 viewer_loss_updated;
+	gint64 last_update;
+	gint64 last_congestion;
+	guint64 slow_links;
+	guint64 decreases;
+	guint64 increases;
+} bitrate_controller;
+
+typedef struct bitrate_controller_stats {
+	bitrate_controller_state state;
+	guint64 estimate;
+	guint64 received_rate;
+	gdouble loss;
+	gdouble viewer_loss;
+	gint64 since_congestion;	/* Microseconds, -1 before the first congestion */
+	guint64 slow_links;
+	guint64 decreases;
+	guint64 increases;
+} bitrate_controller_stats;
+
+void bitrate_controller_init(bitrate_controller * bc, const bitrate_controller_config * config);
+void bitrate_controller_destroy(bitrate_controller * bc);
+void bitrate_controller_reset(bitrate_controller * bc);
+void bitrate_controller_set_cap(bitrate_controller * bc, guint64 cap);
+guint64 bitrate_controller_slow_link(bitrate_controller * bc);
+void bitrate_controller_viewer_loss(bitrate_controller * bc, gdouble loss);
+gboolean bitrate_controller_update(bitrate_controller * bc, guint64 bytes, guint32 expected, guint32 received, guint64 * estimate);
+void bitrate_controller_get_stats(bitrate_controller * bc, bitrate_controller_stats * stats);
+const gchar * bitrate_controller_state_name(bitrate_controller_state state);
@@ -0,0 +1,456 @@
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include "client_queue.h"
+#include "gop_cache.h"
+#include "rtp.h"
+#include "debug.h"
+#include "utils.h"
+
+/* Overflows are counted over this period before a viewer is deemed too slow */
+#define CLIENT_QUEUE_OVERFLOW_WINDOW (10 * G_USEC_PER_SEC)
+
+static gsize queue_budget = 0;
+static guint queue_max_overflows = 0;
+/* Context slow viewers are closed on and backlogs drained from */
+static GMainContext *queue_context = NULL;
+static GList *queues = NULL;
+static janus_mutex queues_mutex;
+
+void client_queue_init(gsize budget, guint max_overflows, GMainContext * context)
+{
+	janus_mutex_init(&queues_mutex);
+
+	queue_budget = budget;
+	queue_max_overflows = max_overflows;
+	queue_context = context;
+
+	if (budget == 0) {
+		JANUS_LOG(LOG_VERB, "RTSP client queues disabled\n");
+		return;
+	}
+	JANUS_LOG(LOG_INFO, "RTSP client queues: %"G_GSIZE_FORMAT" bytes per stream, disconnect after %u overflows\n", budget, max_overflows);
+}
+
+void client_queue_destroy(void)
+{
+	/* Queues still attached go away with their transports */
+	queue_budget = 0;
+	queue_context = NULL;
+}
+
+gboolean client_queue_enabled(void)
+{
+	return queue_budget > 0;
+}
+
+/* Whether the kernel would take more right away, the RTSP watch only gets what it can write without backlogging */
+static gboolean client_queue_writable(client_queue * queue)
+{
+	struct pollfd pfd = { .fd = queue->fd, .events = POLLOUT, .revents = 0 };
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLOUT);
+}
+
+/* Frames nothing else is predicted from: NRI of 0 for H.264, the N bit of the VP8 payload descriptor */
+static gboolean client_queue_is_droppable(idilia_codec codec, char * buf, int len)
+{
+	int plen = 0;
+	guint8 *payload = (guint8 *)janus_rtp_payload(buf, len, &plen);
+
+	if (!payload || plen < 1) {
+		return FALSE;
+	}
+
+	switch (codec)
+	{
+	case IDILIA_CODEC_H264:
+		return (payload[0] & 0x60) == 0;
+	case IDILIA_CODEC_VP8:
+		return (payload[0] & 0x20) != 0;
+	default:
+		return FALSE;
+	}
+}
+
+static guint32 client_queue_get_timestamp(GstBuffer * buffer)
+{
+	guint32 ts = 0;
+	gst_buffer_extract(buffer, 4, &ts, sizeof(ts));
+	return ntohl(ts);
+}
+
+static gboolean client_queue_check(client_queue * queue, GstBuffer * buffer, gboolean droppable)
+{
+	GstMapInfo map;
+	gboolean result = FALSE;
+
+	if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		result = droppable ? client_queue_is_droppable(queue->codec, (char *)map.data, map.size) :
+			gop_cache_is_keyframe(queue->codec, (char *)map.data, map.size);
+		gst_buffer_unmap(buffer, &map);
+	}
+
+	return result;
+}
+
+static void client_queue_write(client_queue * queue, GstBuffer * buffer, guint8 channel)
+{
+	GstRTSPMessage message = { 0 };
+	GstMapInfo map;
+	guint8 *data;
+	guint size;
+
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		return;
+	}
+
+	/* Same interleaved data message the client would have sent */
+	gst_rtsp_message_init_data(&message, channel);
+	gst_rtsp_message_take_body(&message, map.data, map.size);
+	gst_rtsp_client_send_message(queue->client, NULL, &message);
+	gst_rtsp_message_steal_body(&message, &data, &size);
+	gst_buffer_unmap(buffer, &map);
+	gst_rtsp_message_unset(&message);
+}
+
+static void client_queue_write_rtp_locked(client_queue * queue, GstBuffer * buffer)
+{
+	client_queue_write(queue, buffer, queue->channel);
+	queue->sent++;
+	queue->sent_any = TRUE;
+	queue->sent_ts = client_queue_get_timestamp(buffer);
+}
+
+/* Writes the backlog while the kernel takes it, TRUE if the socket can still take more after it */
+static gboolean client_queue_flush_locked(client_queue * queue)
+{
+	GstBuffer *head;
+	gboolean writable = client_queue_writable(queue);
+
+	while (writable && (head = g_queue_pop_head(&queue->packets)) != NULL) {
+		queue->bytes -= gst_buffer_get_size(head);
+		client_queue_write_rtp_locked(queue, head);
+		gst_buffer_unref(head);
+		writable = client_queue_writable(queue);
+	}
+
+	return writable;
+}
+
+static guint client_queue_clear_locked(client_queue * queue)
+{
+	guint count = g_queue_get_length(&queue->packets);
+	GstBuffer *buffer;
+
+	while ((buffer = g_queue_pop_head(&queue->packets)) != NULL) {
+		gst_buffer_unref(buffer);
+	}
+	queue->bytes = 0;
+
+	return count;
+}
+
+/* Brings the backlog back within budget, TRUE when it took an overflow to do so */
+static gboolean client_queue_shed_locked(client_queue * queue)
+{
+	if (queue->codec != IDILIA_CODEC_INVALID) {
+		/* Frames go whole, and only when none of their packets is referenced nor already started */
+		GList *l = queue->packets.head;
+		while (l != NULL && queue->bytes > queue_budget) {
+			guint32 ts = client_queue_get_timestamp(l->data);
+			gboolean droppable = !queue->sent_any || ts != queue->sent_ts;
+			GList *end = l;
+			while (end != NULL && client_queue_get_timestamp(end->data) == ts) {
+				droppable = droppable && client_queue_check(queue, end->data, TRUE);
+				end = end->next;
+			}
+
+			while (droppable && l != end) {
+				GList *next = l->next;
+				GstBuffer *buffer = l->data;
+				queue->bytes -= gst_buffer_get_size(buffer);
+				queue->dropped++;
+				g_queue_delete_link(&queue->packets, l);
+				gst_buffer_unref(buffer);
+				l = next;
+			}
+			l = end;
+		}
+	}
+
+	if (queue->bytes <= queue_budget) {
+		return FALSE;
+	}
+
+	if (queue->codec != IDILIA_CODEC_INVALID) {
+		/* Anything left depends on what came before it, start over from a keyframe */
+		queue->skipped += client_queue_clear_locked(queue);
+		queue->skipping = TRUE;
+	} else {
+		while (queue->bytes > queue_budget / 2) {
+			GstBuffer *buffer = g_queue_pop_head(&queue->packets);
+			queue->bytes -= gst_buffer_get_size(buffer);
+			queue->skipped++;
+			gst_buffer_unref(buffer);
+		}
+	}
+
+	gint64 now = janus_get_monotonic_time();
+	if (now - queue->window_start > CLIENT_QUEUE_OVERFLOW_WINDOW) {
+		queue->window_start = now;
+		queue->window_overflows = 0;
+	}
+	queue->window_overflows++;
+	queue->overflows++;
+
+	return TRUE;
+}
+
+static gboolean client_queue_close_cb(gpointer user_data)
+{
+	GstRTSPClient *client = (GstRTSPClient *)user_data;
+	gst_rtsp_client_close(client);
+	return G_SOURCE_REMOVE;
+}
+
+static void client_queue_unref(gpointer user_data)
+{
+	client_queue *queue = (client_queue *)user_data;
+
+	if (!g_atomic_int_dec_and_test(&queue->ref)) {
+		return;
+	}
+
+	client_queue_clear_locked(queue);
+	if (queue->keyframe_data_free) {
+		queue->keyframe_data_free(queue->keyframe_data);
+	}
+	janus_mutex_destroy(&queue->mutex);
+	g_object_unref(queue->socket);
+	g_free(queue->mount);
+	g_free(queue->address);
+	g_free(queue);
+}
+
+/* The connection has room again: the backlog goes out without waiting for the stream's next packet */
+static gboolean client_queue_drain_cb(GSocket * socket, GIOCondition condition, gpointer user_data)
+{
+	client_queue *queue = (client_queue *)user_data;
+
+	janus_mutex_lock(&queue->mutex);
+	if (!queue->closing && !(condition & (G_IO_ERR | G_IO_HUP))) {
+		client_queue_flush_locked(queue);
+	}
+	gboolean done = queue->closing || (condition & (G_IO_ERR | G_IO_HUP)) || g_queue_is_empty(&queue->packets);
+	if (done && queue->drain_source) {
+		g_source_unref(queue->drain_source);
+		queue->drain_source = NULL;
+	}
+	janus_mutex_unlock(&queue->mutex);
+
+	return done ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+static void client_queue_watch_locked(client_queue * queue)
+{
+	if (queue->drain_source || g_queue_is_empty(&queue->packets)) {
+		return;
+	}
+
+	g_atomic_int_inc(&queue->ref);
+	queue->drain_source = g_socket_create_source(queue->socket, G_IO_OUT, NULL);
+	g_source_set_callback(queue->drain_source, (GSourceFunc)client_queue_drain_cb, queue, client_queue_unref);
+	g_source_attach(queue->drain_source, queue_context);
+}
+
+static gboolean client_queue_send_rtp(GstBuffer * buffer, guint8 channel, gpointer user_data)
+{
+	client_queue *queue = (client_queue *)user_data;
+	gboolean overflow = FALSE, close = FALSE;
+
+	janus_mutex_lock(&queue->mutex);
+
+	if (queue->closing) {
+		janus_mutex_unlock(&queue->mutex);
+		return TRUE;
+	}
+
+	if (queue->skipping) {
+		if (!client_queue_check(queue, buffer, FALSE)) {
+			queue->skipped++;
+			janus_mutex_unlock(&queue->mutex);
+			return TRUE;
+		}
+		queue->skipping = FALSE;
+	}
+
+	queue->channel = channel;
+	if (client_queue_flush_locked(queue)) {
+		client_queue_write_rtp_locked(queue, buffer);
+	} else {
+		g_queue_push_tail(&queue->packets, gst_buffer_ref(buffer));
+		queue->bytes += gst_buffer_get_size(buffer);
+		queue->max_bytes = MAX(queue->max_bytes, queue->bytes);
+
+		if (queue->bytes > queue_budget) {
+			overflow = client_queue_shed_locked(queue);
+			close = overflow && queue_max_overflows > 0 && queue->window_overflows >= queue_max_overflows;
+		}
+		client_queue_watch_locked(queue);
+	}
+
+	if (close) {
+		queue->closing = TRUE;
+		client_queue_clear_locked(queue);
+	}
+
+	janus_mutex_unlock(&queue->mutex);
+
+	if (close) {
+		JANUS_LOG(LOG_WARN, "RTSP viewer %s of %s overflowed %u times, disconnecting it\n",
+			queue->address, queue->mount, queue_max_overflows);
+		/* The client is closed from the server's context, not from the streaming thread */
+		GSource *source = g_idle_source_new();
+		g_source_set_callback(source, client_queue_close_cb, g_object_ref(queue->client), g_object_unref);
+		g_source_attach(source, queue_context);
+		g_source_unref(source);
+	} else if (overflow && queue->skipping && queue->keyframe_func) {
+		JANUS_LOG(LOG_VERB, "RTSP viewer %s of %s fell behind, skipping to the next keyframe\n", queue->address, queue->mount);
+		queue->keyframe_func(queue->keyframe_data);
+	}
+
+	return TRUE;
+}
+
+/* RTCP is small and rare, it goes out as is */
+static gboolean client_queue_send_rtcp(GstBuffer * buffer, guint8 channel, gpointer user_data)
+{
+	client_queue *queue = (client_queue *)user_data;
+
+	janus_mutex_lock(&queue->mutex);
+	if (!queue->closing) {
+		client_queue_write(queue, buffer, channel);
+	}
+	janus_mutex_unlock(&queue->mutex);
+
+	return TRUE;
+}
+
+/* The transport is gone along with its client, a drain in progress finds the queue closing */
+static void client_queue_release(gpointer user_data)
+{
+	client_queue *queue = (client_queue *)user_data;
+
+	janus_mutex_lock(&queues_mutex);
+	queues = g_list_remove(queues, queue);
+	janus_mutex_unlock(&queues_mutex);
+
+	JANUS_LOG(LOG_VERB, "RTSP viewer %s of %s: %"SCNu64" packets sent, %"SCNu64" dropped, %"SCNu64" skipped, %"SCNu64" overflows\n",
+		queue->address, queue->mount, queue->sent, queue->dropped, queue->skipped, queue->overflows);
+
+	janus_mutex_lock(&queue->mutex);
+	queue->closing = TRUE;
+	client_queue_clear_locked(queue);
+	GSource *drain_source = queue->drain_source;
+	queue->drain_source = NULL;
+	janus_mutex_unlock(&queue->mutex);
+
+	if (drain_source) {
+		g_source_destroy(drain_source);
+		g_source_unref(drain_source);
+	}
+	client_queue_unref(queue);
+}
+
+/* Puts a queue between the shared media and a TCP viewer's stream, in place of the client's own callbacks */
+void client_queue_attach(GstRTSPClient * client, GstRTSPStreamTransport * trans, const gchar * mount, idilia_codec codec,
+	client_queue_keyframe_func keyframe_func, gpointer keyframe_data, GDestroyNotify keyframe_data_free)
+{
+	GstRTSPConnection *conn = gst_rtsp_client_get_connection(client);
+	GSocket *socket = conn ? gst_rtsp_connection_get_write_socket(conn) : NULL;
+	gboolean attached = FALSE;
+
+	janus_mutex_lock(&queues_mutex);
+	for (GList *l = queues; l != NULL && !attached; l = l->next) {
+		attached = ((client_queue *)l->data)->trans == trans;
+	}
+	janus_mutex_unlock(&queues_mutex);
+
+	if (!client_queue_enabled() || !socket || attached) {
+		/* A PLAY after a PAUSE finds the queue in place */
+		if (keyframe_data_free) {
+			keyframe_data_free(keyframe_data);
+		}
+		return;
+	}
+
+	client_queue *queue = g_new0(client_queue, 1);
+	queue->ref = 1;
+	janus_mutex_init(&queue->mutex);
+	queue->client = client;
+	queue->trans = trans;
+	queue->socket = g_object_ref(socket);
+	queue->fd = g_socket_get_fd(socket);
+	queue->mount = g_strdup(mount);
+	queue->address = g_strdup(gst_rtsp_connection_get_ip(conn));
+	queue->codec = codec;
+	g_queue_init(&queue->packets);
+	queue->keyframe_func = keyframe_func;
+	queue->keyframe_data = keyframe_data;
+	queue->keyframe_data_free = keyframe_data_free;
+
+	janus_mutex_lock(&queues_mutex);
+	queues = g_list_prepend(queues, queue);
+	janus_mutex_unlock(&queues_mutex);
+
+	JANUS_LOG(LOG_VERB, "Queueing %s to RTSP viewer %s of %s\n", codec != IDILIA_CODEC_INVALID ? "video" : "audio", queue->address, mount);
+	/* The client's own callbacks wait for room in its watch backlog, which holds up the shared media's
+	 * streaming thread for every viewer: that back-pressure is given up, the budget and the overflow
+	 * limit above bound a slow viewer instead */
+	gst_rtsp_stream_transport_set_callbacks(trans, client_queue_send_rtp, client_queue_send_rtcp, queue, client_queue_release);
+#if GST_CHECK_VERSION(1, 16, 0)
+	/* Buffer lists then fall back to the per-buffer callbacks above */
+	gst_rtsp_stream_transport_set_list_callbacks(trans, NULL, NULL, NULL, NULL);
+#endif
+}
+
+/* Stats of the viewers of mount, to be freed with client_queue_stats_free */
+GList * client_queue_get_stats(const gchar * mount)
+{
+	GList *result = NULL;
+
+	janus_mutex_lock(&queues_mutex);
+	for (GList *l = queues; l != NULL; l = l->next) {
+		client_queue *queue = (client_queue *)l->data;
+		if (g_strcmp0(queue->mount, mount) != 0) {
+			continue;
+		}
+
+		client_queue_stats *stats = g_new0(client_queue_stats, 1);
+		janus_mutex_lock(&queue->mutex);
+		stats->address = g_strdup(queue->address);
+		stats->video = queue->codec != IDILIA_CODEC_INVALID;
+		stats->backlog_packets = g_queue_get_length(&queue->packets);
+		stats->backlog_bytes = queue->bytes;
+		stats->max_bytes = queue->max_bytes;
+		stats->sent = queue->sent;
+		stats->dropped = queue->dropped;
+		stats->skipped = queue->skipped;
+		stats->overflows = queue->overflows;
+		if (ioctl(queue->fd, SIOCOUTQ, &stats->socket_bytes) < 0) {
+			stats->socket_bytes = -1;
+		}
+		janus_mutex_unlock(&queue->mutex);
+
+		result = g_list_prepend(result, stats);
+	}
+	janus_mutex_unlock(&queues_mutex);
+
+	return result;
+}
+
+void client_queue_stats_free(client_queue_stats * stats)
+{
+	g_free(stats->address);
+	g_free(stats);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include "mutex.h"
+#include "sdp_utils.h"
+
+typedef void (*client_queue_keyframe_func)(gpointer user_data);
+
+/* Interleaved RTP of one stream to one RTSP-over-TCP viewer, held back while its socket cannot take more */
+typedef struct client_queue {
+	volatile gint ref;		/* One for the transport, one for the writable watch while there is one */
+	janus_mutex mutex;
+	GstRTSPClient *client;
+	GstRTSPStreamTransport *trans;
+	GSocket *socket;		/* Write end of the viewer's connection */
+	int fd;
+	GSource *drain_source;		/* Watches the connection for room while there is a backlog */
+	guint8 channel;			/* Interleaved channel of the RTP */
+	gboolean sent_any;
+	guint32 sent_ts;		/* RTP timestamp of the last packet written, that frame is never dropped */
+	gchar *mount;
+	gchar *address;
+	idilia_codec codec;		/* IDILIA_CODEC_INVALID for audio, which is never skipped */
+	GQueue packets;
+	gsize bytes;
+	gsize max_bytes;
+	gboolean skipping;		/* Over budget, waiting for the next keyframe */
+	gint64 window_start;		/* Start of the period overflows are counted over */
+	guint window_overflows;
+	gboolean closing;
+	guint64 sent;
+	guint64 dropped;		/* Packets of non-reference frames discarded from the backlog */
+	guint64 skipped;		/* Packets discarded up to the next keyframe */
+	guint64 overflows;
+	client_queue_keyframe_func keyframe_func;
+	gpointer keyframe_data;
+	GDestroyNotify keyframe_data_free;
+} client_queue;
+
+typedef struct client_queue_stats {
+	gchar *address;
+	gboolean video;
+	guint backlog_packets;
+	gsize backlog_bytes;
+	gsize max_bytes;
+	gint socket_bytes;		/* Written to the socket but not sent yet */
+	guint64 sent;
+	guint64 dropped;
+	guint64 skipped;
+	guint64 overflows;
+} client_queue_stats;
+
+void client_queue_init(gsize budget, guint max_overflows, GMainContext * context);
+void client_queue_destroy(void);
+gboolean client_queue_enabled(void);
+
+void client_queue_attach(GstRTSPClient * client, GstRTSPStreamTransport * trans, const gchar * mount, idilia_codec codec,
+	client_queue_keyframe_func keyframe_func, gpointer keyframe_data, GDestroyNotify keyframe_data_free);
+GList * client_queue_get_stats(const gchar * mount);
+void client_queue_stats_free(client_queue_stats * stats);
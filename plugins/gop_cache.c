@@ -0,0 +1,227 @@
+#include <arpa/inet.h>
+#include "gop_cache.h"
+#include "rtp.h"
+#include "debug.h"
+
+gboolean gop_cache_is_keyframe(idilia_codec codec, char * buf, int len)
+{
+	int plen = 0;
+	guint8 *payload = (guint8 *)janus_rtp_payload(buf, len, &plen);
+
+	if (!payload || plen < 1) {
+		return FALSE;
+	}
+
+	switch (codec)
+	{
+	case IDILIA_CODEC_VP8: {
+		/* Payload descriptor (RFC 7741), then the payload header of the first partition: P bit clear on keyframes */
+		gboolean start = (payload[0] & 0x10) && (payload[0] & 0x07) == 0;
+		int offset = 1;
+		if (payload[0] & 0x80) {
+			if (plen < 2) {
+				return FALSE;
+			}
+			guint8 ext = payload[1];
+			offset = 2;
+			if (ext & 0x80) {
+				if (plen <= offset) {
+					return FALSE;
+				}
+				offset += (payload[offset] & 0x80) ? 2 : 1;
+			}
+			if (ext & 0x40) {
+				offset++;
+			}
+			if (ext & 0x30) {
+				offset++;
+			}
+		}
+		return start && plen > offset && (payload[offset] & 0x01) == 0;
+	}
+	case IDILIA_CODEC_VP9:
+		/* Start of a frame which is not inter-picture predicted */
+		return (payload[0] & 0x08) && !(payload[0] & 0x40);
+	case IDILIA_CODEC_H264: {
+		guint8 nal = payload[0] & 0x1f;
+		if (nal == 24 && plen > 3) {
+			/* STAP-A, look at the first aggregated NAL */
+			nal = payload[3] & 0x1f;
+		} else if (nal == 28) {
+			/* FU-A, only its first fragment starts the frame */
+			return plen > 1 && (payload[1] & 0x80) && (payload[1] & 0x1f) == 5;
+		}
+		return nal == 5 || nal == 7;
+	}
+	default:
+		return FALSE;
+	}
+}
+
+static void gop_cache_clear_locked(gop_cache * cache)
+{
+	GstBuffer *buffer;
+
+	while ((buffer = g_queue_pop_head(&cache->packets)) != NULL) {
+		gst_buffer_unref(buffer);
+	}
+	cache->bytes = 0;
+	cache->caching = FALSE;
+	cache->keyframe_pending = FALSE;
+}
+
+GstPadProbeReturn gop_cache_sink_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	gop_cache *cache = (gop_cache *)user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+		/* The payloader pushes this frame's packets from this very call, the src probe picks the flag up */
+		janus_mutex_lock(&cache->mutex);
+		cache->keyframe_pending = TRUE;
+		janus_mutex_unlock(&cache->mutex);
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn gop_cache_src_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	gop_cache *cache = (gop_cache *)user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	gsize size = gst_buffer_get_size(buffer);
+	gboolean keyframe = FALSE;
+	guint32 ts = 0;
+
+	if (!g_atomic_int_get(&cache->enabled)) {
+		return GST_PAD_PROBE_OK;
+	}
+
+	janus_mutex_lock(&cache->mutex);
+
+	if (cache->passthrough) {
+		GstMapInfo map;
+		if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+			if (map.size >= RTP_HEADER_SIZE) {
+				ts = ntohl(((rtp_header *)map.data)->timestamp);
+				/* Parameter sets and the IDR following them belong to the same GOP */
+				keyframe = gop_cache_is_keyframe(cache->codec, (char *)map.data, map.size) &&
+					!(cache->caching && ts == cache->gop_ts);
+			}
+			gst_buffer_unmap(buffer, &map);
+		}
+	} else {
+		keyframe = cache->keyframe_pending;
+		cache->keyframe_pending = FALSE;
+	}
+
+	if (keyframe) {
+		gop_cache_clear_locked(cache);
+		cache->caching = TRUE;
+		cache->gop_ts = ts;
+	}
+
+	if (cache->caching) {
+		if (cache->bytes + size > cache->budget) {
+			/* A partial GOP is of no use to a new viewer */
+			JANUS_LOG(LOG_VERB, "GOP over the %"G_GSIZE_FORMAT" bytes budget, not cached\n", cache->budget);
+			gop_cache_clear_locked(cache);
+		} else {
+			g_queue_push_tail(&cache->packets, gst_buffer_ref(buffer));
+			cache->bytes += size;
+		}
+	}
+
+	janus_mutex_unlock(&cache->mutex);
+
+	return GST_PAD_PROBE_OK;
+}
+
+void gop_cache_init(gop_cache * cache, idilia_codec codec, gsize budget, gboolean enabled)
+{
+	janus_mutex_init(&cache->mutex);
+	g_queue_init(&cache->packets);
+	cache->codec = codec;
+	cache->budget = budget;
+	cache->bytes = 0;
+	cache->caching = FALSE;
+	cache->keyframe_pending = FALSE;
+	g_atomic_int_set(&cache->enabled, enabled);
+}
+
+void gop_cache_destroy(gop_cache * cache)
+{
+	gop_cache_clear(cache);
+	janus_mutex_destroy(&cache->mutex);
+}
+
+void gop_cache_clear(gop_cache * cache)
+{
+	janus_mutex_lock(&cache->mutex);
+	gop_cache_clear_locked(cache);
+	janus_mutex_unlock(&cache->mutex);
+}
+
+void gop_cache_set_enabled(gop_cache * cache, gboolean enabled)
+{
+	g_atomic_int_set(&cache->enabled, enabled);
+	if (!enabled) {
+		gop_cache_clear(cache);
+	}
+}
+
+/* A new media starts from scratch */
+void gop_cache_reset(gop_cache * cache, gboolean passthrough)
+{
+	janus_mutex_lock(&cache->mutex);
+	gop_cache_clear_locked(cache);
+	cache->passthrough = passthrough;
+	janus_mutex_unlock(&cache->mutex);
+}
+
+GList * gop_cache_snapshot(gop_cache * cache)
+{
+	GList *burst = NULL;
+
+	janus_mutex_lock(&cache->mutex);
+	if (cache->caching) {
+		for (GList *l = cache->packets.tail; l != NULL; l = l->prev) {
+			burst = g_list_prepend(burst, gst_buffer_ref(l->data));
+		}
+	}
+	janus_mutex_unlock(&cache->mutex);
+
+	return burst;
+}
+
+/* Sequence number and timestamp of the first packet a snapshot would start with */
+gboolean gop_cache_get_start(gop_cache * cache, guint16 * seq, guint32 * ts)
+{
+	gboolean found = FALSE;
+
+	janus_mutex_lock(&cache->mutex);
+	GstBuffer *first = cache->caching ? g_queue_peek_head(&cache->packets) : NULL;
+	GstMapInfo map;
+	if (first && gst_buffer_map(first, &map, GST_MAP_READ)) {
+		if (map.size >= RTP_HEADER_SIZE) {
+			*seq = ntohs(((rtp_header *)map.data)->seq_number);
+			*ts = ntohl(((rtp_header *)map.data)->timestamp);
+			found = TRUE;
+		}
+		gst_buffer_unmap(first, &map);
+	}
+	janus_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+gsize gop_cache_get_bytes(gop_cache * cache)
+{
+	gsize bytes;
+
+	janus_mutex_lock(&cache->mutex);
+	bytes = cache->bytes;
+	janus_mutex_unlock(&cache->mutex);
+
+	return bytes;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <gst/gst.h>
+#include "mutex.h"
+#include "sdp_utils.h"
+
+/* Payloaded RTP from the last keyframe onward, replayed to viewers joining a shared media */
+typedef struct gop_cache {
+	janus_mutex mutex;
+	volatile gint enabled;
+	idilia_codec codec;
+	gsize budget;			/* Bytes, a GOP growing past it is dropped until the next keyframe */
+	gboolean passthrough;		/* No depayloader to flag keyframes, they are spotted in the RTP payload */
+	GQueue packets;
+	gsize bytes;
+	gboolean caching;		/* Inside a GOP that still fits the budget */
+	guint32 gop_ts;			/* RTP timestamp of the keyframe the GOP started with */
+	gboolean keyframe_pending;	/* The depayloader flagged the frame being payloaded as a keyframe */
+} gop_cache;
+
+void gop_cache_init(gop_cache * cache, idilia_codec codec, gsize budget, gboolean enabled);
+void gop_cache_destroy(gop_cache * cache);
+void gop_cache_clear(gop_cache * cache);
+void gop_cache_set_enabled(gop_cache * cache, gboolean enabled);
+void gop_cache_reset(gop_cache * cache, gboolean passthrough);
+/* Buffer probes of the payloader, the sink one is only needed when not in passthrough */
+GstPadProbeReturn gop_cache_sink_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+GstPadProbeReturn gop_cache_src_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+GList * gop_cache_snapshot(gop_cache * cache);
+gboolean gop_cache_get_start(gop_cache * cache, guint16 * seq, guint32 * ts);
+gsize gop_cache_get_bytes(gop_cache * cache);
+gboolean gop_cache_is_keyframe(idilia_codec codec, char * buf, int len);
@@ -1,17 +1,23 @@
 #include "debug.h"
 #include "gst_utils.h"
 #include "idilia_source_common.h"
-#include "audio_video_defines.h"
 #include "node_service_access.h"
 #include "rtsp_server.h"
 #include "rtsp_clients_utils.h"
 #include "socket_names.h"
+#include "pipeline_pool.h"
+#include "pipeline_builder.h"
+
+/* Factory data: the builder input of its medias, and the pooled pipeline the first one is built from */
+#define PIPELINE_PARAMS_KEY "janus-source-pipeline-params"
+#define POOLED_ELEMENT_KEY "janus-source-pooled-element"
 
 static GstSDPMessage * create_sdp(GstRTSPClient * client, GstRTSPMedia * media);
-static gchar * janus_source_create_launch_pipe(janus_source_session * session, pipeline_callback_data_t * data);
 static void media_configure_cb(GstRTSPMediaFactory * factory, GstRTSPMedia * media, pipeline_callback_data_t * data);
 static void client_connected_cb(GstRTSPServer *gstrtspserver, GstRTSPClient *gstrtspclient, pipeline_callback_data_t * data);
 static gchar *janus_source_create_json_request(gchar *request, const gchar *pid);
+static void janus_source_release_media(pipeline_callback_data_t * data);
+static void janus_source_disconnect_feedback(pipeline_callback_data_t * data);
 
 
 static GstSDPMessage *
@@ -81,16 +87,133 @@ int close_and_destroy_sockets(gpointer key, janus_source_socket * sck, gpointer
 	return TRUE;
 }
 
+/* A probe on one of the mount's pads, its callback is given user_data */
+typedef struct janus_source_pad_probe {
+	pipeline_callback_data_t * data;
+	GstPadProbeCallback func;
+	gpointer user_data;
+} janus_source_pad_probe;
+
+/* What removing the probe takes, kept apart as the probe itself may be freed by the removal */
+typedef struct janus_source_pad_probe_id {
+	GstPad * pad;
+	gulong id;
+} janus_source_pad_probe_id;
+
+static GstPadProbeReturn janus_source_pad_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	janus_source_pad_probe * probe = (janus_source_pad_probe *)user_data;
+	return probe->func(pad, info, probe->user_data);
+}
+
+/* Once the probe is removed and no streaming thread is running it any more */
+static void janus_source_pad_probe_free(gpointer user_data)
+{
+	janus_source_pad_probe * probe = (janus_source_pad_probe *)user_data;
+	pipeline_callback_data_unref(probe->data);
+	g_free(probe);
+}
+
+static void janus_source_add_pad_probe(pipeline_callback_data_t * data, GstPad * pad, GstPadProbeCallback func, gpointer user_data)
+{
+	janus_source_pad_probe * probe = g_new0(janus_source_pad_probe, 1);
+	probe->data = pipeline_callback_data_ref(data);
+	probe->func = func;
+	probe->user_data = user_data;
+
+	janus_source_pad_probe_id * probe_id = g_new0(janus_source_pad_probe_id, 1);
+	probe_id->pad = gst_object_ref(pad);
+	probe_id->id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, janus_source_pad_probe_cb, probe, janus_source_pad_probe_free);
+
+	g_mutex_lock(&data->clients_mutex);
+	data->probes = g_slist_prepend(data->probes, probe_id);
+	g_mutex_unlock(&data->clients_mutex);
+}
+
+static void janus_source_remove_pad_probes(pipeline_callback_data_t * data)
+{
+	g_mutex_lock(&data->clients_mutex);
+	GSList * probes = data->probes;
+	data->probes = NULL;
+	g_mutex_unlock(&data->clients_mutex);
+
+	for (GSList * l = probes; l != NULL; l = l->next) {
+		janus_source_pad_probe_id * probe_id = (janus_source_pad_probe_id *)l->data;
+		gst_pad_remove_probe(probe_id->pad, probe_id->id);
+		gst_object_unref(probe_id->pad);
+		g_free(probe_id);
+	}
+	g_slist_free(probes);
+}
+
+pipeline_callback_data_t * pipeline_callback_data_ref(pipeline_callback_data_t * data) {
+	g_atomic_int_inc(&data->ref);
+	return data;
+}
+
+/* Called by the owner of the mount once it is removed, the data lives on while a probe or task still holds it */
 void pipeline_callback_data_destroy(pipeline_callback_data_t * data) {
 	g_assert(data);
+	janus_source_remove_pad_probes(data);
+	janus_source_disconnect_feedback(data);
+	janus_source_release_media(data);
+
+	g_mutex_lock(&data->clients_mutex);
+	GSource * idle_source = data->idle_source;
+	data->idle_source = NULL;
+	g_mutex_unlock(&data->clients_mutex);
+	if (idle_source) {
+		/* Drops the reference the timeout holds */
+		g_source_destroy(idle_source);
+		g_source_unref(idle_source);
+	}
+
+	pipeline_callback_data_unref(data);
+}
+
+void pipeline_callback_data_unref(pipeline_callback_data_t * data) {
+	g_assert(data);
+	if (!g_atomic_int_dec_and_test(&data->ref)) {
+		return;
+	}
 	JANUS_LOG(LOG_VERB, "Freeing callback data for session: %s\n", data->id);
 	g_hash_table_foreach_remove(data->sockets, (GHRFunc)close_and_destroy_sockets, NULL);
 	g_hash_table_destroy(data->sockets);
+	if (data->idle_source) {
+		g_source_destroy(data->idle_source);
+		g_source_unref(data->idle_source);
+	}
+	if (data->media) {
+		g_object_unref(data->media);
+	}
+	gop_cache_destroy(&data->gop_cache);
+	viewer_feedback_destroy(&data->feedback);
+	g_hash_table_destroy(data->viewers);
 	g_free(data->id);
 	g_free(data->rtsp_url);
+	janus_source_session_unref((janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session);
 	g_free(data);
 }
 
+/* Releases the reference a client's signal handler holds */
+static void pipeline_callback_data_closure_notify(gpointer data, GClosure * closure) {
+	pipeline_callback_data_unref((pipeline_callback_data_t *)data);
+}
+
+/* Copy of a stream's RTCP callback data for a socket watch, it holds the session until the watch lets go of it */
+static janus_source_rtcp_cbk_data * janus_source_rtcp_cbk_data_dup(const janus_source_rtcp_cbk_data * data) {
+	janus_source_rtcp_cbk_data * copy = g_new(janus_source_rtcp_cbk_data, 1);
+	*copy = *data;
+	janus_source_session_ref((janus_source_session *)copy->session);
+	return copy;
+}
+
+static void janus_source_rtcp_cbk_data_free(gpointer data) {
+	janus_source_rtcp_cbk_data * cbk_data = (janus_source_rtcp_cbk_data *)data;
+	janus_source_session_unref((janus_source_session *)cbk_data->session);
+	g_free(cbk_data);
+}
+
 static void set_custom_socket(GHashTable * sockets, GstElement *bin, const gchar * socket_name) {
 	g_assert(sockets);
 	
@@ -123,11 +246,20 @@ static void rtsp_media_target_state_cb(GstRTSPMedia *gstrtspmedia, gint state, p
 		GstElement * bin = gst_rtsp_media_get_element(gstrtspmedia);
 		g_assert(bin);
 		
-		set_custom_socket(data->sockets, bin, SOCKET_VIDEO_RTP_SRV);
-		set_custom_socket(data->sockets, bin, SOCKET_VIDEO_RTCP_RCV_SRV);
+		if (janus_source_get_ingest_mode() == JANUS_SOURCE_INGEST_APPSRC) {
+			janus_source_session * session = (janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session;
+			ingest_appsrc * ingest = session ? g_atomic_pointer_get(&session->ingest) : NULL;
+
+			if (ingest) {
+				ingest_appsrc_attach(ingest, bin, data);
+			}
+		} else {
+			set_custom_socket(data->sockets, bin, SOCKET_VIDEO_RTP_SRV);
+			set_custom_socket(data->sockets, bin, SOCKET_VIDEO_RTCP_RCV_SRV);
 
-		set_custom_socket(data->sockets, bin, SOCKET_AUDIO_RTP_SRV);
-		set_custom_socket(data->sockets, bin, SOCKET_AUDIO_RTCP_RCV_SRV);
+			set_custom_socket(data->sockets, bin, SOCKET_AUDIO_RTP_SRV);
+			set_custom_socket(data->sockets, bin, SOCKET_AUDIO_RTCP_RCV_SRV);
+		}
 
 #if 0
 		JANUS_LOG(LOG_INFO, "Source: dumping dot file\n");
@@ -143,6 +275,79 @@ static void rtsp_media_target_state_cb(GstRTSPMedia *gstrtspmedia, gint state, p
 	}		
 }
 
+/* RTCP the viewers sent on the video stream, SRs and RRs are handled by the RTP session itself */
+static void viewer_rtcp_cb(GObject * rtpsession, GstBuffer * buffer, pipeline_callback_data_t * data)
+{
+	GstMapInfo map;
+
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		return;
+	}
+	viewer_feedback_process_rtcp(&data->feedback, (const char *)map.data, map.size);
+	gst_buffer_unmap(buffer, &map);
+
+	janus_source_apply_viewer_feedback((janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session,
+		&data->feedback);
+}
+
+/* The streams only get their RTP session once the media is prepared */
+static void media_prepared_cb(GstRTSPMedia * media, pipeline_callback_data_t * data)
+{
+	if (data->pay_index[JANUS_SOURCE_STREAM_VIDEO] < 0) {
+		return;
+	}
+
+	GstRTSPStream * stream = gst_rtsp_media_get_stream(media, data->pay_index[JANUS_SOURCE_STREAM_VIDEO]);
+	GObject * rtpsession = stream ? gst_rtsp_stream_get_rtpsession(stream) : NULL;
+	if (!rtpsession) {
+		JANUS_LOG(LOG_WARN, "No RTP session for the video of %s, viewers' reports are ignored\n", data->id);
+		return;
+	}
+
+	/* A media prepared again after a suspension keeps its RTP sessions */
+	g_mutex_lock(&data->clients_mutex);
+	if (data->prepared_media == media && data->feedback_session != rtpsession) {
+		GObject * previous = data->feedback_session;
+		gulong previous_id = data->id_feedback_cb;
+		data->feedback_session = g_object_ref(rtpsession);
+		data->id_feedback_cb = g_signal_connect_data(rtpsession, "on-receiving-rtcp", (GCallback)viewer_rtcp_cb,
+			pipeline_callback_data_ref(data), pipeline_callback_data_closure_notify, 0);
+		g_mutex_unlock(&data->clients_mutex);
+
+		if (previous) {
+			g_signal_handler_disconnect(previous, previous_id);
+			g_object_unref(previous);
+		}
+	} else {
+		g_mutex_unlock(&data->clients_mutex);
+	}
+	g_object_unref(rtpsession);
+}
+
+/* Stops feeding the viewers' reports from the previous media, the handlers let go of the data */
+static void janus_source_disconnect_feedback(pipeline_callback_data_t * data)
+{
+	g_mutex_lock(&data->clients_mutex);
+	GstRTSPMedia * media = data->prepared_media;
+	gulong media_id = data->id_media_prepared_cb;
+	GObject * rtpsession = data->feedback_session;
+	gulong rtpsession_id = data->id_feedback_cb;
+	data->prepared_media = NULL;
+	data->id_media_prepared_cb = 0;
+	data->feedback_session = NULL;
+	data->id_feedback_cb = 0;
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (media) {
+		g_signal_handler_disconnect(media, media_id);
+		g_object_unref(media);
+	}
+	if (rtpsession) {
+		g_signal_handler_disconnect(rtpsession, rtpsession_id);
+		g_object_unref(rtpsession);
+	}
+}
+
 static void media_configure_cb(GstRTSPMediaFactory * factory, GstRTSPMedia * media, pipeline_callback_data_t * data)
 {
 	JANUS_LOG(LOG_VERB, "media_configure callback\n") ;
@@ -153,8 +358,569 @@ static void media_configure_cb(GstRTSPMediaFactory * factory, GstRTSPMedia * med
 	}
 
 	data->id_rtsp_media_target_state_cb = g_signal_connect(media, "target-state", (GCallback)rtsp_media_target_state_cb, data);
+	/* The pads of the previous media, if any, are not needed any more */
+	janus_source_remove_pad_probes(data);
+
+	if (janus_source_get_media_idle_timeout() > 0) {
+		/* Suspending stops the pipeline, resuming only needs it prerolled again */
+		gst_rtsp_media_set_suspend_mode(media, GST_RTSP_SUSPEND_MODE_RESET);
+		janus_source_release_media(data);
+	}
+	g_mutex_lock(&data->clients_mutex);
+	if (data->media) {
+		g_object_unref(data->media);
+	}
+	data->media = g_object_ref(media);
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (janus_source_get_viewer_feedback_policy() != VIEWER_FEEDBACK_OFF) {
+		janus_source_disconnect_feedback(data);
+		g_mutex_lock(&data->clients_mutex);
+		data->prepared_media = g_object_ref(media);
+		data->id_media_prepared_cb = g_signal_connect_data(media, "prepared", (GCallback)media_prepared_cb,
+			pipeline_callback_data_ref(data), pipeline_callback_data_closure_notify, 0);
+		g_mutex_unlock(&data->clients_mutex);
+	}
+
+	GstElement * bin = gst_rtsp_media_get_element(media);
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		if (data->pay_index[stream] < 0) {
+			continue;
+		}
+
+		gchar * pay_name = g_strdup_printf("pay%d", data->pay_index[stream]);
+		GstElement * pay = gst_bin_get_by_name(GST_BIN(bin), pay_name);
+
+		if (!pay) {
+			JANUS_LOG(LOG_ERR, "Unable to find %s\n", pay_name);
+			g_free(pay_name);
+			continue;
+		}
+
+		GstPad * sink = gst_element_get_static_pad(pay, "sink");
+		GstPad * src = gst_element_get_static_pad(pay, "src");
+
+		/* The rewriter goes first so that the GOP cache keeps rewritten packets */
+		if (data->passthrough && src) {
+			janus_source_add_pad_probe(data, src, rtp_rewriter_probe_cb, &data->rewriter[stream]);
+		}
+
+		if (stream == JANUS_SOURCE_STREAM_VIDEO && data->gop_cache.budget > 0) {
+			gop_cache_reset(&data->gop_cache, data->passthrough);
+			if (!data->passthrough && sink) {
+				janus_source_add_pad_probe(data, sink, gop_cache_sink_probe_cb, &data->gop_cache);
+			}
+			if (src) {
+				janus_source_add_pad_probe(data, src, gop_cache_src_probe_cb, &data->gop_cache);
+			}
+		}
+
+		if (sink) {
+			gst_object_unref(sink);
+		}
+		if (src) {
+			gst_object_unref(src);
+		}
+
+		gst_object_unref(pay);
+		g_free(pay_name);
+	}
+	g_object_unref(bin);
+}
+
+
+static GstElement * janus_source_create_element(GstRTSPMediaFactory * factory, const GstRTSPUrl * url)
+{
+	GstElement * element = g_object_steal_data(G_OBJECT(factory), POOLED_ELEMENT_KEY);
+
+	if (element) {
+		JANUS_LOG(LOG_VERB, "Using pooled pipeline\n");
+		/* Hand it over as a fresh floating reference, the media sinks it */
+		g_object_force_floating(G_OBJECT(element));
+		return element;
+	}
+
+	const pipeline_builder_params * params = g_object_get_data(G_OBJECT(factory), PIPELINE_PARAMS_KEY);
+	if (!params) {
+		JANUS_LOG(LOG_ERR, "No pipeline parameters attached to the factory\n");
+		return NULL;
+	}
+
+	return pipeline_builder_build(params);
+}
+
+/* The classes are shared by every mount and client: patched once, before the RTSP server starts */
+void janus_source_rtsp_classes_init(void)
+{
+	/* Pipelines are built element by element instead of from a launch string */
+	GstRTSPMediaFactoryClass *factory_class = g_type_class_ref(GST_TYPE_RTSP_MEDIA_FACTORY);
+	factory_class->create_element = janus_source_create_element;
+
+	GstRTSPClientClass *client_class = g_type_class_ref(GST_TYPE_RTSP_CLIENT);
+	client_class->create_sdp = create_sdp;
+	/* The references are kept, the classes must not go away with the patched methods */
+}
+
+static void janus_source_factory_set_params(GstRTSPMediaFactory * factory, const pipeline_builder_params * params)
+{
+	pipeline_builder_params *copy = g_new(pipeline_builder_params, 1);
+
+	*copy = *params;
+	g_object_set_data_full(G_OBJECT(factory), PIPELINE_PARAMS_KEY, copy, g_free);
+}
+
+/* Sends a cached GOP to a single viewer, ahead of the live packets it continues into */
+static void janus_source_send_burst(GstRTSPStreamTransport * trans, GList * burst)
+{
+	const GstRTSPTransport * transport = gst_rtsp_stream_transport_get_transport(trans);
+
+	if (transport->lower_transport == GST_RTSP_LOWER_TRANS_TCP) {
+		for (GList * l = burst; l != NULL; l = l->next) {
+			gst_rtsp_stream_transport_send_rtp(trans, l->data);
+		}
+		return;
+	}
+
+	/* Multicast viewers share the group with everybody else */
+	if (transport->lower_transport != GST_RTSP_LOWER_TRANS_UDP || !transport->destination) {
+		return;
+	}
+
+	/* The transport has no send callbacks for UDP, the media's multiudpsink owns the delivery:
+	 * the burst goes out of the stream's own socket so the viewer sees a single source */
+
+	GInetAddress * inet = g_inet_address_new_from_string(transport->destination);
+	if (!inet) {
+		return;
+	}
+
+	/* Same socket, hence same source port, the media streams to this viewer from */
+	GstRTSPStream * stream = gst_rtsp_stream_transport_get_stream(trans);
+	GSocket * socket = gst_rtsp_stream_get_rtp_socket(stream, g_inet_address_get_family(inet));
+	GSocketAddress * address = g_inet_socket_address_new(inet, transport->client_port.min);
+
+	if (socket) {
+		for (GList * l = burst; l != NULL; l = l->next) {
+			GstMapInfo map;
+			if (gst_buffer_map(l->data, &map, GST_MAP_READ)) {
+				g_socket_send_to(socket, address, (const gchar *)map.data, map.size, NULL, NULL);
+				gst_buffer_unmap(l->data, &map);
+			}
+		}
+		g_object_unref(socket);
+	}
+
+	g_object_unref(address);
+	g_object_unref(inet);
+}
+
+/* Clients get the handlers of every mount, TRUE if the request targets the one of data */
+static gboolean
+janus_source_request_is_ours(GstRTSPContext *rtspcontext, pipeline_callback_data_t * data)
+{
+	if (!rtspcontext->uri || !rtspcontext->uri->abspath) {
+		return FALSE;
+	}
+
+	gchar * path = g_strdup_printf("/%s", data->id);
+	gsize plen = strlen(path);
+	const gchar * abspath = rtspcontext->uri->abspath;
+	gboolean ours = strncmp(abspath, path, plen) == 0 && (abspath[plen] == '\0' || abspath[plen] == '/');
+	g_free(path);
+
+	return ours;
+}
+
+static void
+janus_source_request_viewer_keyframe(pipeline_callback_data_t * data, const gchar * reason)
+{
+	if (data->pay_index[JANUS_SOURCE_STREAM_VIDEO] < 0) {
+		return;
+	}
+
+	janus_source_request_keyframe((janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session, reason);
+}
+
+/* Streaming threads are owned by sources and queues, the ones rtpbin adds included */
+static guint
+janus_source_count_streaming_threads(GstElement * bin)
+{
+	guint threads = 0;
+	GValue item = G_VALUE_INIT;
+	GstIterator * it = gst_bin_iterate_recurse(GST_BIN(bin));
+
+	while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+		GstElement * element = g_value_get_object(&item);
+		GstElementFactory * factory = gst_element_get_factory(element);
+		const gchar * name = factory ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : NULL;
+
+		if (GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SOURCE) ||
+			g_strcmp0(name, "queue") == 0 || g_strcmp0(name, "rtpjitterbuffer") == 0) {
+			threads++;
+		}
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(it);
+
+	return threads;
+}
+
+static gboolean
+janus_source_idle_timeout_cb(gpointer user_data)
+{
+	pipeline_callback_data_t * data = (pipeline_callback_data_t *)user_data;
+
+	g_mutex_lock(&data->clients_mutex);
+	GstRTSPMedia * media = data->media ? g_object_ref(data->media) : NULL;
+	gboolean idle = g_hash_table_size(data->viewers) == 0;
+	/* Already taken when the mount is being removed */
+	if (data->idle_source) {
+		g_source_unref(data->idle_source);
+		data->idle_source = NULL;
+	}
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (!media) {
+		return G_SOURCE_REMOVE;
+	}
+
+	if (idle && gst_rtsp_media_get_status(media) == GST_RTSP_MEDIA_STATUS_PREPARED) {
+		GstElement * bin = gst_rtsp_media_get_element(media);
+		guint threads = janus_source_count_streaming_threads(bin);
+		g_object_unref(bin);
+
+		if (gst_rtsp_media_suspend(media)) {
+			gsize bytes = gop_cache_get_bytes(&data->gop_cache);
+			/* The GOP would be stale by the time the media is resumed */
+			gop_cache_clear(&data->gop_cache);
+
+			g_mutex_lock(&data->clients_mutex);
+			data->suspend.suspended = TRUE;
+			data->suspend.suspends++;
+			data->suspend.suspended_since = janus_get_monotonic_time();
+			data->suspend.threads_released = threads;
+			data->suspend.bytes_released += bytes;
+			g_mutex_unlock(&data->clients_mutex);
+
+			JANUS_LOG(LOG_INFO, "Suspended idle media of %s, %u streaming threads and %"G_GSIZE_FORMAT" cached bytes released\n",
+				data->id, threads, bytes);
+		} else {
+			JANUS_LOG(LOG_WARN, "Unable to suspend idle media of %s\n", data->id);
+		}
+	}
+
+	g_object_unref(media);
+	return G_SOURCE_REMOVE;
+}
+
+/* Keeps the media prepared between viewers, the idle timeout can only suspend a prepared media */
+static void
+janus_source_hold_media(pipeline_callback_data_t * data, GstRTSPMedia * media)
+{
+	g_mutex_lock(&data->clients_mutex);
+	gboolean hold = janus_source_get_media_idle_timeout() > 0 && media && data->media == media && !data->media_held;
+	if (hold) {
+		data->media_held = TRUE;
+	}
+	g_mutex_unlock(&data->clients_mutex);
+
+	/* Already prepared, this only counts the mount in */
+	if (hold && !gst_rtsp_media_prepare(media, NULL)) {
+		JANUS_LOG(LOG_WARN, "Unable to hold media of %s, it goes with its last viewer\n", data->id);
+		g_mutex_lock(&data->clients_mutex);
+		data->media_held = FALSE;
+		g_mutex_unlock(&data->clients_mutex);
+	}
+}
+
+/* Gives back the mount's prepare count, the media is unprepared if no viewer is left */
+static void
+janus_source_release_media(pipeline_callback_data_t * data)
+{
+	g_mutex_lock(&data->clients_mutex);
+	GstRTSPMedia * media = data->media_held ? g_object_ref(data->media) : NULL;
+	data->media_held = FALSE;
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (media) {
+		gst_rtsp_media_unprepare(media);
+		g_object_unref(media);
+	}
+}
+
+/* Brings a suspended media back as soon as a viewer describes or sets it up, rather than on its PLAY */
+static void
+janus_source_resume_media(pipeline_callback_data_t * data)
+{
+	g_mutex_lock(&data->clients_mutex);
+	if (data->idle_source) {
+		g_source_destroy(data->idle_source);
+		g_source_unref(data->idle_source);
+		data->idle_source = NULL;
+	}
+	GstRTSPMedia * media = data->media ? g_object_ref(data->media) : NULL;
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (!media) {
+		return;
+	}
+
+	if (gst_rtsp_media_get_status(media) == GST_RTSP_MEDIA_STATUS_SUSPENDED && !gst_rtsp_media_unsuspend(media)) {
+		JANUS_LOG(LOG_WARN, "Unable to resume media of %s\n", data->id);
+	}
+
+	g_mutex_lock(&data->clients_mutex);
+	if (data->suspend.suspended && gst_rtsp_media_get_status(media) != GST_RTSP_MEDIA_STATUS_SUSPENDED) {
+		data->suspend.suspended = FALSE;
+		data->suspend.resumes++;
+		data->suspend.suspended_total += janus_get_monotonic_time() - data->suspend.suspended_since;
+		JANUS_LOG(LOG_INFO, "Resumed media of %s\n", data->id);
+	}
+	g_mutex_unlock(&data->clients_mutex);
+
+	g_object_unref(media);
+}
+
+void
+janus_source_get_suspend_stats(pipeline_callback_data_t * data, pipeline_suspend_stats * stats)
+{
+	g_mutex_lock(&data->clients_mutex);
+	*stats = data->suspend;
+	g_mutex_unlock(&data->clients_mutex);
+}
+
+/* Current state of the mount's shared pipeline, GST_STATE_VOID_PENDING before its first media; never waits for a change */
+GstState
+janus_source_get_pipeline_state(pipeline_callback_data_t * data)
+{
+	GstState state = GST_STATE_VOID_PENDING;
+
+	g_mutex_lock(&data->clients_mutex);
+	GstRTSPMedia * media = data->media ? g_object_ref(data->media) : NULL;
+	g_mutex_unlock(&data->clients_mutex);
+
+	if (media) {
+		GstElement * bin = gst_rtsp_media_get_element(media);
+		if (bin) {
+			gst_element_get_state(bin, &state, NULL, 0);
+			g_object_unref(bin);
+		}
+		g_object_unref(media);
+	}
+
+	return state;
+}
+
+/* Counts gstrtspclient as a viewer of the mount, TRUE if it is the first one */
+static gboolean
+janus_source_viewer_add(pipeline_callback_data_t * data, GstRTSPClient * gstrtspclient)
+{
+	g_mutex_lock(&data->clients_mutex);
+	gboolean added = g_hash_table_add(data->viewers, gstrtspclient);
+	g_mutex_unlock(&data->clients_mutex);
+
+	janus_source_session * session = (janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session;
+	if (!added || !session) {
+		return FALSE;
+	}
+
+	if (g_atomic_int_add(&session->viewers, 1) == 0) {
+		JANUS_LOG(LOG_VERB, "First viewer of %s, resuming ingest\n", data->id);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+janus_source_viewer_remove(pipeline_callback_data_t * data, GstRTSPClient * gstrtspclient)
+{
+	guint idle_timeout = janus_source_get_media_idle_timeout();
+
+	g_mutex_lock(&data->clients_mutex);
+	gboolean removed = g_hash_table_remove(data->viewers, gstrtspclient);
+	if (removed && idle_timeout > 0 && g_hash_table_size(data->viewers) == 0 && !data->idle_source) {
+		/* Not on the client's context, its thread may stop along with the client */
+		data->idle_source = g_timeout_source_new_seconds(idle_timeout);
+		g_source_set_callback(data->idle_source, janus_source_idle_timeout_cb,
+			pipeline_callback_data_ref(data), (GDestroyNotify)pipeline_callback_data_unref);
+		g_source_attach(data->idle_source, rtsp_server_data->context);
+	}
+	g_mutex_unlock(&data->clients_mutex);
+
+	janus_source_session * session = (janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session;
+	if (removed && session && g_atomic_int_dec_and_test(&session->viewers)) {
+		JANUS_LOG(LOG_VERB, "Last viewer of %s left\n", data->id);
+	}
 }
 
+static void
+janus_source_viewer_behind(gpointer session)
+{
+	janus_source_request_keyframe((janus_source_session *)session, "RTSP viewer fell behind");
+}
+
+/* TCP viewers get their own bounded backlog, so a slow one never holds up the shared media */
+static void
+janus_source_attach_client_queues(GstRTSPClient * gstrtspclient, GstRTSPSessionMedia * sessmedia, pipeline_callback_data_t * data)
+{
+	janus_source_session * session = (janus_source_session *)data->rtcp_cbk_data[JANUS_SOURCE_STREAM_VIDEO].session;
+
+	if (!client_queue_enabled() || !session) {
+		return;
+	}
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		if (data->pay_index[stream] < 0) {
+			continue;
+		}
+
+		GstRTSPStreamTransport * trans = gst_rtsp_session_media_get_transport(sessmedia, data->pay_index[stream]);
+		if (!trans || gst_rtsp_stream_transport_get_transport(trans)->lower_transport != GST_RTSP_LOWER_TRANS_TCP) {
+			continue;
+		}
+
+		gboolean video = (stream == JANUS_SOURCE_STREAM_VIDEO);
+		janus_source_session_ref(session);
+		client_queue_attach(gstrtspclient, trans, data->id, video ? session->codec[stream] : IDILIA_CODEC_INVALID,
+			video ? janus_source_viewer_behind : NULL, session, (GDestroyNotify)janus_source_session_unref);
+	}
+}
+
+static void
+client_play_request_cb(GstRTSPClient  *gstrtspclient,
+	GstRTSPContext *rtspcontext,
+	pipeline_callback_data_t * data)
+{
+	if (!data) {
+		JANUS_LOG(LOG_ERR, "Calback data is NULL\n");
+		return;
+	}
+
+	if (!rtspcontext->sessmedia || !janus_source_request_is_ours(rtspcontext, data)) {
+		return;
+	}
+
+	janus_source_attach_client_queues(gstrtspclient, rtspcontext->sessmedia, data);
+	janus_source_hold_media(data, rtspcontext->media);
+
+	if (data->pay_index[JANUS_SOURCE_STREAM_VIDEO] < 0) {
+		return;
+	}
+
+	janus_source_request_viewer_keyframe(data, "RTSP PLAY");
+}
+
+/* GOP burst waiting for the PLAY response to be sent */
+typedef struct janus_source_pending_burst {
+	pipeline_callback_data_t * data;
+	GstRTSPClient * client;
+	GstRTSPSessionMedia * sessmedia;
+} janus_source_pending_burst;
+
+static void
+janus_source_pending_burst_free(gpointer user_data)
+{
+	janus_source_pending_burst * pending = (janus_source_pending_burst *)user_data;
+
+	pipeline_callback_data_unref(pending->data);
+	g_object_unref(pending->sessmedia);
+	g_object_unref(pending->client);
+	g_free(pending);
+}
+
+/* Runs on the client's context once the PLAY handling is over, the viewer's transport is live by then */
+static gboolean
+janus_source_pending_burst_cb(gpointer user_data)
+{
+	janus_source_pending_burst * pending = (janus_source_pending_burst *)user_data;
+	pipeline_callback_data_t * data = pending->data;
+
+	if (gst_rtsp_session_media_get_rtsp_state(pending->sessmedia) != GST_RTSP_STATE_PLAYING) {
+		return G_SOURCE_REMOVE;
+	}
+
+	GstRTSPStreamTransport * trans = gst_rtsp_session_media_get_transport(pending->sessmedia, data->pay_index[JANUS_SOURCE_STREAM_VIDEO]);
+	GList * burst = trans ? gop_cache_snapshot(&data->gop_cache) : NULL;
+	if (burst) {
+		JANUS_LOG(LOG_VERB, "Sending %u cached packets to the new viewer of %s\n", g_list_length(burst), data->id);
+		janus_source_send_burst(trans, burst);
+		g_list_free_full(burst, (GDestroyNotify)gst_buffer_unref);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Points the RTP-Info entry of the stream at seq and rtptime, FALSE if the response has none for it */
+static gboolean
+janus_source_rebase_rtp_info(GstRTSPMessage * response, gint stream_index, guint16 seq, guint32 rtptime)
+{
+	gchar * value = NULL;
+
+	if (gst_rtsp_message_get_header(response, GST_RTSP_HDR_RTP_INFO, &value, 0) != GST_RTSP_OK || !value) {
+		return FALSE;
+	}
+
+	gchar ** infos = g_strsplit(value, ",", -1);
+	gchar * control = g_strdup_printf("/stream=%d", stream_index);
+	gboolean found = FALSE;
+
+	for (gchar ** info = infos; *info != NULL; info++) {
+		gchar ** params = g_strsplit(g_strstrip(*info), ";", -1);
+		if (params[0] && g_str_has_prefix(params[0], "url=") && g_str_has_suffix(params[0], control)) {
+			gchar * rebased = g_strdup_printf("%s;seq=%u;rtptime=%u", params[0], seq, rtptime);
+			g_free(*info);
+			*info = rebased;
+			found = TRUE;
+		}
+		g_strfreev(params);
+	}
+
+	if (found) {
+		gst_rtsp_message_remove_header(response, GST_RTSP_HDR_RTP_INFO, -1);
+		gst_rtsp_message_take_header(response, GST_RTSP_HDR_RTP_INFO, g_strjoinv(", ", infos));
+	}
+
+	g_free(control);
+	g_strfreev(infos);
+	return found;
+}
+
+/* The cached GOP is the live stream's own packets, from the last keyframe up to the ones the viewer
+ * gets live: the PLAY response announces its first packet, which the burst then sends after it */
+static GstRTSPStatusCode
+client_adjust_play_response_cb(GstRTSPClient  *gstrtspclient,
+	GstRTSPContext *rtspcontext,
+	pipeline_callback_data_t * data)
+{
+	guint16 seq = 0;
+	guint32 rtptime = 0;
+
+	if (!data || !rtspcontext->sessmedia || !rtspcontext->response || !janus_source_request_is_ours(rtspcontext, data)) {
+		return GST_RTSP_STS_OK;
+	}
+
+	if (data->pay_index[JANUS_SOURCE_STREAM_VIDEO] < 0 || !gop_cache_get_start(&data->gop_cache, &seq, &rtptime)) {
+		return GST_RTSP_STS_OK;
+	}
+
+	/* A viewer told to expect later packets would drop the burst, it waits for the next keyframe instead */
+	if (!janus_source_rebase_rtp_info(rtspcontext->response, data->pay_index[JANUS_SOURCE_STREAM_VIDEO], seq, rtptime)) {
+		return GST_RTSP_STS_OK;
+	}
+
+	janus_source_pending_burst * pending = g_new0(janus_source_pending_burst, 1);
+	pending->data = pipeline_callback_data_ref(data);
+	pending->client = g_object_ref(gstrtspclient);
+	pending->sessmedia = g_object_ref(rtspcontext->sessmedia);
+
+	GSource * source = g_idle_source_new();
+	g_source_set_callback(source, janus_source_pending_burst_cb, pending, janus_source_pending_burst_free);
+	g_source_attach(source, g_main_context_get_thread_default());
+	g_source_unref(source);
+
+	return GST_RTSP_STS_OK;
+}
 
 static void
 client_pause_request_cb(GstRTSPClient  *gstrtspclient,
@@ -171,6 +937,23 @@ client_pause_request_cb(GstRTSPClient  *gstrtspclient,
 	rtsp_clients_list_remove(&data->clients_list, &data->clients_mutex, g_object_ref(gstrtspclient));
 }
 
+/* The media is prepared while the DESCRIBE is handled, which needs the gate open to preroll */
+static GstRTSPStatusCode
+client_pre_describe_request_cb(GstRTSPClient  *gstrtspclient,
+	GstRTSPContext *rtspcontext,
+	pipeline_callback_data_t * data)
+{
+	if (janus_source_request_is_ours(rtspcontext, data)) {
+		gboolean first = janus_source_viewer_add(data, gstrtspclient);
+		if (first) {
+			janus_source_resume_media(data);
+		}
+		janus_source_request_viewer_keyframe(data, first ? "first RTSP viewer" : "RTSP DESCRIBE");
+	}
+
+	return GST_RTSP_STS_OK;
+}
+
 static void
 client_setup_request_cb(GstRTSPClient  *gstrtspclient,
 	GstRTSPContext *rtspcontext,
@@ -184,6 +967,41 @@ client_setup_request_cb(GstRTSPClient  *gstrtspclient,
 	}
 
 	rtsp_clients_list_add(&data->clients_list, &data->clients_mutex, g_object_ref(gstrtspclient));
+
+	if (janus_source_request_is_ours(rtspcontext, data)) {
+		gboolean first = janus_source_viewer_add(data, gstrtspclient);
+		if (first) {
+			janus_source_resume_media(data);
+		}
+		janus_source_request_viewer_keyframe(data, first ? "first RTSP viewer" : "RTSP SETUP");
+	}
+}
+
+static void
+client_teardown_request_cb(GstRTSPClient  *gstrtspclient,
+	GstRTSPContext *rtspcontext,
+	pipeline_callback_data_t * data)
+{
+	if (!data) {
+		JANUS_LOG(LOG_ERR, "Calback data is NULL\n");
+		return;
+	}
+
+	if (janus_source_request_is_ours(rtspcontext, data)) {
+		janus_source_viewer_remove(data, gstrtspclient);
+	}
+}
+
+static void
+client_closed_cb(GstRTSPClient  *gstrtspclient,
+	pipeline_callback_data_t * data)
+{
+	if (!data) {
+		JANUS_LOG(LOG_ERR, "Calback data is NULL\n");
+		return;
+	}
+
+	janus_source_viewer_remove(data, gstrtspclient);
 }
 
 
@@ -199,98 +1017,190 @@ client_connected_cb(GstRTSPServer *gstrtspserver,
 		return;
 	}
 
-	GstRTSPClientClass *klass = GST_RTSP_CLIENT_GET_CLASS(gstrtspclient);
-	klass->create_sdp = create_sdp;	
-	g_signal_connect(gstrtspclient, "pause-request",(GCallback)client_pause_request_cb, data);
-	g_signal_connect(gstrtspclient, "setup-request",(GCallback)client_setup_request_cb, data);	
+	/* Each handler holds the data, the client may outlive the mount */
+	static const struct {
+		const gchar * signal;
+		GCallback callback;
+	} handlers[] = {
+		{ "pause-request", (GCallback)client_pause_request_cb },
+		{ "pre-describe-request", (GCallback)client_pre_describe_request_cb },
+		{ "setup-request", (GCallback)client_setup_request_cb },
+		{ "play-request", (GCallback)client_play_request_cb },
+		{ "adjust-play-response", (GCallback)client_adjust_play_response_cb },
+		{ "teardown-request", (GCallback)client_teardown_request_cb },
+		{ "closed", (GCallback)client_closed_cb }
+	};
+
+	for (guint i = 0; i < G_N_ELEMENTS(handlers); i++) {
+		g_signal_connect_data(gstrtspclient, handlers[i].signal, handlers[i].callback,
+			pipeline_callback_data_ref(data), pipeline_callback_data_closure_notify, 0);
+	}
 }
 
-static gchar * janus_source_create_launch_pipe(janus_source_session * session, pipeline_callback_data_t * data) {
-	gchar * launch_pipe = NULL;
-	gchar * launch_pipe_video = NULL;
-	gchar * launch_pipe_audio = NULL;
+/* Element names of each stream's ingest and feedback ends, shared with the sockets they are bound to */
+static const gchar * rtp_srv_names[JANUS_SOURCE_STREAM_MAX] = { SOCKET_VIDEO_RTP_SRV, SOCKET_AUDIO_RTP_SRV };
+static const gchar * rtcp_snd_srv_names[JANUS_SOURCE_STREAM_MAX] = { SOCKET_VIDEO_RTCP_SND_SRV, SOCKET_AUDIO_RTCP_SND_SRV };
 
+/* Fills the pipeline builder input from the session. FALSE if a feedback socket is missing */
+static gboolean janus_source_get_builder_params(janus_source_session * session, pipeline_builder_params * params) {
 	g_assert(session);
-	
-	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++)
-	{
-		int port = 0;
-		janus_source_socket * sck = NULL;
-		const gchar *socket_rtp_srv_name, *socket_rtcp_rcv_srv_name, *socket_rtcp_snd_srv_name;
 
-		if (stream == JANUS_SOURCE_STREAM_VIDEO) {
-			socket_rtcp_snd_srv_name = SOCKET_VIDEO_RTCP_SND_SRV;
-			socket_rtp_srv_name = SOCKET_VIDEO_RTP_SRV;
-		    socket_rtcp_rcv_srv_name = SOCKET_VIDEO_RTCP_RCV_SRV;
-		} else {
-			socket_rtcp_snd_srv_name = SOCKET_AUDIO_RTCP_SND_SRV;
-			socket_rtp_srv_name = SOCKET_AUDIO_RTP_SRV;
-		    socket_rtcp_rcv_srv_name = SOCKET_AUDIO_RTCP_RCV_SRV;
+	params->use_appsrc = (janus_source_get_ingest_mode() == JANUS_SOURCE_INGEST_APPSRC);
+	params->passthrough = janus_source_get_rtp_passthrough();
+	params->mtu = janus_source_get_rtp_mtu();
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		params->codec[stream] = session->codec[stream];
+		params->codec_pt[stream] = session->codec_pt[stream];
+		params->rtcp_port[stream] = 0;
+
+		if (params->use_appsrc) {
+			continue;
 		}
 
-		sck = g_hash_table_lookup(session->sockets, socket_rtcp_snd_srv_name);
+		janus_source_socket * sck = g_hash_table_lookup(session->sockets, rtcp_snd_srv_names[stream]);
+		if (!sck) {
+			JANUS_LOG(LOG_ERR, "Unable to lookup for %s\n", rtcp_snd_srv_names[stream]);
+			return FALSE;
+		}
+		params->rtcp_port[stream] = sck->port;
+	}
 
-		if (sck) {
-			port = sck->port;
-		} else {
-			JANUS_LOG(LOG_ERR, "Unable to lookup for %s\n", socket_rtcp_snd_srv_name);
-			return NULL;
+	return TRUE;
+}
+
+/* Streams passed through as-is get their RTP header rewritten on the payN element */
+static void janus_source_init_rewriters(const pipeline_builder_params * params, pipeline_callback_data_t * data) {
+	pipeline_builder_get_pay_index(params, data->pay_index);
+
+	data->passthrough = params->passthrough;
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		if (!params->passthrough) {
+			continue;
 		}
 
-		switch (session->codec[stream])
-		{
-		case IDILIA_CODEC_VP8:
-			launch_pipe_video = g_strdup_printf(PIPE_VIDEO_VP8,
-				session->codec_pt[stream],
-				socket_rtp_srv_name,
-				socket_rtcp_rcv_srv_name,
-				port);
-			break;
-		case IDILIA_CODEC_VP9:
-			launch_pipe_video = g_strdup_printf(PIPE_VIDEO_VP9,
-				session->codec_pt[stream],
-				socket_rtp_srv_name,
-				socket_rtcp_rcv_srv_name,
-				port);
-			break;
-		case IDILIA_CODEC_H264:
-			launch_pipe_video = g_strdup_printf(PIPE_VIDEO_H264,
-				session->codec_pt[stream],
-				socket_rtp_srv_name,
-				socket_rtcp_rcv_srv_name,
-				port);
-			break;
-		case IDILIA_CODEC_OPUS:
-			launch_pipe_audio = g_strdup_printf(PIPE_AUDIO_OPUS,
-				session->codec_pt[stream],
-				socket_rtp_srv_name,
-				socket_rtcp_rcv_srv_name,
-				port);
-			break;
-		default: 
-			break;
+		const pipeline_codec_desc * desc = pipeline_builder_get_codec(params->codec[stream]);
+		if (desc) {
+			rtp_rewriter_init(&data->rewriter[stream], g_random_int(), desc->pt, desc->ts_step);
 		}
 	}
+}
 
-	if (session->codec[JANUS_SOURCE_STREAM_VIDEO] != IDILIA_CODEC_INVALID && session->codec[JANUS_SOURCE_STREAM_AUDIO] != IDILIA_CODEC_INVALID) {
-		launch_pipe = g_strdup_printf("( %s name=pay0  %s name=pay1 )", launch_pipe_video, launch_pipe_audio);
+/* Pipeline the pool builds ahead of time: placeholder payload types and ports, patched at checkout */
+GstElement * janus_source_create_template_pipeline(const idilia_codec codec[]) {
+	pipeline_builder_params params;
+
+	params.use_appsrc = (janus_source_get_ingest_mode() == JANUS_SOURCE_INGEST_APPSRC);
+	params.passthrough = janus_source_get_rtp_passthrough();
+	params.mtu = janus_source_get_rtp_mtu();
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		const pipeline_codec_desc * desc = pipeline_builder_get_codec(codec[stream]);
+		params.codec[stream] = codec[stream];
+		params.codec_pt[stream] = desc ? desc->pt : -1;
+		params.rtcp_port[stream] = 0;
 	}
-	else if (session->codec[JANUS_SOURCE_STREAM_VIDEO] != IDILIA_CODEC_INVALID && session->codec[JANUS_SOURCE_STREAM_AUDIO] == IDILIA_CODEC_INVALID) {
-		launch_pipe = g_strdup_printf("( %s name=pay0 )", launch_pipe_video);
+
+	return pipeline_builder_build(&params);
+}
+
+/* Applies the session's payload types and feedback ports to a pipeline built by janus_source_create_template_pipeline */
+static void janus_source_patch_pooled_pipeline(GstElement * bin, const pipeline_builder_params * params) {
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		if (params->codec[stream] == IDILIA_CODEC_INVALID) {
+			continue;
+		}
+
+		GstElement * src = gst_bin_get_by_name(GST_BIN(bin), rtp_srv_names[stream]);
+		if (src) {
+			GstCaps * caps = NULL;
+			g_object_get(src, "caps", &caps, NULL);
+			if (caps) {
+				caps = gst_caps_make_writable(caps);
+				gst_caps_set_simple(caps, "payload", G_TYPE_INT, params->codec_pt[stream], NULL);
+				g_object_set(src, "caps", caps, NULL);
+				gst_caps_unref(caps);
+			}
+			gst_object_unref(src);
+		}
+
+		if (!params->use_appsrc) {
+			GstElement * sink = gst_bin_get_by_name(GST_BIN(bin), rtcp_snd_srv_names[stream]);
+			if (sink) {
+				g_object_set(sink, "port", params->rtcp_port[stream], NULL);
+				gst_object_unref(sink);
+			}
+		}
 	}
-	else if (session->codec[JANUS_SOURCE_STREAM_VIDEO] == IDILIA_CODEC_INVALID && session->codec[JANUS_SOURCE_STREAM_AUDIO] != IDILIA_CODEC_INVALID) {
-		launch_pipe = g_strdup_printf("( %s name=pay0 )", launch_pipe_audio);
+}
+
+void janus_source_relay_fds_reset(janus_source_session * session) {
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		for (int kind = 0; kind < JANUS_SOURCE_RELAY_MAX; kind++) {
+			g_atomic_int_set(&session->relay_fd[stream][kind], -1);
+		}
 	}
+}
 
-	if (launch_pipe_video) {
-		g_free(launch_pipe_video);
+static void janus_source_relay_fd_publish(janus_source_session * session, int stream, int kind, const gchar * name) {
+	janus_source_socket * sck = g_hash_table_lookup(session->sockets, name);
+	int fd = socket_utils_get_fd(sck);
+
+	if (fd < 0) {
+		JANUS_LOG(LOG_ERR, "Unable to lookup for %s\n", name);
+		return;
 	}
 
-	if (launch_pipe_audio) {
-		g_free(launch_pipe_audio);
+	g_atomic_int_set(&session->relay_fd[stream][kind], fd);
+}
+
+/* Called when the session is closed: RTCP read from its sockets is no longer relayed to the peer */
+void janus_source_relay_sockets_detach(janus_source_session * session) {
+	if (!session->sockets) {
+		return;
 	}
 
-	return launch_pipe;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, session->sockets);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		socket_utils_detach((janus_source_socket *)value);
+	}
+}
+
+/* Called when the session is reclaimed: past the grace period no packet thread still holds a relay fd */
+void janus_source_relay_sockets_close(janus_source_session * session) {
+	if (!session->sockets) {
+		return;
+	}
+
+	JANUS_LOG(LOG_VERB, "Closing session sockets\n");
+	g_hash_table_foreach_remove(session->sockets, (GHRFunc)close_and_destroy_sockets, NULL);
+	g_hash_table_destroy(session->sockets);
+	session->sockets = NULL;
+}
+
+void janus_source_relay_batches_destroy(janus_source_session * session) {
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		relay_batch * batch = g_atomic_pointer_get(&session->relay_batch[stream]);
+		g_atomic_pointer_set(&session->relay_batch[stream], NULL);
+		relay_batch_free(batch);
+	}
+}
+
+/* Pushes turn into no-ops, a packet thread may still be holding the ingest */
+void janus_source_ingest_detach(janus_source_session * session) {
+	ingest_appsrc * ingest = g_atomic_pointer_get(&session->ingest);
+	if (ingest) {
+		ingest_appsrc_detach(ingest);
+	}
+}
+
+void janus_source_ingest_destroy(janus_source_session * session) {
+	ingest_appsrc * ingest = g_atomic_pointer_get(&session->ingest);
+	g_atomic_pointer_set(&session->ingest, NULL);
+	ingest_appsrc_free(ingest);
 }
 
 static void create_server_socket(GHashTable * sockets, const gchar *name) {
@@ -312,6 +1222,77 @@ static void create_client_socket(GHashTable * cli_sockets, const gchar *name, GH
 		);
 }
 
+#ifdef USE_REGISTRY_SERVICE
+/* Mount waiting for the registry to hand out its entry id */
+typedef struct {
+	janus_source_session * session;
+	pipeline_callback_data_t * data;
+	GstRTSPMediaFactory * factory;
+	gchar * status_service_url;
+} janus_source_registration;
+
+static void janus_source_registration_done(gboolean success, json_t * db_id_json_object, gpointer user_data)
+{
+	janus_source_registration * reg = (janus_source_registration *)user_data;
+	janus_source_session * session = reg->session;
+	pipeline_callback_data_t * callback_data = reg->data;
+	GstRTSPMediaFactory * factory = reg->factory;
+
+	pipeline_callback_data_t * current = janus_source_session_get_callback_data(session);
+	if (current) {
+		pipeline_callback_data_unref(current);
+	}
+
+	if (session->destroyed || current != callback_data) {
+		/* Closed while the request was in flight: its DELETE went out without the entry id */
+		const gchar * entry_id = json_is_object(db_id_json_object) ? json_string_value(json_object_get(db_id_json_object, "_id")) : NULL;
+		JANUS_LOG(LOG_WARN, "Session closed before its registration completed\n");
+		if (entry_id) {
+			gchar * curl_str = g_strdup_printf("%s/%s", reg->status_service_url, entry_id);
+			curl_async_request(curl_str, "{}", "DELETE", NULL, NULL, NULL);
+			g_free(curl_str);
+		}
+		g_object_unref(factory);
+	}
+	else if (!success) {
+		JANUS_LOG(LOG_ERR, "Could not send the request to the server\n");
+		g_object_unref(factory);
+	}
+	else if (!json_is_object(db_id_json_object)) {
+		JANUS_LOG(LOG_ERR, "Not valid json object.\n");
+		g_object_unref(factory);
+	}
+	else {
+		gint code_err = json_integer_value(json_object_get(db_id_json_object, "code"));
+
+		if (code_err != 0) {
+			gchar *code_error_string = g_strdup_printf("%d", code_err);
+			if(0 == g_strcmp0("11000", code_error_string)){
+				JANUS_LOG(LOG_ERR, "The mountpoint /%s already exist in the system\n", session->id);
+				janus_source_hangup_media(session->handle);
+				janus_source_send_id_error(session->handle);
+			}
+			g_free(code_error_string);
+			g_object_unref(factory);
+		}
+		else {
+			callback_data->id_media_configure_cb = g_signal_connect(factory, "media-configure", (GCallback)media_configure_cb, (gpointer)callback_data);
+			callback_data->id_client_connected_cb = g_signal_connect(rtsp_server_data->rtsp_server, "client-connected", (GCallback)client_connected_cb, (gpointer)callback_data);
+
+			janus_source_rtsp_add_mountpoint(rtsp_server_data, factory, session->id);
+
+			session->db_entry_session_id = (gchar *) g_strdup(json_string_value(json_object_get(db_id_json_object, "_id")));
+			JANUS_LOG(LOG_INFO, "Stream ready at %s\n", session->rtsp_url);
+		}
+	}
+
+	pipeline_callback_data_unref(callback_data);
+	janus_source_session_unref(session);
+	g_free(reg->status_service_url);
+	g_free(reg);
+}
+#endif
+
 void janus_rtsp_handle_client_callback(gpointer data) {	
 	
 	janus_source_session *session = (janus_source_session*)(data); 
@@ -329,39 +1310,87 @@ void janus_rtsp_handle_client_callback(gpointer data) {
 	const gchar * rtsp_ip = janus_source_get_rtsp_ip();
 	int rtsp_port = janus_source_rtsp_server_port(rtsp_server_data);
 	pipeline_callback_data_t * callback_data = g_new0(pipeline_callback_data_t, 1);
+	/* The session's reference, released along with the mount */
+	g_atomic_int_set(&callback_data->ref, 1);
+	janus_source_session_ref(session);
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		callback_data->rtcp_cbk_data[stream].session = (gpointer)session;
+		callback_data->rtcp_cbk_data[stream].is_video = (stream == JANUS_SOURCE_STREAM_VIDEO);
+	}
 
-	session->callback_data = callback_data;
+	janus_source_session_set_callback_data(session, callback_data);
 	session->rtsp_url = g_strdup_printf("rtsp://%s:%d/%s", rtsp_ip, rtsp_port, session->id);
 
 	callback_data->id = g_strdup(session->id);
 	callback_data->rtsp_url = g_strdup(session->rtsp_url);
+	gop_cache_init(&callback_data->gop_cache, session->codec[JANUS_SOURCE_STREAM_VIDEO],
+		janus_source_get_gop_cache_size(), g_atomic_int_get(&session->gop_cache));
 
 	rtsp_clients_list_init(&callback_data->clients_list, &callback_data->clients_mutex);
+	callback_data->viewers = g_hash_table_new(NULL, NULL);
+	viewer_feedback_init(&callback_data->feedback, 90000);
 
 	session->sockets = g_hash_table_new(g_str_hash, g_str_equal);
 	callback_data->sockets = g_hash_table_new(g_str_hash, g_str_equal); 
 
-	create_server_socket(callback_data->sockets, SOCKET_VIDEO_RTP_SRV);
-	create_client_socket(session->sockets, SOCKET_VIDEO_RTP_CLI, callback_data->sockets, SOCKET_VIDEO_RTP_SRV);
-	create_server_socket(callback_data->sockets, SOCKET_VIDEO_RTCP_RCV_SRV);
-	create_client_socket(session->sockets, SOCKET_VIDEO_RTCP_RCV_CLI, callback_data->sockets, SOCKET_VIDEO_RTCP_RCV_SRV);
-	create_server_socket(session->sockets, SOCKET_VIDEO_RTCP_SND_SRV);
+	if (janus_source_get_ingest_mode() == JANUS_SOURCE_INGEST_APPSRC) {
+		/* No loopback sockets nor ports: the pipeline is fed through appsrc once it is prepared */
+		g_atomic_pointer_set(&session->ingest, ingest_appsrc_new());
+	} else {
+		create_server_socket(callback_data->sockets, SOCKET_VIDEO_RTP_SRV);
+		create_client_socket(session->sockets, SOCKET_VIDEO_RTP_CLI, callback_data->sockets, SOCKET_VIDEO_RTP_SRV);
+		create_server_socket(callback_data->sockets, SOCKET_VIDEO_RTCP_RCV_SRV);
+		create_client_socket(session->sockets, SOCKET_VIDEO_RTCP_RCV_CLI, callback_data->sockets, SOCKET_VIDEO_RTCP_RCV_SRV);
+		create_server_socket(session->sockets, SOCKET_VIDEO_RTCP_SND_SRV);
+
+		create_server_socket(callback_data->sockets, SOCKET_AUDIO_RTP_SRV);
+		create_client_socket(session->sockets, SOCKET_AUDIO_RTP_CLI, callback_data->sockets, SOCKET_AUDIO_RTP_SRV);
+		create_server_socket(callback_data->sockets, SOCKET_AUDIO_RTCP_RCV_SRV);
+		create_client_socket(session->sockets, SOCKET_AUDIO_RTCP_RCV_CLI, callback_data->sockets, SOCKET_AUDIO_RTCP_RCV_SRV);
+		create_server_socket(session->sockets, SOCKET_AUDIO_RTCP_SND_SRV);
+
+		/* Resolve the relay sockets once, so the per-packet path does not have to */
+		janus_source_relay_fd_publish(session, JANUS_SOURCE_STREAM_VIDEO, JANUS_SOURCE_RELAY_RTP, SOCKET_VIDEO_RTP_CLI);
+		janus_source_relay_fd_publish(session, JANUS_SOURCE_STREAM_VIDEO, JANUS_SOURCE_RELAY_RTCP, SOCKET_VIDEO_RTCP_RCV_CLI);
+		janus_source_relay_fd_publish(session, JANUS_SOURCE_STREAM_AUDIO, JANUS_SOURCE_RELAY_RTP, SOCKET_AUDIO_RTP_CLI);
+		janus_source_relay_fd_publish(session, JANUS_SOURCE_STREAM_AUDIO, JANUS_SOURCE_RELAY_RTCP, SOCKET_AUDIO_RTCP_RCV_CLI);
+
+		for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+			g_atomic_pointer_set(&session->relay_batch[stream],
+				relay_batch_new(g_atomic_int_get(&session->relay_fd[stream][JANUS_SOURCE_RELAY_RTP])));
+		}
+	}
+
+	pipeline_builder_params params;
 
-	create_server_socket(callback_data->sockets, SOCKET_AUDIO_RTP_SRV);
-	create_client_socket(session->sockets, SOCKET_AUDIO_RTP_CLI, callback_data->sockets, SOCKET_AUDIO_RTP_SRV);
-	create_server_socket(callback_data->sockets, SOCKET_AUDIO_RTCP_RCV_SRV);
-	create_client_socket(session->sockets, SOCKET_AUDIO_RTCP_RCV_CLI, callback_data->sockets, SOCKET_AUDIO_RTCP_RCV_SRV);
-	create_server_socket(session->sockets, SOCKET_AUDIO_RTCP_SND_SRV);
+	if (!janus_source_get_builder_params(session, &params)) {
+		JANUS_LOG(LOG_ERR, "Unable to set up the pipeline of session %s\n", session->id);
+		/* No mount: the pipeline's sockets go now, the session's ones stay until it is reclaimed */
+		janus_source_relay_fds_reset(session);
+		janus_source_relay_batches_destroy(session);
+		janus_source_ingest_detach(session);
+		janus_source_session_set_callback_data(session, NULL);
+		pipeline_callback_data_destroy(callback_data);
+		return;
+	}
+	janus_source_init_rewriters(&params, callback_data);
 
-	gchar * launch_pipe = janus_source_create_launch_pipe(session, data);
+	GstRTSPMediaFactory * factory = janus_source_rtsp_factory(rtsp_server_data, rtsp_ip, session->multicast);
+	janus_source_factory_set_params(factory, &params);
 
-	GstRTSPMediaFactory * factory = janus_source_rtsp_factory(rtsp_server_data, rtsp_ip, launch_pipe);
-	g_free(launch_pipe);
+	GstElement * pooled = pipeline_pool_checkout(session->codec);
+	if (pooled) {
+		janus_source_patch_pooled_pipeline(pooled, &params);
+		/* Released with the factory if no media ever gets created */
+		g_object_set_data_full(G_OBJECT(factory), POOLED_ELEMENT_KEY, pooled, (GDestroyNotify)pipeline_pool_release);
+	}
 
 	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++)
 	{
-		callback_data->rtcp_cbk_data[stream].session = (gpointer)session;
-		callback_data->rtcp_cbk_data[stream].is_video = (stream == JANUS_SOURCE_STREAM_VIDEO);
+		if (janus_source_get_ingest_mode() == JANUS_SOURCE_INGEST_APPSRC) {
+			/* Feedback is pulled from the pipeline's appsink instead */
+			continue;
+		}
 
 		janus_source_socket * sck = NULL;
 
@@ -372,50 +1401,34 @@ void janus_rtsp_handle_client_callback(gpointer data) {
 		}
 
 		if (sck) {
-			socket_utils_attach_callback(sck, 
-				(GSourceFunc)janus_source_send_rtcp_src_received,
-				(gpointer)&callback_data->rtcp_cbk_data[stream]);
+			janus_source_rtcp_cbk_data * cbk_data = janus_source_rtcp_cbk_data_dup(&callback_data->rtcp_cbk_data[stream]);
+			if (!rtcp_reactor_enabled() || !socket_utils_attach_reactor(sck,
+				janus_source_rtcp_src_datagram, cbk_data, janus_source_rtcp_cbk_data_free)) {
+				socket_utils_attach_callback(sck, 
+					(GSourceFunc)janus_source_send_rtcp_src_received,
+					cbk_data, janus_source_rtcp_cbk_data_free);
+			}
 			} else {
 				JANUS_LOG(LOG_ERR, "Socket rtcp_snd_srv lookup error");
 			}
 	}
 
 #ifdef USE_REGISTRY_SERVICE
+	janus_source_registration * reg = g_new0(janus_source_registration, 1);
+	/* Released once the registry answered, the session may be destroyed meanwhile */
+	janus_source_session_ref(session);
+	reg->session = session;
+	reg->data = pipeline_callback_data_ref(callback_data);
+	reg->factory = factory;
+	reg->status_service_url = g_strdup(session->status_service_url);
+
+	/* The mountpoint is added once the registry accepted it, on the setup thread's context; without
+	 * one this is the global default context, which the plain thread default getter reports as NULL */
 	gchar *http_request_data = janus_source_create_json_request(session->rtsp_url, session->pid);
-	json_t *db_id_json_object = NULL;
-
-	if (curl_request(session->curl_handle, session->status_service_url, http_request_data, "POST", &db_id_json_object) != TRUE) {
-		JANUS_LOG(LOG_ERR, "Could not send the request to the server\n");		
-	}
-	else {
-		if (!json_is_object(db_id_json_object)) {
-			JANUS_LOG(LOG_ERR, "Not valid json object.\n");				
-		}	
-		else
-		{			
-			gint code_err = json_integer_value(json_object_get(db_id_json_object, "code"));
-
-			if (code_err != 0) {
-            	gchar *code_error_string = g_strdup_printf("%d", code_err);
-				if(0 == g_strcmp0("11000", code_error_string)){
-					JANUS_LOG(LOG_ERR, "The mountpoint /%s already exist in the system\n", session->id);
-					janus_source_hangup_media(session->handle);		
-					janus_source_send_id_error(session->handle);							
-				} 
-				g_free(code_error_string);
-			}
-			else {
-				callback_data->id_media_configure_cb = g_signal_connect(factory, "media-configure", (GCallback)media_configure_cb, (gpointer)callback_data);
-				callback_data->id_client_connected_cb = g_signal_connect(rtsp_server_data->rtsp_server, "client-connected", (GCallback)client_connected_cb, (gpointer)callback_data);
-					
-				janus_source_rtsp_add_mountpoint(rtsp_server_data, factory, session->id);
-				
-				session->db_entry_session_id = (gchar *) g_strdup(json_string_value(json_object_get(db_id_json_object, "_id")));
-				JANUS_LOG(LOG_INFO, "Stream ready at %s\n", session->rtsp_url);
-			}
-		}
-		json_decref(db_id_json_object);
-	}
+	GMainContext *context = g_main_context_ref_thread_default();
+	curl_async_request(session->status_service_url, http_request_data, "POST",
+		context, janus_source_registration_done, reg);
+	g_main_context_unref(context);
 	g_free(http_request_data);
 
 #else
@@ -6,6 +6,18 @@
 
 gboolean request_key_frame_periodic_cb(gpointer data);
 void janus_rtsp_handle_client_callback(gpointer data);
+pipeline_callback_data_t * pipeline_callback_data_ref(pipeline_callback_data_t * data);
+void pipeline_callback_data_unref(pipeline_callback_data_t * data);
 void pipeline_callback_data_destroy(pipeline_callback_data_t * data);
 int close_and_destroy_sockets(gpointer key, janus_source_socket * sck, gpointer user_data);
+void janus_source_relay_fds_reset(janus_source_session * session);
+void janus_source_relay_sockets_detach(janus_source_session * session);
+void janus_source_relay_sockets_close(janus_source_session * session);
+void janus_source_relay_batches_destroy(janus_source_session * session);
+void janus_source_ingest_detach(janus_source_session * session);
+void janus_source_ingest_destroy(janus_source_session * session);
+void janus_source_rtsp_classes_init(void);
+GstElement * janus_source_create_template_pipeline(const idilia_codec codec[]);
+void janus_source_get_suspend_stats(pipeline_callback_data_t * data, pipeline_suspend_stats * stats);
+GstState janus_source_get_pipeline_state(pipeline_callback_data_t * data);
 
@@ -94,6 +94,7 @@
 #include "../mutex.h"
 #include "../record.h"
 #include "../rtcp.h"
+#include "../rtp.h"
 #include "../utils.h"
 #include <sys/socket.h>
 #include <gst/gst.h>
@@ -103,9 +104,10 @@
 #include "sdp_utils.h"
 #include "socket_utils.h"
 #include "queue_callbacks.h"
-#include "audio_video_defines.h"
 #include "rtsp_server.h"
 #include "gst_utils.h"
+#include "pipeline_pool.h"
+#include "metrics.h"
 
 /* Plugin information */
 #define JANUS_SOURCE_VERSION			1
@@ -177,7 +179,6 @@ janus_plugin *create(void) {
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
 static GThread *watchdog;
 static GThread *handler_rtsp_thread;
 static GThread *keepalive;
@@ -191,30 +192,91 @@ typedef struct janus_source_message {
 	char *transaction;
 	json_t *message;
 	json_t *jsep;
+	gint64 queued;	/* Monotonic time handle_message queued it */
 } janus_source_message;
-static GAsyncQueue *messages = NULL;
 static janus_source_message exit_message;
 
-static GHashTable *sessions;
-static GList *old_sessions;
-static janus_mutex sessions_mutex;
+/* Message handlers: all the messages of a session go to the same one, so they are handled in order */
+#define JANUS_SOURCE_MAX_HANDLERS 32
+typedef struct janus_source_handler_worker {
+	guint index;
+	GThread *thread;
+	GAsyncQueue *messages;
+	janus_mutex stats_mutex;
+	guint max_depth;
+	guint64 handled;
+	gint64 total_latency;	/* Microseconds from queueing to the end of handling */
+	gint64 max_latency;
+} janus_source_handler_worker;
+static janus_source_handler_worker *handlers = NULL;
+static guint handlers_count = 0;
+
+/* Live sessions by handle, split so that lookups from the handlers rarely meet session churn on the same lock */
+#define JANUS_SOURCE_SESSION_SHARDS 16
+typedef struct janus_source_session_shard {
+	janus_mutex mutex;
+	GHashTable *sessions;
+} janus_source_session_shard;
+static janus_source_session_shard session_shards[JANUS_SOURCE_SESSION_SHARDS];
+/* Destroyed sessions in the order they were destroyed, each freed once it has been there long enough */
+static GQueue reclaim_queue = G_QUEUE_INIT;
+static janus_mutex reclaim_mutex;
+/* Media and RTSP callbacks may still hold a raw pointer to a session for a while after it is destroyed */
+#define JANUS_SOURCE_RECLAIM_GRACE (5 * G_USEC_PER_SEC)
 static janus_mutex keepalive_mutex;
-static GHashTable *sessions;
-static CURL *curl_handle = NULL;
 static const char * gst_debug_str = "*:3"; //gst debug setting
 
 /* configuration options */
 static uint16_t udp_min_port = 0, udp_max_port = 0;
+static guint udp_port_quarantine = 0; /* ms before a released port is reused, 0 reuses it right away */
 static uint64_t keepalive_interval = 5000000; //5sec keepalive default interval
 static gchar *status_service_url = NULL;
 static gchar *keepalive_service_url = NULL;
 static gboolean use_codec_priority = FALSE;
 static idilia_codec codec_priority_list[] = { IDILIA_CODEC_INVALID, IDILIA_CODEC_INVALID };
 static gchar *rtsp_interface_ip = NULL;
+static guint relay_batch_size = 0; /* 0 disables batching */
+static guint relay_batch_deadline = 2000; /* us */
+static janus_source_ingest_mode ingest_mode = JANUS_SOURCE_INGEST_UDP;
+static gboolean rtp_passthrough = FALSE;
+static guint pipeline_pool_size = 0; /* 0 disables the pool */
+static guint gop_cache_size = 0; /* bytes per mount, 0 disables the GOP cache */
+static guint rtp_mtu = 0; /* 0 keeps the payloaders' default */
+static guint message_handlers = 1; /* threads handling messages, a session always gets the same one */
+static guint keyframe_request_interval = 1000; /* ms between two PLIs sent to a publisher */
+static gboolean ingest_gating = FALSE; /* drop the publisher's RTP while no RTSP viewer is watching */
+static guint rtsp_threads = 0; /* threads serving RTSP clients, 0 serves them on the RTSP server thread */
+static gboolean rtsp_thread_pinning = FALSE;
+static gchar *multicast_address_range = NULL; /* first-last group, multicast is unavailable when unset */
+static uint16_t multicast_min_port = 0, multicast_max_port = 0;
+static guint multicast_ttl = 1;
+static gchar *multicast_iface = NULL;
+static gboolean rtsp_multicast = FALSE; /* default for mounts whose setup does not ask */
+static guint client_queue_size = 0; /* bytes of backlog per RTSP-over-TCP viewer and stream, 0 leaves them unbounded */
+static guint slow_client_overflows = 0; /* overflows in 10s before a viewer is disconnected, 0 never disconnects */
+static guint rtcp_reactor_threads = 0; /* threads reading the pipelines' RTCP, 0 polls each socket from the main context */
+static guint media_idle_timeout = 0; /* seconds without viewers before the shared media is suspended, 0 never suspends it */
+static guint metrics_port = 0; /* local port of the Prometheus listener, 0 disables it */
+static gchar *metrics_address = NULL;
+static viewer_feedback_policy feedback_policy = VIEWER_FEEDBACK_OFF; /* how the viewers' receiver reports drive the publisher's REMB */
+static guint feedback_percentile = 80;
+static guint feedback_interval = 1000; /* ms between two REMBs driven by the viewers */
+/* REMB sent to publishers once they got congested, bps and ms */
+static bitrate_controller_config bitrate_control = {
+	.min_bitrate = 64 * 1024,
+	.max_bitrate = 2048 * 1024,
+	.increase = 64 * 1024,
+	.decrease = 85,
+	.loss_threshold = 10,
+	.hold = 2000,
+	.interval = 1000,
+};
+/* WebRTC peers keep RTP packets below this size, a smaller MTU needs re-packetization */
+#define JANUS_SOURCE_PASSTHROUGH_MIN_MTU 1200
 janus_source_rtsp_server_data *rtsp_server_data = NULL;
 //function declarations
 static void *janus_source_rtsp_server_thread(void *data);
-static void janus_source_close_session_func(gpointer key, gpointer value, gpointer user_data);
+static gboolean janus_source_close_session_func(gpointer key, gpointer value, gpointer user_data);
 static void janus_source_close_session(janus_source_session * session);
 static void janus_source_relay_rtp(janus_source_session *session, int video, char *buf, int len);
 static void janus_source_relay_rtcp(janus_source_session *session, int video, char *buf, int len);
@@ -223,11 +285,60 @@ static void janus_source_parse_keepalive_interval(janus_config_item *config_keep
 static void janus_source_parse_video_codec_priority(janus_config_item *config);
 static void janus_source_parse_status_service_url(janus_config_item *config_url, gchar **url);
 static void janus_source_parse_rtsp_interface_ip(janus_config_item *config, gchar **rtsp_interface_ip); 
+static void janus_source_parse_uint(janus_config_item *config, guint *value);
+static void janus_source_parse_ingest_mode(janus_config_item *config, janus_source_ingest_mode *mode);
+static void janus_source_parse_bool(janus_config_item *config, gboolean *value);
+static void janus_source_parse_string(janus_config_item *config, gchar **value);
+static void janus_source_warm_pipeline_pool(void);
+static void janus_source_collect_metrics(GString *out);
+static void janus_source_message_free(janus_source_message *msg);
+static void janus_source_handle_client_event(gpointer data);
+static void janus_source_send_pli(janus_source_session *session, const gchar *reason);
+static void janus_source_send_remb(janus_source_session *session, guint64 bitrate);
 gboolean janus_source_send_rtcp_src_received(GSocket *socket, GIOCondition condition, janus_source_rtcp_cbk_data * data);
 static gchar * janus_source_do_codec_negotiation(janus_source_session * session, gchar * orig_sdp);
-static idilia_codec janus_source_select_video_codec_by_priority_list(const gchar * sdp);
+static idilia_codec janus_source_select_video_codec_by_priority_list(const sdp_model * offer);
 
 
+/* Handles are heap pointers so the low bits carry no information */
+static guint64 janus_source_handle_hash(janus_plugin_session *handle) {
+	return ((guint64)(guintptr)handle >> 4) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+}
+
+/* Spreads the sessions over the handlers */
+static janus_source_handler_worker *janus_source_handler_for(janus_plugin_session *handle) {
+	return &handlers[(janus_source_handle_hash(handle) >> 32) % handlers_count];
+}
+
+/* Takes the top bits of the hash, the handler choice above uses the middle ones */
+static janus_source_session_shard *janus_source_session_shard_for(janus_plugin_session *handle) {
+	return &session_shards[janus_source_handle_hash(handle) >> 60];
+}
+
+/* Returns the live session of handle with a reference taken, NULL if there is none */
+static janus_source_session *janus_source_session_lookup(janus_plugin_session *handle) {
+	janus_source_session_shard *shard = janus_source_session_shard_for(handle);
+	janus_mutex_lock(&shard->mutex);
+	janus_source_session *session = (janus_source_session *)g_hash_table_lookup(shard->sessions, handle);
+	if (session != NULL)
+		janus_source_session_ref(session);
+	janus_mutex_unlock(&shard->mutex);
+	return session;
+}
+
+/* Ends the handling of msg, releasing the reference taken on its session if it had one */
+static void janus_source_handler_done(janus_source_handler_worker *worker, janus_source_message *msg, janus_source_session *session) {
+	gint64 latency = janus_get_monotonic_time() - msg->queued;
+	janus_mutex_lock(&worker->stats_mutex);
+	worker->handled++;
+	worker->total_latency += latency;
+	worker->max_latency = MAX(worker->max_latency, latency);
+	janus_mutex_unlock(&worker->stats_mutex);
+	janus_source_message_free(msg);
+	if (session)
+		janus_source_session_unref(session);
+}
+
 static void janus_source_message_free(janus_source_message *msg) {
 	if(!msg || msg == &exit_message)
 		return;
@@ -259,33 +370,20 @@ void *janus_source_watchdog(void *data) {
 	JANUS_LOG(LOG_INFO, "SourcePlugin watchdog started\n");
 	gint64 now = 0;
 	while (g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		janus_mutex_lock(&sessions_mutex);
-		/* Iterate on all the sessions */
+		/* The queue is ordered by destruction time: stop at the first session still in its grace period */
+		GSList *expired = NULL;
 		now = janus_get_monotonic_time();
-		if (old_sessions != NULL) {
-			GList *sl = old_sessions;
-			JANUS_LOG(LOG_HUGE, "Checking %d old SourcePlugin sessions...\n", g_list_length(old_sessions));
-			while (sl) {
-				janus_source_session *session = (janus_source_session *)sl->data;
-				if (!session) {
-					sl = sl->next;
-					continue;
-				}
-				if (now - session->destroyed >= 5 * G_USEC_PER_SEC) {
-					/* We're lazy and actually get rid of the stuff only after a few seconds */
-					JANUS_LOG(LOG_VERB, "Freeing old SourcePlugin session\n");
-					GList *rm = sl->next;
-					old_sessions = g_list_delete_link(old_sessions, sl);
-					sl = rm;
-					session->handle = NULL;
-					g_free(session);
-					session = NULL;
-					continue;
-				}
-				sl = sl->next;
-			}
+		janus_mutex_lock(&reclaim_mutex);
+		while (!g_queue_is_empty(&reclaim_queue)) {
+			janus_source_session *session = (janus_source_session *)g_queue_peek_head(&reclaim_queue);
+			if (now - session->destroyed < JANUS_SOURCE_RECLAIM_GRACE)
+				break;
+			g_queue_pop_head(&reclaim_queue);
+			expired = g_slist_prepend(expired, session);
 		}
-		janus_mutex_unlock(&sessions_mutex);
+		janus_mutex_unlock(&reclaim_mutex);
+		/* We're lazy and actually get rid of the stuff only after a few seconds, or later if still in use */
+		g_slist_free_full(expired, (GDestroyNotify)janus_source_session_unref);
 		g_usleep(500000);
 	}
 	JANUS_LOG(LOG_INFO, "SourcePlugin watchdog stopped\n");
@@ -339,15 +437,12 @@ void janus_source_remove_pid_from_registry(void);
 void janus_source_remove_pid_from_registry(void){
 
 	gchar *curl_str = g_strdup_printf("%s/%s", keepalive_service_url, PID);	
-	gboolean retCode = curl_request(curl_handle, keepalive_service_url, "{}", "DELETE", NULL);		    	
+	/* Failures are logged by the registry worker */
+	curl_async_request(keepalive_service_url, "{}", "DELETE", NULL, NULL, NULL);
 
 	if (curl_str) {
 		g_free(curl_str);
 	}
-
-	if (retCode != TRUE) {
-	    JANUS_LOG(LOG_ERR, "Could not send the request to the server\n"); 
-	}
 }
 
 /* Plugin implementation */
@@ -383,12 +478,51 @@ int janus_source_init(janus_callbacks *callback, const char *config_path) {
 			}
 			JANUS_LOG(LOG_VERB, "Parsing category '%s'\n", cat->name);
 			janus_source_parse_ports_range(janus_config_get_item(cat, "udp_port_range"), &udp_min_port, &udp_max_port);
+			janus_source_parse_uint(janus_config_get_item(cat, "udp_port_quarantine"), &udp_port_quarantine);
 			janus_source_parse_keepalive_interval(janus_config_get_item(cat, "keepalive_interval"), &keepalive_interval);
 			janus_source_parse_status_service_url(janus_config_get_item(cat, "keepalive_service_url"), &keepalive_service_url);
 			janus_source_parse_status_service_url(janus_config_get_item(cat,"status_service_url"),&status_service_url);
 			
 			janus_source_parse_video_codec_priority(janus_config_get_item(cat, "video_codec_priority"));
 			janus_source_parse_rtsp_interface_ip(janus_config_get_item(cat, "interface"),&rtsp_interface_ip);
+			janus_source_parse_uint(janus_config_get_item(cat, "relay_batch_size"), &relay_batch_size);
+			janus_source_parse_uint(janus_config_get_item(cat, "relay_batch_deadline"), &relay_batch_deadline);
+			janus_source_parse_ingest_mode(janus_config_get_item(cat, "ingest_mode"), &ingest_mode);
+			janus_source_parse_bool(janus_config_get_item(cat, "rtp_passthrough"), &rtp_passthrough);
+			janus_source_parse_uint(janus_config_get_item(cat, "rtp_mtu"), &rtp_mtu);
+			janus_source_parse_uint(janus_config_get_item(cat, "pipeline_pool_size"), &pipeline_pool_size);
+			janus_source_parse_uint(janus_config_get_item(cat, "gop_cache_size"), &gop_cache_size);
+			janus_source_parse_uint(janus_config_get_item(cat, "keyframe_request_interval"), &keyframe_request_interval);
+			janus_source_parse_uint(janus_config_get_item(cat, "message_handlers"), &message_handlers);
+			janus_source_parse_bool(janus_config_get_item(cat, "ingest_gating"), &ingest_gating);
+			janus_source_parse_uint(janus_config_get_item(cat, "media_idle_timeout"), &media_idle_timeout);
+			janus_source_parse_uint(janus_config_get_item(cat, "rtcp_reactor_threads"), &rtcp_reactor_threads);
+			gchar *policy = NULL;
+			janus_source_parse_string(janus_config_get_item(cat, "viewer_feedback_policy"), &policy);
+			if (policy) {
+				feedback_policy = viewer_feedback_parse_policy(policy);
+				g_free(policy);
+			}
+			janus_source_parse_uint(janus_config_get_item(cat, "viewer_feedback_percentile"), &feedback_percentile);
+			janus_source_parse_uint(janus_config_get_item(cat, "viewer_feedback_interval"), &feedback_interval);
+			janus_source_parse_uint(janus_config_get_item(cat, "metrics_port"), &metrics_port);
+			janus_source_parse_string(janus_config_get_item(cat, "metrics_address"), &metrics_address);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_min"), &bitrate_control.min_bitrate);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_max"), &bitrate_control.max_bitrate);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_increase"), &bitrate_control.increase);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_decrease"), &bitrate_control.decrease);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_loss_threshold"), &bitrate_control.loss_threshold);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_hold"), &bitrate_control.hold);
+			janus_source_parse_uint(janus_config_get_item(cat, "bitrate_interval"), &bitrate_control.interval);
+			janus_source_parse_uint(janus_config_get_item(cat, "client_queue_size"), &client_queue_size);
+			janus_source_parse_uint(janus_config_get_item(cat, "slow_client_overflows"), &slow_client_overflows);
+			janus_source_parse_uint(janus_config_get_item(cat, "rtsp_threads"), &rtsp_threads);
+			janus_source_parse_bool(janus_config_get_item(cat, "rtsp_thread_pinning"), &rtsp_thread_pinning);
+			janus_source_parse_string(janus_config_get_item(cat, "multicast_address_range"), &multicast_address_range);
+			janus_source_parse_ports_range(janus_config_get_item(cat, "multicast_port_range"), &multicast_min_port, &multicast_max_port);
+			janus_source_parse_uint(janus_config_get_item(cat, "multicast_ttl"), &multicast_ttl);
+			janus_source_parse_string(janus_config_get_item(cat, "multicast_iface"), &multicast_iface);
+			janus_source_parse_bool(janus_config_get_item(cat, "rtsp_multicast"), &rtsp_multicast);
 			
 			cl = cl->next;
 		}
@@ -402,9 +536,19 @@ int janus_source_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_WARN, "Using default port range: %d-%d\n", udp_min_port, udp_max_port);
 	}
 
-	sessions = g_hash_table_new(NULL, NULL);
-	janus_mutex_init(&sessions_mutex);
-	messages = g_async_queue_new_full((GDestroyNotify)janus_source_message_free);
+	for (guint i = 0; i < JANUS_SOURCE_SESSION_SHARDS; i++) {
+		session_shards[i].sessions = g_hash_table_new(NULL, NULL);
+		janus_mutex_init(&session_shards[i].mutex);
+	}
+	janus_mutex_init(&reclaim_mutex);
+	/* Queues exist before initialized is set, the threads popping them are started further down */
+	handlers_count = CLAMP(message_handlers, 1, JANUS_SOURCE_MAX_HANDLERS);
+	handlers = g_new0(janus_source_handler_worker, handlers_count);
+	for (guint i = 0; i < handlers_count; i++) {
+		handlers[i].index = i;
+		handlers[i].messages = g_async_queue_new_full((GDestroyNotify)janus_source_message_free);
+		janus_mutex_init(&handlers[i].stats_mutex);
+	}
 	/* This is the callback we'll need to invoke to contact the gateway */
 	gateway = callback;
 	g_atomic_int_set(&initialized, 1);
@@ -420,33 +564,42 @@ int janus_source_init(janus_callbacks *callback, const char *config_path) {
 
 	gst_init(NULL, NULL);
 	gst_debug_set_threshold_from_string(gst_debug_str, FALSE);
+	janus_source_rtsp_classes_init();
 
-	curl_handle = curl_init();
+	curl_async_init();
 	
-	socket_utils_init(udp_min_port, udp_max_port);
+	socket_utils_init(udp_min_port, udp_max_port, udp_port_quarantine);
+	relay_batch_init(relay_batch_size, relay_batch_deadline);
+	if (ingest_mode == JANUS_SOURCE_INGEST_UDP)
+		rtcp_reactor_init(rtcp_reactor_threads);
+	/* Slow viewers are disconnected from the context the RTSP server runs on */
+	client_queue_init(client_queue_size, slow_client_overflows, NULL);
+	/* udpsrc binds in READY, only appsrc pipelines can be warmed that far before they get their socket */
+	pipeline_pool_init(pipeline_pool_size, janus_source_create_template_pipeline, ingest_mode == JANUS_SOURCE_INGEST_APPSRC);
+	janus_source_warm_pipeline_pool();
 	
-	/* Launch the thread that will handle incoming messages */
-	handler_thread = g_thread_try_new("janus source handler", janus_source_handler, NULL, &error);
-	if (error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Source handler thread...\n", error->code, error->message ? error->message : "??");
-		return -1;
-	}
-	
-	/* Launch the thread that will handle rtsp clients */
-	handler_rtsp_thread = g_thread_try_new("rtsp server", janus_source_rtsp_server_thread, NULL, &error); 
-	if (error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Source rtsp server thread...\n", error->code, error->message ? error->message : "??");
-		return -1;
+	/* Launch the threads that will handle incoming messages */
+	for (guint i = 0; i < handlers_count; i++) {
+		janus_source_handler_worker *worker = &handlers[i];
+		gchar *name = g_strdup_printf("source handler %u", i);
+		worker->thread = g_thread_try_new(name, janus_source_handler, worker, &error);
+		g_free(name);
+		if (error != NULL) {
+			g_atomic_int_set(&initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Source handler thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			goto error_handlers;
+		}
 	}
+	JANUS_LOG(LOG_INFO, "Source messages handled by %u threads\n", handlers_count);
+	metrics_init(metrics_address ? metrics_address : "127.0.0.1", metrics_port, janus_source_collect_metrics);
 
 	/* Set PID */
 	memset(&PID, 0, JANUS_PID_SIZE);	
 	if (0 > janus_set_pid()) {
 		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got an error while plugin id initialize.");
-		return -1;
+		goto error_metrics;
 	}
 
 	/*Start the keepalive thread */
@@ -454,11 +607,46 @@ int janus_source_init(janus_callbacks *callback, const char *config_path) {
 	if (error != NULL) {
 		g_atomic_int_set(&initialized, 0);
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SourcePlugin keepalive thread...\n", error->code, error->message ? error->message : "??");
-		return -1;
+		g_error_free(error);
+		goto error_metrics;
+	}
+
+	/* Launched last: nothing stops the RTSP server thread before its main loop runs */
+	handler_rtsp_thread = g_thread_try_new("rtsp server", janus_source_rtsp_server_thread, NULL, &error); 
+	if (error != NULL) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Source rtsp server thread...\n", error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		goto error_keepalive;
 	}
 
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_SOURCE_NAME);
 	return 0;
+
+	/* Everything started above goes, in reverse order */
+error_keepalive:
+	g_thread_join(keepalive);
+	keepalive = NULL;
+	janus_source_remove_pid_from_registry();
+error_metrics:
+	metrics_destroy();
+error_handlers:
+	for (guint i = 0; i < handlers_count; i++) {
+		if (handlers[i].thread != NULL) {
+			g_async_queue_push(handlers[i].messages, &exit_message);
+			g_thread_join(handlers[i].thread);
+			handlers[i].thread = NULL;
+		}
+	}
+	pipeline_pool_destroy();
+	client_queue_destroy();
+	rtcp_reactor_destroy();
+	relay_batch_destroy();
+	socket_utils_destroy();
+	curl_async_destroy();
+	g_thread_join(watchdog);
+	watchdog = NULL;
+	return -1;
 }
 
 
@@ -466,16 +654,25 @@ void janus_source_destroy(void) {
 	if (!g_atomic_int_get(&initialized))
 		return;
 	g_atomic_int_set(&stopping, 1);
-
-	g_async_queue_push(messages, &exit_message);
-	if (handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
+	/* Scrapes read the sessions and the handlers' queues */
+	metrics_destroy();
+
+	for (guint i = 0; i < handlers_count; i++) {
+		if (handlers[i].thread != NULL) {
+			g_async_queue_push(handlers[i].messages, &exit_message);
+			g_thread_join(handlers[i].thread);
+			handlers[i].thread = NULL;
+		}
 	}
 
-	g_hash_table_foreach(sessions, janus_source_close_session_func, NULL);
+	for (guint i = 0; i < JANUS_SOURCE_SESSION_SHARDS; i++)
+		g_hash_table_foreach_steal(session_shards[i].sessions, janus_source_close_session_func, NULL);
 	socket_utils_destroy();
+	relay_batch_destroy();
+	client_queue_destroy();
+	pipeline_pool_destroy();
 
+	janus_source_rtsp_setup_thread_stop(rtsp_server_data);
 	janus_source_deattach_rtsp_queue_callback(rtsp_server_data);
 	
 	janus_source_rtsp_clean_and_quit_main_loop(rtsp_server_data);
@@ -484,7 +681,10 @@ void janus_source_destroy(void) {
 		g_thread_join(handler_rtsp_thread);
 		handler_rtsp_thread = NULL;
 	}
+	/* The mounts' sockets were closed on the RTSP thread */
+	rtcp_reactor_destroy();
   
+	janus_source_rtsp_server_clear_multicast(rtsp_server_data);
 	g_free(rtsp_server_data);
 	rtsp_server_data = NULL;
 
@@ -496,19 +696,34 @@ void janus_source_destroy(void) {
 	if(keepalive == NULL){
 		janus_source_remove_pid_from_registry();
 	}
+	/* Waits for the DELETEs queued above and by the sessions closed earlier */
+	curl_async_destroy();
 
 	if (watchdog != NULL) {
 		g_thread_join(watchdog);
 		watchdog = NULL;
 	}
+	/* Every thread that could still use them is gone */
+	janus_mutex_lock(&reclaim_mutex);
+	while (!g_queue_is_empty(&reclaim_queue))
+		janus_source_session_unref((janus_source_session *)g_queue_pop_head(&reclaim_queue));
+	janus_mutex_unlock(&reclaim_mutex);
 
 	/* FIXME We should destroy the sessions cleanly */
-	janus_mutex_lock(&sessions_mutex);
-	g_hash_table_destroy(sessions);
-	janus_mutex_unlock(&sessions_mutex);
-	g_async_queue_unref(messages);
-	messages = NULL;
-	sessions = NULL;
+	for (guint i = 0; i < JANUS_SOURCE_SESSION_SHARDS; i++) {
+		janus_mutex_lock(&session_shards[i].mutex);
+		g_hash_table_destroy(session_shards[i].sessions);
+		session_shards[i].sessions = NULL;
+		janus_mutex_unlock(&session_shards[i].mutex);
+		janus_mutex_destroy(&session_shards[i].mutex);
+	}
+	for (guint i = 0; i < handlers_count; i++) {
+		g_async_queue_unref(handlers[i].messages);
+		janus_mutex_destroy(&handlers[i].stats_mutex);
+	}
+	g_free(handlers);
+	handlers = NULL;
+	handlers_count = 0;
 	
     /* Free configuration fields */
   if (keepalive_service_url) {
@@ -521,9 +736,14 @@ void janus_source_destroy(void) {
  
 	g_free(rtsp_interface_ip);
 	rtsp_interface_ip = NULL;
+	g_free(metrics_address);
+	metrics_address = NULL;
+
+	g_free(multicast_address_range);
+	multicast_address_range = NULL;
+	g_free(multicast_iface);
+	multicast_iface = NULL;
  
-	curl_cleanup(curl_handle);
-	
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_SOURCE_NAME);
@@ -575,7 +795,13 @@ void janus_source_create_session(janus_plugin_session *handle, int *error) {
 	session->status_service_url=status_service_url;
 	session->keepalive_service_url=keepalive_service_url;
 	session->pid=PID;
-	session->curl_handle=curl_handle;
+	janus_source_relay_fds_reset(session);
+	g_atomic_int_set(&session->gop_cache, 1);
+	keyframe_limiter_init(&session->keyframe, keyframe_request_interval);
+	bitrate_controller_init(&session->bitrate_control, &bitrate_control);
+	session_stats_init(&session->stats);
+	session->multicast = rtsp_multicast;
+	janus_mutex_init(&session->mutex);
 
 	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++)
 	{
@@ -586,11 +812,14 @@ void janus_source_create_session(janus_plugin_session *handle, int *error) {
 	session->bitrate = 0;	/* No limit */
 	session->destroyed = 0;
 	g_atomic_int_set(&session->hangingup, 0);
+	/* Owned by the sessions table until the session is reclaimed */
+	g_atomic_int_set(&session->ref, 1);
 	handle->plugin_handle = session;
 
-	janus_mutex_lock(&sessions_mutex);
-	g_hash_table_insert(sessions, handle, session);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_source_session_shard *shard = janus_source_session_shard_for(handle);
+	janus_mutex_lock(&shard->mutex);
+	g_hash_table_insert(shard->sessions, handle, session);
+	janus_mutex_unlock(&shard->mutex);
 
 	return;
 }
@@ -611,14 +840,20 @@ void janus_source_destroy_session(janus_plugin_session *handle, int *error) {
 	JANUS_LOG(LOG_VERB, "Removing Source Plugin session...\n");
 	janus_source_close_session(session);
 
-	janus_mutex_lock(&sessions_mutex);
-	if (!session->destroyed) {
+	janus_source_session_shard *shard = janus_source_session_shard_for(handle);
+	janus_mutex_lock(&shard->mutex);
+	gboolean removed = !session->destroyed;
+	if (removed) {
 		session->destroyed = janus_get_monotonic_time();
-		g_hash_table_remove(sessions, handle);
+		g_hash_table_remove(shard->sessions, handle);
+	}
+	janus_mutex_unlock(&shard->mutex);
+	if (removed) {
 		/* Cleaning up and removing the session is done in a lazy way */
-		old_sessions = g_list_append(old_sessions, session);
+		janus_mutex_lock(&reclaim_mutex);
+		g_queue_push_tail(&reclaim_queue, session);
+		janus_mutex_unlock(&reclaim_mutex);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 	return;
 }
 
@@ -638,6 +873,154 @@ json_t *janus_source_query_session(janus_plugin_session *handle) {
 	json_object_set_new(info, "bitrate", json_integer(session->bitrate));
 	json_object_set_new(info, "slowlink_count", json_integer(session->slowlink_count));
 	json_object_set_new(info, "destroyed", json_integer(session->destroyed));
+	/* Held until the end, the mount may be removed meanwhile */
+	pipeline_callback_data_t *data = janus_source_session_get_callback_data(session);
+	if (relay_batch_enabled()) {
+		json_t *batching = json_object();
+		for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+			relay_batch *batch = g_atomic_pointer_get(&session->relay_batch[stream]);
+			if (!batch)
+				continue;
+			guint64 flushes = 0, packets = 0, dropped = 0;
+			relay_batch_get_stats(batch, &flushes, &packets, &dropped);
+			json_t *stats = json_object();
+			json_object_set_new(stats, "packets", json_integer(packets));
+			json_object_set_new(stats, "flushes", json_integer(flushes));
+			json_object_set_new(stats, "dropped", json_integer(dropped));
+			json_object_set_new(stats, "avg_batch_size", json_real(flushes ? (double)packets / flushes : 0.0));
+			json_object_set_new(batching, stream == JANUS_SOURCE_STREAM_VIDEO ? "video" : "audio", stats);
+		}
+		json_object_set_new(info, "relay_batch", batching);
+	}
+	if (gop_cache_size > 0) {
+		json_t *gop = json_object();
+		json_object_set_new(gop, "enabled", g_atomic_int_get(&session->gop_cache) ? json_true() : json_false());
+		json_object_set_new(gop, "budget", json_integer(gop_cache_size));
+		json_object_set_new(gop, "bytes", json_integer(data ? gop_cache_get_bytes(&data->gop_cache) : 0));
+		json_object_set_new(info, "gop_cache", gop);
+	}
+	json_t *viewers = json_object();
+	json_object_set_new(viewers, "count", json_integer(g_atomic_int_get(&session->viewers)));
+	json_object_set_new(viewers, "gating", ingest_gating ? json_true() : json_false());
+	json_object_set_new(viewers, "gated_packets", json_integer(g_atomic_pointer_get(&session->gated_packets)));
+	json_object_set_new(info, "viewers", viewers);
+	if (client_queue_enabled() && session->id) {
+		json_t *clients = json_array();
+		GList *queues = client_queue_get_stats(session->id);
+		for (GList *l = queues; l != NULL; l = l->next) {
+			client_queue_stats *stats = (client_queue_stats *)l->data;
+			json_t *client = json_object();
+			json_object_set_new(client, "address", json_string(stats->address ? stats->address : ""));
+			json_object_set_new(client, "stream", json_string(stats->video ? "video" : "audio"));
+			json_object_set_new(client, "backlog_packets", json_integer(stats->backlog_packets));
+			json_object_set_new(client, "backlog_bytes", json_integer(stats->backlog_bytes));
+			json_object_set_new(client, "max_backlog_bytes", json_integer(stats->max_bytes));
+			json_object_set_new(client, "socket_bytes", json_integer(stats->socket_bytes));
+			json_object_set_new(client, "sent", json_integer(stats->sent));
+			json_object_set_new(client, "dropped", json_integer(stats->dropped));
+			json_object_set_new(client, "skipped", json_integer(stats->skipped));
+			json_object_set_new(client, "overflows", json_integer(stats->overflows));
+			json_array_append_new(clients, client);
+		}
+		g_list_free_full(queues, (GDestroyNotify)client_queue_stats_free);
+		json_object_set_new(info, "rtsp_clients", clients);
+	}
+	if (feedback_policy != VIEWER_FEEDBACK_OFF && data) {
+		guint reporting = 0, jitter_ms = 0;
+		gdouble loss = 0.0;
+		viewer_feedback_get(&data->feedback, &reporting, &loss, &jitter_ms);
+		json_t *feedback = json_object();
+		json_object_set_new(feedback, "policy", json_string(viewer_feedback_policy_name(feedback_policy)));
+		json_object_set_new(feedback, "viewers", json_integer(reporting));
+		json_object_set_new(feedback, "loss", json_real(loss));
+		json_object_set_new(feedback, "jitter_ms", json_integer(jitter_ms));
+		json_object_set_new(info, "viewer_feedback", feedback);
+	}
+	session_stats_stream_snapshot snapshot[JANUS_SOURCE_STREAM_MAX];
+	guint64 keyframes = 0;
+	gint64 keyframe_interval = 0;
+	session_stats_snapshot(&session->stats, snapshot, &keyframes, &keyframe_interval);
+	json_t *media = json_object();
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		json_t *stats = json_object();
+		json_object_set_new(stats, "packets", json_integer(snapshot[stream].packets));
+		json_object_set_new(stats, "bytes", json_integer(snapshot[stream].bytes));
+		json_object_set_new(stats, "packet_rate", json_integer(snapshot[stream].packet_rate));
+		json_object_set_new(stats, "bitrate", json_integer(snapshot[stream].bitrate));
+		json_object_set_new(stats, "lost", json_integer(snapshot[stream].lost));
+		json_object_set_new(stats, "loss", json_real(snapshot[stream].loss));
+		json_object_set_new(stats, "jitter_ms", json_integer(snapshot[stream].jitter_ms));
+		json_object_set_new(stats, "send_failures", json_integer(snapshot[stream].send_failures));
+		json_object_set_new(stats, "rtcp_in", json_integer(snapshot[stream].rtcp_in));
+		json_object_set_new(stats, "rtcp_out", json_integer(snapshot[stream].rtcp_out));
+		json_object_set_new(stats, "rtcp_failures", json_integer(snapshot[stream].rtcp_failures));
+		if (stream == JANUS_SOURCE_STREAM_VIDEO) {
+			json_object_set_new(stats, "keyframes", json_integer(keyframes));
+			json_object_set_new(stats, "keyframe_interval_ms", json_integer(keyframe_interval / 1000));
+		}
+		json_object_set_new(media, stream == JANUS_SOURCE_STREAM_VIDEO ? "video" : "audio", stats);
+	}
+	json_object_set_new(media, "rtsp_viewers", json_integer(g_atomic_int_get(&session->viewers)));
+	json_object_set_new(info, "stats", media);
+	bitrate_controller_stats control;
+	bitrate_controller_get_stats(&session->bitrate_control, &control);
+	json_t *estimate = json_object();
+	json_object_set_new(estimate, "state", json_string(bitrate_controller_state_name(control.state)));
+	json_object_set_new(estimate, "estimate", json_integer(control.estimate));
+	json_object_set_new(estimate, "received", json_integer(control.received_rate));
+	json_object_set_new(estimate, "loss", json_real(control.loss));
+	json_object_set_new(estimate, "viewer_loss", json_real(control.viewer_loss));
+	json_object_set_new(estimate, "since_congestion_ms", json_integer(control.since_congestion < 0 ? -1 : control.since_congestion / 1000));
+	json_object_set_new(estimate, "slow_links", json_integer(control.slow_links));
+	json_object_set_new(estimate, "decreases", json_integer(control.decreases));
+	json_object_set_new(estimate, "increases", json_integer(control.increases));
+	json_object_set_new(info, "bitrate_control", estimate);
+	json_object_set_new(info, "multicast", session->multicast && rtsp_server_data && rtsp_server_data->address_pool ? json_true() : json_false());
+	if (media_idle_timeout > 0 && data) {
+		pipeline_suspend_stats suspend;
+		janus_source_get_suspend_stats(data, &suspend);
+		gint64 suspended_total = suspend.suspended_total;
+		if (suspend.suspended)
+			suspended_total += janus_get_monotonic_time() - suspend.suspended_since;
+		json_t *idle = json_object();
+		json_object_set_new(idle, "suspended", suspend.suspended ? json_true() : json_false());
+		json_object_set_new(idle, "suspends", json_integer(suspend.suspends));
+		json_object_set_new(idle, "resumes", json_integer(suspend.resumes));
+		json_object_set_new(idle, "suspended_ms", json_integer(suspended_total / 1000));
+		json_object_set_new(idle, "threads_released", json_integer(suspend.threads_released));
+		json_object_set_new(idle, "gop_bytes_released", json_integer(suspend.bytes_released));
+		json_object_set_new(info, "idle_suspend", idle);
+	}
+	if (rtcp_reactor_enabled()) {
+		json_t *reactor = json_array();
+		for (guint i = 0; i < rtcp_reactor_get_threads(); i++) {
+			rtcp_reactor_stats stats;
+			rtcp_reactor_get_stats(i, &stats);
+			json_t *thread = json_object();
+			json_object_set_new(thread, "sockets", json_integer(stats.sockets));
+			json_object_set_new(thread, "wakeups", json_integer(stats.wakeups));
+			json_object_set_new(thread, "datagrams", json_integer(stats.datagrams));
+			json_object_set_new(thread, "max_batch", json_integer(stats.max_batch));
+			json_array_append_new(reactor, thread);
+		}
+		json_object_set_new(info, "rtcp_reactor", reactor);
+	}
+	gint rtsp_max_threads = 0, rtsp_active_threads = 0;
+	janus_source_rtsp_server_get_threads(&rtsp_max_threads, &rtsp_active_threads);
+	json_t *rtsp = json_object();
+	json_object_set_new(rtsp, "max", json_integer(rtsp_max_threads));
+	json_object_set_new(rtsp, "active", json_integer(rtsp_active_threads));
+	json_object_set_new(rtsp, "pinned", rtsp_thread_pinning && rtsp_max_threads > 0 ? json_true() : json_false());
+	json_object_set_new(info, "rtsp_threads", rtsp);
+	guint64 keyframe_requests = 0, plis = 0;
+	keyframe_limiter_get_stats(&session->keyframe, &keyframe_requests, &plis);
+	json_t *keyframe = json_object();
+	json_object_set_new(keyframe, "requests", json_integer(keyframe_requests));
+	json_object_set_new(keyframe, "plis", json_integer(plis));
+	json_object_set_new(info, "keyframe_requests", keyframe);
+	json_object_set_new(info, "message_handler", json_integer(janus_source_handler_for(handle)->index));
+	if (data)
+		pipeline_callback_data_unref(data);
 	return info;
 }
 
@@ -649,7 +1032,14 @@ struct janus_plugin_result *janus_source_handle_message(janus_plugin_session *ha
 	msg->transaction = transaction;
 	msg->message = message;
 	msg->jsep = jsep;
-	g_async_queue_push(messages, msg);
+	msg->queued = janus_get_monotonic_time();
+
+	janus_source_handler_worker *worker = janus_source_handler_for(handle);
+	g_async_queue_push(worker->messages, msg);
+	gint depth = g_async_queue_length(worker->messages);
+	janus_mutex_lock(&worker->stats_mutex);
+	worker->max_depth = MAX(worker->max_depth, (guint)MAX(depth, 0));
+	janus_mutex_unlock(&worker->stats_mutex);
 
 	/* All the requests to this plugin are handled asynchronously: we add a comment
 	 * (a JSON object with a "hint" string in it, that's what the core expects),
@@ -677,11 +1067,11 @@ void janus_source_setup_media(janus_plugin_session *handle) {
 	
 	QueueEventData *queue_event_data;
 	queue_event_data = g_malloc0(sizeof(QueueEventData));
-	queue_event_data->callback = janus_rtsp_handle_client_callback;
+	queue_event_data->callback = janus_source_handle_client_event;
 	queue_event_data->session = session;
+	janus_source_session_ref(session);
 
-	g_async_queue_push(rtsp_server_data->rtsp_async_queue, queue_event_data) ;
-	g_main_context_wakeup(NULL) ;
+	janus_source_rtsp_queue_push(rtsp_server_data, queue_event_data);
 }
 
 void janus_source_incoming_rtp(janus_plugin_session *handle, int video, char *buf, int len) {
@@ -697,6 +1087,21 @@ void janus_source_incoming_rtp(janus_plugin_session *handle, int video, char *bu
 		}
 		if (session->destroyed)
 			return;
+		if (video && keyframe_limiter_poll(&session->keyframe)) {
+			janus_source_send_pli(session, "deferred request");
+		}
+		int stream = video ? JANUS_SOURCE_STREAM_VIDEO : JANUS_SOURCE_STREAM_AUDIO;
+		session_stats_ingest ingest;
+		session_stats_rtp(&session->stats, stream, session->codec[stream], buf, len, &ingest);
+		guint64 estimate = 0;
+		if (bitrate_controller_update(&session->bitrate_control, ingest.bytes, ingest.expected, ingest.received, &estimate)) {
+			janus_source_send_remb(session, estimate);
+		}
+		/* Nobody is watching: the pipeline gets nothing until the first viewer asks for a keyframe */
+		if (ingest_gating && g_atomic_int_get(&session->viewers) == 0) {
+			g_atomic_pointer_add(&session->gated_packets, 1);
+			return;
+		}
 		if ((!video && session->audio_active) || (video && session->video_active)) {
 			janus_source_relay_rtp(session, video, buf, len);
 		}
@@ -718,6 +1123,7 @@ void janus_source_incoming_rtcp(janus_plugin_session *handle, int video, char *b
 		//if (session->bitrate > 0)
 		//	janus_rtcp_cap_remb(buf, len, session->bitrate);
 		JANUS_LOG(LOG_HUGE, "%s RTCP received; len=%d\n", video ? "Video" : "Audio", len);
+		g_atomic_pointer_add(&session->stats.stream[video ? JANUS_SOURCE_STREAM_VIDEO : JANUS_SOURCE_STREAM_AUDIO].rtcp_in, 1);
 		janus_source_relay_rtcp(session, video, buf, len);
 	}
 }
@@ -761,25 +1167,19 @@ void janus_source_slow_link(janus_plugin_session *handle, int uplink, int video)
 		JANUS_LOG(LOG_VERB, "Getting a lot of NACKs (slow uplink) for video, but that's expected, a configure disabled the video forwarding\n");
 	}
 	else {
-		/* Slow uplink or downlink, maybe we set the bitrate cap too high? */
+		/* Slow uplink or downlink: back off now, the controller probes back up once the link recovers */
 		if (video) {
-			/* Halve the bitrate, but don't go too low... */
-			session->bitrate = session->bitrate > 0 ? session->bitrate : 512 * 1024;
-			session->bitrate = session->bitrate / 2;
-			if (session->bitrate < 64 * 1024)
-				session->bitrate = 64 * 1024;
+			guint64 estimate = bitrate_controller_slow_link(&session->bitrate_control);
 			JANUS_LOG(LOG_WARN, "Getting a lot of NACKs (slow %s) for %s, forcing a lower REMB: %"SCNu64"\n",
-				uplink ? "uplink" : "downlink", video ? "video" : "audio", session->bitrate);
+				uplink ? "uplink" : "downlink", video ? "video" : "audio", estimate);
 			/* ... and send a new REMB back */
-			char rtcpbuf[24];
-			janus_rtcp_remb((char *)(&rtcpbuf), 24, session->bitrate);
-			gateway->relay_rtcp(handle, 1, rtcpbuf, 24);
+			janus_source_send_remb(session, estimate);
 			/* As a last thing, notify the user about this */
 			json_t *event = json_object();
 			json_object_set_new(event, "source", json_string("event"));
 			json_t *result = json_object();
 			json_object_set_new(result, "status", json_string("slow_link"));
-			json_object_set_new(result, "bitrate", json_integer(session->bitrate));
+			json_object_set_new(result, "bitrate", json_integer(estimate));
 			json_object_set_new(event, "result", result);
 			gateway->push_event(session->handle, &janus_source_plugin, NULL, event, NULL);
 			/* We don't need the event anymore */
@@ -815,38 +1215,36 @@ void janus_source_hangup_media(janus_plugin_session *handle) {
 	session->audio_active = TRUE;
 	session->video_active = TRUE;
 	session->bitrate = 0;
+	bitrate_controller_reset(&session->bitrate_control);
+	session_stats_reset(&session->stats);
 }
 
 /* Thread to handle incoming messages */
 static void *janus_source_handler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining SourcePlugin handler thread\n");
+	janus_source_handler_worker *worker = (janus_source_handler_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining SourcePlugin handler thread %u\n", worker->index);
 	janus_source_message *msg = NULL;
 	int error_code = 0;
 	char *error_cause = g_malloc0(512);
 	json_t *root = NULL;
 	while (g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(worker->messages);
 		if (msg == NULL)
 			continue;
 		if (msg == &exit_message)
 			break;
 		if (msg->handle == NULL) {
-			janus_source_message_free(msg);
+			janus_source_handler_done(worker, msg, NULL);
 			continue;
 		}
-		janus_source_session *session = NULL;
-		janus_mutex_lock(&sessions_mutex);
-		if (g_hash_table_lookup(sessions, msg->handle) != NULL) {
-			session = (janus_source_session *)msg->handle->plugin_handle;
-		}
-		janus_mutex_unlock(&sessions_mutex);
+		janus_source_session *session = janus_source_session_lookup(msg->handle);
 		if (!session) {
 			JANUS_LOG(LOG_ERR, "No session associated with this handle...\n");
-			janus_source_message_free(msg);
+			janus_source_handler_done(worker, msg, NULL);
 			continue;
 		}
 		if (session->destroyed) {
-			janus_source_message_free(msg);
+			janus_source_handler_done(worker, msg, session);
 			continue;
 		}
 		/* Handle request */
@@ -903,6 +1301,22 @@ static void *janus_source_handler(void *data) {
 			goto error;
 		}
 		
+		json_t *gop_cache = json_object_get(root, "gop_cache");
+		if (gop_cache && !json_is_boolean(gop_cache)) {
+			JANUS_LOG(LOG_ERR, "Invalid element (gop_cache should be a boolean)\n");
+			error_code = JANUS_SOURCE_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid value (gop_cache should be a boolean)");
+			goto error;
+		}
+
+		json_t *multicast = json_object_get(root, "multicast");
+		if (multicast && !json_is_boolean(multicast)) {
+			JANUS_LOG(LOG_ERR, "Invalid element (multicast should be a boolean)\n");
+			error_code = JANUS_SOURCE_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid value (multicast should be a boolean)");
+			goto error;
+		}
+
 		json_t *id = json_object_get(root, "id");
 		if(id && !json_is_string(id)) {
 				JANUS_LOG(LOG_ERR, "Invalid element (id should be a string)\n");
@@ -918,17 +1332,14 @@ static void *janus_source_handler(void *data) {
 		if (video) {
 			if (!session->video_active && json_is_true(video)) {
 				/* Send a PLI */
-				JANUS_LOG(LOG_VERB, "Just (re-)enabled video, sending a PLI to recover it\n");
-				char buf[12];
-				memset(buf, 0, 12);
-				janus_rtcp_pli((char *)&buf, 12);
-				gateway->relay_rtcp(session->handle, 1, buf, 12);
+				janus_source_request_keyframe(session, "video re-enabled");
 			}
 			session->video_active = json_is_true(video);
 			JANUS_LOG(LOG_VERB, "Setting video property: %s\n", session->video_active ? "true" : "false");
 		}
 		if (bitrate) {
 			session->bitrate = json_integer_value(bitrate);
+			bitrate_controller_set_cap(&session->bitrate_control, session->bitrate);
 			JANUS_LOG(LOG_VERB, "Setting video bitrate: %"SCNu64"\n", session->bitrate);
 			if (session->bitrate > 0) {
 				/* FIXME Generate a new REMB (especially useful for Firefox, which doesn't send any we can cap later) */
@@ -940,15 +1351,38 @@ static void *janus_source_handler(void *data) {
 				/* FIXME How should we handle a subsequent "no limit" bitrate? */
 			}
 		}
+		pipeline_callback_data_t *mount = janus_source_session_get_callback_data(session);
+		if (gop_cache) {
+			g_atomic_int_set(&session->gop_cache, json_is_true(gop_cache));
+			if (mount) {
+				gop_cache_set_enabled(&mount->gop_cache, json_is_true(gop_cache));
+			}
+			JANUS_LOG(LOG_VERB, "Setting GOP cache property: %s\n", json_is_true(gop_cache) ? "true" : "false");
+		}
+		if (multicast) {
+			if (mount) {
+				JANUS_LOG(LOG_WARN, "Mount of %s already set up, multicast property ignored\n", session->id);
+			} else {
+				session->multicast = json_is_true(multicast);
+				JANUS_LOG(LOG_VERB, "Setting multicast property: %s\n", session->multicast ? "true" : "false");
+			}
+		}
+		if (mount)
+			pipeline_callback_data_unref(mount);
 		if(id) {
-			session->id = g_strdup(json_string_value(id));			
+			/* A later message may rename the session, the old id goes once nobody can pick it up */
+			janus_mutex_lock(&session->mutex);
+			gchar *old_id = session->id;
+			session->id = g_strdup(json_string_value(id));
+			janus_mutex_unlock(&session->mutex);
+			g_free(old_id);
 		}
 
 
-		if (!audio && !video && !bitrate && !record && !id && !msg_sdp) {
-			JANUS_LOG(LOG_ERR, "No supported attributes (audio, video, bitrate, record, id, jsep) found\n");
+		if (!audio && !video && !bitrate && !record && !id && !gop_cache && !multicast && !msg_sdp) {
+			JANUS_LOG(LOG_ERR, "No supported attributes (audio, video, bitrate, record, id, gop_cache, multicast, jsep) found\n");
 			error_code = JANUS_SOURCE_ERROR_INVALID_ELEMENT;
-			g_snprintf(error_cause, 512, "Message error: no supported attributes (audio, video, bitrate, record, id, jsep) found");
+			g_snprintf(error_cause, 512, "Message error: no supported attributes (audio, video, bitrate, record, id, gop_cache, multicast, jsep) found");
 			goto error;
 		}
 
@@ -968,34 +1402,11 @@ static void *janus_source_handler(void *data) {
 				type = "answer";
 			if (!strcasecmp(msg_sdp_type, "answer"))
 				type = "offer";
-			/* Any media direction that needs to be fixed? */
-			char *sdp = g_strdup(msg_sdp);
-			if (strstr(sdp, "a=recvonly")) {
-				/* Turn recvonly to inactive, as we simply bounce media back */
-				sdp = janus_string_replace(sdp, "a=recvonly", "a=inactive");
-			}
-			else if (strstr(sdp, "a=sendonly")) {
-				/* Turn sendonly to recvonly */
-				sdp = janus_string_replace(sdp, "a=sendonly", "a=recvonly");
-				/* FIXME We should also actually not echo this media back, though... */
-			}
-			/* Make also sure we get rid of ULPfec, red, etc. */
-			if (strstr(sdp, "ulpfec")) {
-				/* FIXME This really needs some better code */
-				sdp = janus_string_replace(sdp, "a=rtpmap:116 red/90000\r\n", "");
-				sdp = janus_string_replace(sdp, "a=rtpmap:117 ulpfec/90000\r\n", "");
-				sdp = janus_string_replace(sdp, "a=rtpmap:96 rtx/90000\r\n", "");
-				sdp = janus_string_replace(sdp, "a=fmtp:96 apt=100\r\n", "");
-				sdp = janus_string_replace(sdp, "a=rtpmap:97 rtx/90000\r\n", "");
-				sdp = janus_string_replace(sdp, "a=fmtp:97 apt=101\r\n", "");
-				sdp = janus_string_replace(sdp, "a=rtpmap:98 rtx/90000\r\n", "");
-				sdp = janus_string_replace(sdp, "a=fmtp:98 apt=116\r\n", "");
-				sdp = janus_string_replace(sdp, " 116", "");
-				sdp = janus_string_replace(sdp, " 117", "");
-				sdp = janus_string_replace(sdp, " 96", "");
-				sdp = janus_string_replace(sdp, " 97", "");
-				sdp = janus_string_replace(sdp, " 98", "");
-			}
+			/* Fix the media directions and get rid of ULPfec, red, rtx etc. in a single pass,
+			 * whatever payload types the offer gave them */
+			sdp_model *offer = sdp_parse(msg_sdp);
+			char *sdp = sdp_model_scrub(offer);
+			sdp_model_free(offer);
 			json_t *jsep = json_pack("{ssss}", "type", type, "sdp", sdp);
 			sdp = janus_source_do_codec_negotiation(session, sdp);
 			
@@ -1010,7 +1421,7 @@ static void *janus_source_handler(void *data) {
 			json_decref(event);
 			json_decref(jsep);
 		}
-		janus_source_message_free(msg);
+		janus_source_handler_done(worker, msg, session);
 		continue;
 
 	error:
@@ -1022,41 +1433,70 @@ static void *janus_source_handler(void *data) {
 			json_object_set_new(event, "error", json_string(error_cause));
 			int ret = gateway->push_event(msg->handle, &janus_source_plugin, msg->transaction, event, NULL);
 			JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
-			janus_source_message_free(msg);
+			janus_source_handler_done(worker, msg, session);
 			/* We don't need the event anymore */
 			json_decref(event);
 		}
 	}
 	g_free(error_cause);
-	JANUS_LOG(LOG_VERB, "Leaving SourcePlugin handler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving SourcePlugin handler thread %u\n", worker->index);
 	return NULL;
 }
 
 void janus_source_relay_rtp(janus_source_session *session, int video, char *buf, int len) {
 
-	janus_source_socket * sck = (video ? g_hash_table_lookup(session->sockets, "video_rtp_cli") : g_hash_table_lookup(session->sockets, "audio_rtp_cli"));
+	int stream = video ? JANUS_SOURCE_STREAM_VIDEO : JANUS_SOURCE_STREAM_AUDIO;
+	ingest_appsrc *ingest = g_atomic_pointer_get(&session->ingest);
 
-	if (!sck) {
-		JANUS_LOG(LOG_ERR, "Unable to lookup for rtp_cli\n");
-		return; 
-	} 
+	if (ingest) {
+		if (!ingest_appsrc_push(ingest, stream, JANUS_SOURCE_RELAY_RTP, buf, len)) {
+			g_atomic_pointer_add(&session->stats.stream[stream].send_failures, 1);
+		}
+		return;
+	}
 
-	if (g_socket_send(sck->socket, buf, len, NULL, NULL) < 0) {
-		//JANUS_LOG(LOG_ERR, "Send RTP failed! type: %s\n", video ? "video" : "audio");
+	relay_batch *batch = g_atomic_pointer_get(&session->relay_batch[stream]);
+
+	if (batch) {
+		/* A marker bit ends the frame, don't hold it back waiting for the batch to fill */
+		gboolean frame_end = len >= RTP_HEADER_SIZE && ((rtp_header *)buf)->markerbit;
+		relay_batch_push(batch, buf, len, frame_end);
+		return;
+	}
+
+	int fd = g_atomic_int_get(&session->relay_fd[stream][JANUS_SOURCE_RELAY_RTP]);
+
+	if (fd < 0) {
+		/* Sockets not set up yet (or already closed) */
+		return;
+	}
+
+	if (send(fd, buf, len, MSG_DONTWAIT) < 0) {
+		/* Counted rather than logged, this fires for every packet while the pipeline lags */
+		g_atomic_pointer_add(&session->stats.stream[stream].send_failures, 1);
 	}
 }
 
 static void janus_source_relay_rtcp(janus_source_session *session, int video, char *buf, int len) {
 
-	janus_source_socket * sck = (video ? g_hash_table_lookup(session->sockets, "video_rtcp_rcv_cli") : g_hash_table_lookup(session->sockets, "audio_rtcp_rcv_cli"));
+	int stream = video ? JANUS_SOURCE_STREAM_VIDEO : JANUS_SOURCE_STREAM_AUDIO;
+	ingest_appsrc *ingest = g_atomic_pointer_get(&session->ingest);
+
+	if (ingest) {
+		if (!ingest_appsrc_push(ingest, stream, JANUS_SOURCE_RELAY_RTCP, buf, len)) {
+			g_atomic_pointer_add(&session->stats.stream[stream].rtcp_failures, 1);
+		}
+		return;
+	}
+
+	int fd = g_atomic_int_get(&session->relay_fd[stream][JANUS_SOURCE_RELAY_RTCP]);
 
-	if (!sck) {
-		JANUS_LOG(LOG_ERR, "Unable to lookup for rtcp_rcv_cli\n");	
-		return; 
-	} 
+	if (fd < 0) {
+		return;
+	}
 
-	if (g_socket_send(sck->socket, buf, len, NULL, NULL) < 0) {
-		//JANUS_LOG(LOG_ERR, "Send RTCP failed! type: %s\n", video ? "video" : "audio");
+	if (send(fd, buf, len, MSG_DONTWAIT) < 0) {
+		g_atomic_pointer_add(&session->stats.stream[stream].rtcp_failures, 1);
 	}
 
 }
@@ -1071,6 +1511,17 @@ static void *janus_source_rtsp_server_thread(void *data) {
 	/*Create rtsp server and async queue*/
 	rtsp_server_data = g_malloc0(sizeof(janus_source_rtsp_server_data));
 	janus_source_create_rtsp_server_and_queue(rtsp_server_data, g_main_context_get_thread_default());
+	/* Keeps this thread for accepting connections, clients are served by the pool */
+	janus_source_rtsp_server_set_threads(rtsp_server_data, rtsp_threads, rtsp_thread_pinning);
+	if (multicast_address_range) {
+		if (multicast_min_port == 0 || multicast_max_port == 0) {
+			multicast_min_port = 5000;
+			multicast_max_port = 5999;
+			JANUS_LOG(LOG_WARN, "Using default multicast port range: %d-%d\n", multicast_min_port, multicast_max_port);
+		}
+		janus_source_rtsp_server_set_multicast(rtsp_server_data, multicast_address_range,
+			multicast_min_port, multicast_max_port, multicast_ttl, multicast_iface);
+	}
 
 #ifdef USE_THREAD_CONTEXT
 	/* Set up a worker context and make it thread-default */
@@ -1078,8 +1529,11 @@ static void *janus_source_rtsp_server_thread(void *data) {
 	g_main_context_push_thread_default(worker_context);
 #endif
 	
-	/* Create new queue source */
-	janus_source_attach_rtsp_queue_callback(rtsp_server_data, queue_events_callback, g_main_context_get_thread_default());
+	/* Session setup is queued to a thread of its own, the server's context only serves RTSP */
+	if (!janus_source_rtsp_setup_thread_start(rtsp_server_data, queue_events_callback)) {
+		/* Sets sessions up here, as before */
+		janus_source_attach_rtsp_queue_callback(rtsp_server_data, queue_events_callback, g_main_context_get_thread_default());
+	}
 	/* make a mainloop for the thread-default context */
 	janus_source_rtsp_create_and_run_main_loop(rtsp_server_data,g_main_context_get_thread_default());
 	
@@ -1107,24 +1561,162 @@ gboolean janus_source_send_rtcp_src_received(GSocket *socket, GIOCondition condi
 	len = g_socket_receive(socket, (gchar*)buf, sizeof(buf), NULL, NULL);
 
 	if (len > 0) {
+		janus_source_relay_rtcp_to_peer(session, data->is_video, buf, len);
+	}
 
-		if (janus_rtcp_has_pli(buf, len))
-		{
-			JANUS_LOG(LOG_VERB, "Source: received PLI\n");
-		}
+	return TRUE;
+}
+
+/* Same as above for the datagrams the RTCP reactor read */
+void janus_source_rtcp_src_datagram(char *buf, int len, gpointer data)
+{
+	janus_source_rtcp_cbk_data * cbk_data = (janus_source_rtcp_cbk_data *)data;
+	janus_source_session * session = (janus_source_session*)cbk_data->session;
 
-		JANUS_LOG(LOG_HUGE, "%s RTCP sent; len=%ld\n", data->is_video ? "Video" : "Audio", len);
-		gateway->relay_rtcp(session->handle, data->is_video, buf, len);
+	if (!session) {
+		JANUS_LOG(LOG_ERR, "janus_source_rtcp_src_datagram: session is NULL\n");
+		return;
 	}
 
-	return TRUE;
+	janus_source_relay_rtcp_to_peer(session, cbk_data->is_video, buf, len);
 }
 
-static void janus_source_close_session_func(gpointer key, gpointer value, gpointer user_data) {
+void janus_source_relay_rtcp_to_peer(janus_source_session *session, gboolean video, char *buf, int len)
+{
+	char *filtered = NULL;
 
-	if (value != NULL) {
-		janus_source_close_session((janus_source_session *)value);
+	if (video && (janus_rtcp_has_pli(buf, len) || janus_rtcp_has_fir(buf, len)))
+	{
+		/* The jitterbuffers ask for keyframes too, they share the viewers' budget */
+		JANUS_LOG(LOG_VERB, "Source: received PLI\n");
+		janus_source_request_keyframe(session, "pipeline feedback");
+		filtered = g_memdup(buf, len);
+		len = keyframe_limiter_strip_rtcp(filtered, len);
+		buf = filtered;
 	}
+
+	if (len > 0) {
+		JANUS_LOG(LOG_HUGE, "%s RTCP sent; len=%d\n", video ? "Video" : "Audio", len);
+		g_atomic_pointer_add(&session->stats.stream[video ? JANUS_SOURCE_STREAM_VIDEO : JANUS_SOURCE_STREAM_AUDIO].rtcp_out, 1);
+		gateway->relay_rtcp(session->handle, video, buf, len);
+	}
+	g_free(filtered);
+}
+
+/* Folds the viewers' reports once per viewer_feedback_interval, the loss is one more input of the bitrate controller */
+void janus_source_apply_viewer_feedback(janus_source_session *session, viewer_feedback *feedback)
+{
+	if (!session || session->destroyed || g_atomic_int_get(&session->hangingup) || !session->handle) {
+		return;
+	}
+	if (!viewer_feedback_aggregate(feedback, feedback_policy, feedback_percentile, (gint64)feedback_interval * 1000)) {
+		return;
+	}
+
+	guint reporting = 0, jitter_ms = 0;
+	gdouble loss = 0.0;
+	viewer_feedback_get(feedback, &reporting, &loss, &jitter_ms);
+
+	JANUS_LOG(LOG_HUGE, "%u viewers of %s report %.1f%% loss and %ums jitter\n",
+		reporting, session->id ? session->id : "?", loss * 100, jitter_ms);
+	bitrate_controller_viewer_loss(&session->bitrate_control, loss);
+}
+
+static void janus_source_send_remb(janus_source_session *session, guint64 bitrate)
+{
+	char buf[24];
+	memset(buf, 0, 24);
+	janus_rtcp_remb((char *)&buf, 24, bitrate);
+	gateway->relay_rtcp(session->handle, 1, buf, 24);
+}
+
+static void janus_source_send_pli(janus_source_session *session, const gchar *reason)
+{
+	if (session->keyframe_fir) {
+		JANUS_LOG(LOG_VERB, "Sending a FIR to the publisher of %s (%s)\n", session->id ? session->id : "?", reason);
+		char buf[20];
+		int seqnr = g_atomic_int_add(&session->fir_seq, 1);
+		memset(buf, 0, 20);
+		janus_rtcp_fir((char *)&buf, 20, &seqnr);
+		gateway->relay_rtcp(session->handle, 1, buf, 20);
+		return;
+	}
+
+	JANUS_LOG(LOG_VERB, "Sending a PLI to the publisher of %s (%s)\n", session->id ? session->id : "?", reason);
+	char buf[12];
+	memset(buf, 0, 12);
+	janus_rtcp_pli((char *)&buf, 12);
+	gateway->relay_rtcp(session->handle, 1, buf, 12);
+}
+
+/* Asks the publisher for a keyframe, at most once per keyframe_request_interval: requests in between are folded into one */
+void janus_source_request_keyframe(janus_source_session *session, const gchar *reason)
+{
+	if (!session || session->destroyed || g_atomic_int_get(&session->hangingup) || !session->handle) {
+		return;
+	}
+
+	if (keyframe_limiter_request(&session->keyframe)) {
+		janus_source_send_pli(session, reason);
+	} else {
+		JANUS_LOG(LOG_HUGE, "Keyframe request for %s folded into the next PLI (%s)\n", session->id ? session->id : "?", reason);
+	}
+}
+
+void janus_source_session_ref(janus_source_session *session) {
+	g_atomic_int_inc(&session->ref);
+}
+
+void janus_source_session_unref(janus_source_session *session) {
+	if (g_atomic_int_dec_and_test(&session->ref)) {
+		JANUS_LOG(LOG_VERB, "Freeing old SourcePlugin session\n");
+		session->handle = NULL;
+		/* Flushed into the sockets before they are closed */
+		janus_source_relay_batches_destroy(session);
+		janus_source_relay_sockets_close(session);
+		janus_source_ingest_destroy(session);
+		keyframe_limiter_destroy(&session->keyframe);
+		bitrate_controller_destroy(&session->bitrate_control);
+		janus_mutex_destroy(&session->mutex);
+		g_free(session);
+	}
+}
+
+/* A reference to the session's mount data, NULL if it has none */
+pipeline_callback_data_t *janus_source_session_get_callback_data(janus_source_session *session) {
+	janus_mutex_lock(&session->mutex);
+	pipeline_callback_data_t *data = session->callback_data ? pipeline_callback_data_ref(session->callback_data) : NULL;
+	janus_mutex_unlock(&session->mutex);
+	return data;
+}
+
+void janus_source_session_set_callback_data(janus_source_session *session, pipeline_callback_data_t *data) {
+	janus_mutex_lock(&session->mutex);
+	session->callback_data = data;
+	janus_mutex_unlock(&session->mutex);
+}
+
+/* Runs janus_rtsp_handle_client_callback on the RTSP thread, with the reference janus_source_setup_media took */
+static void janus_source_handle_client_event(gpointer data) {
+	char thread_name[16] = "";
+	pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name));
+	JANUS_LOG(LOG_VERB, "Setting up a source session on thread \"%s\"\n", thread_name);
+	janus_rtsp_handle_client_callback(data);
+	janus_source_session_unref((janus_source_session *)data);
+}
+
+/* On shutdown, sessions still in the tables are closed and reclaimed like destroyed ones */
+static gboolean janus_source_close_session_func(gpointer key, gpointer value, gpointer user_data) {
+	janus_source_session *session = (janus_source_session *)value;
+
+	if (session != NULL && !session->destroyed) {
+		janus_source_close_session(session);
+		session->destroyed = janus_get_monotonic_time();
+		janus_mutex_lock(&reclaim_mutex);
+		g_queue_push_tail(&reclaim_queue, session);
+		janus_mutex_unlock(&reclaim_mutex);
+	}
+	return TRUE;
 }
 
 static void janus_source_close_session(janus_source_session * session) {
@@ -1134,18 +1726,24 @@ static void janus_source_close_session(janus_source_session * session) {
 	gchar *curl_str = g_strdup_printf("%s/%s", status_service_url, session_id);	
 
 #ifdef USE_REGISTRY_SERVICE
-	curl_request(curl_handle, curl_str, "{}", "DELETE", NULL);		    
+	curl_async_request(curl_str, "{}", "DELETE", NULL, NULL, NULL);
 #endif	    
 
-	if(rtsp_server_data && session->callback_data)	
-		janus_source_rtsp_remove_mountpoint(rtsp_server_data, session->id, session->callback_data);
+	/* Nothing reads the pipeline's feedback for this session any more */
+	janus_source_relay_sockets_detach(session);
 
-	if (session->sockets) {
-		JANUS_LOG(LOG_VERB, "Closing session sockets\n");
-		g_hash_table_foreach_remove(session->sockets, (GHRFunc)close_and_destroy_sockets, NULL);
-		g_hash_table_destroy(session->sockets);
-		session->sockets = NULL;
-	}
+	janus_mutex_lock(&session->mutex);
+	pipeline_callback_data_t *callback_data = session->callback_data;
+	session->callback_data = NULL;
+	janus_mutex_unlock(&session->mutex);
+	/* Released along with the mountpoint */
+	if(rtsp_server_data && callback_data)	
+		janus_source_rtsp_remove_mountpoint(rtsp_server_data, session->id, callback_data);
+
+	/* Stop the media path from using the fds, a packet thread may still be sending on one:
+	 * the sockets, the relay batches and the ingest are freed when the session is reclaimed */
+	janus_source_ingest_detach(session);
+	janus_source_relay_fds_reset(session);
 
 	g_free(session_id);
 	session_id = NULL;
@@ -1153,8 +1751,11 @@ static void janus_source_close_session(janus_source_session * session) {
 	g_free(curl_str);
 	curl_str = NULL;
 
-	g_free(session->id);
+	janus_mutex_lock(&session->mutex);
+	gchar *old_id = session->id;
 	session->id = NULL;
+	janus_mutex_unlock(&session->mutex);
+	g_free(old_id);
 
 	g_free(session->db_entry_session_id);
 	session->db_entry_session_id = NULL;
@@ -1213,6 +1814,42 @@ static void janus_source_parse_status_service_url(janus_config_item *config_url,
 }
 
 
+static void janus_source_parse_uint(janus_config_item *config, guint *value) {
+	if (config && config->value) {
+		*value = atoi(config->value);
+		JANUS_LOG(LOG_VERB, "%s: %u\n", config->name, *value);
+	}
+}
+
+static void janus_source_parse_bool(janus_config_item *config, gboolean *value) {
+	if (config && config->value) {
+		*value = janus_is_true(config->value);
+		JANUS_LOG(LOG_VERB, "%s: %s\n", config->name, *value ? "yes" : "no");
+	}
+}
+
+static void janus_source_parse_string(janus_config_item *config, gchar **value) {
+	if (config && config->value && *config->value) {
+		g_free(*value);
+		*value = g_strdup(config->value);
+		JANUS_LOG(LOG_VERB, "%s: %s\n", config->name, *value);
+	}
+}
+
+static void janus_source_parse_ingest_mode(janus_config_item *config, janus_source_ingest_mode *mode) {
+	if (config && config->value) {
+		if (!g_ascii_strcasecmp(config->value, "appsrc")) {
+			*mode = JANUS_SOURCE_INGEST_APPSRC;
+		} else if (!g_ascii_strcasecmp(config->value, "udp")) {
+			*mode = JANUS_SOURCE_INGEST_UDP;
+		} else {
+			JANUS_LOG(LOG_WARN, "Unknown ingest mode %s, using udp\n", config->value);
+			*mode = JANUS_SOURCE_INGEST_UDP;
+		}
+		JANUS_LOG(LOG_VERB, "Ingest mode: %s\n", *mode == JANUS_SOURCE_INGEST_APPSRC ? "appsrc" : "udp");
+	}
+}
+
 static void janus_source_parse_video_codec_priority(janus_config_item *config) {
 	if (config && config->value)
 	{
@@ -1245,10 +1882,28 @@ static void janus_source_parse_rtsp_interface_ip(janus_config_item *config, gcha
 
 
 
-static idilia_codec janus_source_select_video_codec_by_priority_list(const gchar * sdp)
+/* Prebuilds the video codecs of the priority list (VP8 otherwise) paired with Opus, others join on their first miss */
+static void janus_source_warm_pipeline_pool(void)
+{
+	idilia_codec codec[JANUS_SOURCE_STREAM_MAX] = { IDILIA_CODEC_VP8, IDILIA_CODEC_OPUS };
+
+	if (!use_codec_priority) {
+		pipeline_pool_warm(codec);
+		return;
+	}
+
+	for (guint i = 0; i < sizeof(codec_priority_list) / sizeof(codec_priority_list[0]); i++) {
+		if (codec_priority_list[i] != IDILIA_CODEC_INVALID) {
+			codec[JANUS_SOURCE_STREAM_VIDEO] = codec_priority_list[i];
+			pipeline_pool_warm(codec);
+		}
+	}
+}
+
+static idilia_codec janus_source_select_video_codec_by_priority_list(const sdp_model * offer)
 {
 	for (guint i = 0; i < sizeof(codec_priority_list) / sizeof(codec_priority_list[0]); i++) {
-	if (sdp_get_codec_pt(sdp, codec_priority_list[i]) != -1)
+	if (sdp_model_get_codec_pt(offer, codec_priority_list[i]) != -1)
 		return codec_priority_list[i];
 	}
 	
@@ -1259,23 +1914,32 @@ static gchar * janus_source_do_codec_negotiation(janus_source_session * session,
 {
 	gchar * sdp = NULL;
 	
-	idilia_codec preferred_codec = janus_source_select_video_codec_by_priority_list(orig_sdp);
-	sdp = sdp_set_video_codec(orig_sdp, preferred_codec);
+	/* Each side is parsed once, every query below is answered from the models */
+	sdp_model * offer = sdp_parse(orig_sdp);
+	idilia_codec preferred_codec = janus_source_select_video_codec_by_priority_list(offer);
+	sdp = sdp_model_set_video_codec(offer, preferred_codec);
+	sdp_model_free(offer);
 	g_free(orig_sdp);
 	
+	sdp_model * answer = sdp_parse(sdp);
 	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++)
 	{
 		if (stream == JANUS_SOURCE_STREAM_VIDEO) {
-			session->codec[stream] = sdp_get_video_codec(sdp);
+			session->codec[stream] = sdp_model_get_video_codec(answer);
 		}
 		else if (stream == JANUS_SOURCE_STREAM_AUDIO) {
-			session->codec[stream] = sdp_get_audio_codec(sdp);
+			session->codec[stream] = sdp_model_get_audio_codec(answer);
 		}
 		
-		session->codec_pt[stream] = sdp_get_codec_pt(sdp, session->codec[stream]);
+		session->codec_pt[stream] = sdp_model_get_codec_pt(answer, session->codec[stream]);
+		if (stream == JANUS_SOURCE_STREAM_VIDEO) {
+			guint rtcp_fb = sdp_model_get_rtcp_fb(answer, session->codec_pt[stream]);
+			session->keyframe_fir = !(rtcp_fb & SDP_RTCP_FB_NACK_PLI) && (rtcp_fb & SDP_RTCP_FB_CCM_FIR);
+		}
 	
 		JANUS_LOG(LOG_INFO, "Codec used: %s\n", get_codec_name(session->codec[stream]));
 	}
+	sdp_model_free(answer);
 	return sdp;
 }
 
@@ -1283,6 +1947,225 @@ const gchar *janus_source_get_rtsp_ip(void) {
 	return rtsp_interface_ip;
 }
 
+/* Families written per mount, in this order */
+enum {
+	JANUS_SOURCE_METRIC_VIEWERS = 0,
+	JANUS_SOURCE_METRIC_SUSPENDED,
+	JANUS_SOURCE_METRIC_PIPELINE_STATE,
+	JANUS_SOURCE_METRIC_ESTIMATE,
+	JANUS_SOURCE_METRIC_PACKETS,
+	JANUS_SOURCE_METRIC_BYTES,
+	JANUS_SOURCE_METRIC_LOST,
+	JANUS_SOURCE_METRIC_JITTER,
+	JANUS_SOURCE_METRIC_FAILURES,
+	JANUS_SOURCE_METRIC_MAX
+};
+
+static const struct {
+	const gchar *name;
+	const gchar *type;
+	const gchar *help;
+} janus_source_mount_metrics[JANUS_SOURCE_METRIC_MAX] = {
+	{ "idilia_source_mount_viewers", "gauge", "RTSP clients set up on the mount" },
+	{ "idilia_source_mount_suspended", "gauge", "Whether the mount's shared media is suspended for lack of viewers" },
+	{ "idilia_source_mount_pipeline_state", "gauge", "State of the mount's shared pipeline: 0 no media yet, 1 NULL, 2 READY, 3 PAUSED, 4 PLAYING" },
+	{ "idilia_source_bitrate_estimate_bps", "gauge", "REMB estimate of the publisher, 0 while it was never congested" },
+	{ "idilia_source_rtp_packets_total", "counter", "RTP packets received from the publisher" },
+	{ "idilia_source_rtp_bytes_total", "counter", "RTP bytes received from the publisher" },
+	{ "idilia_source_rtp_lost_total", "counter", "RTP packets of the publisher that never arrived" },
+	{ "idilia_source_rtp_jitter_seconds", "gauge", "Interarrival jitter of the publisher's RTP" },
+	{ "idilia_source_relay_failures_total", "counter", "RTP packets the pipeline could not be handed" },
+};
+
+/* Appends a sample of metric for mount, and stream unless it is -1 */
+static void janus_source_metrics_sample(GString **families, int metric, const gchar *mount, int stream, const gchar *format, ...)
+{
+	GString *family = families[metric];
+	va_list args;
+
+	g_string_append_printf(family, "%s{", janus_source_mount_metrics[metric].name);
+	metrics_append_label(family, "mount", mount);
+	if (stream >= 0) {
+		g_string_append_c(family, ',');
+		metrics_append_label(family, "stream", stream == JANUS_SOURCE_STREAM_VIDEO ? "video" : "audio");
+	}
+	g_string_append(family, "} ");
+	va_start(args, format);
+	g_string_append_vprintf(family, format, args);
+	va_end(args);
+	g_string_append_c(family, '\n');
+}
+
+/* Runs on the metrics thread: shard locks are only held to reference the sessions, media threads are never waited for */
+static void janus_source_collect_metrics(GString *out)
+{
+	GPtrArray *sessions = g_ptr_array_new_with_free_func((GDestroyNotify)janus_source_session_unref);
+	for (guint i = 0; i < JANUS_SOURCE_SESSION_SHARDS; i++) {
+		GHashTableIter iter;
+		gpointer value;
+		janus_mutex_lock(&session_shards[i].mutex);
+		g_hash_table_iter_init(&iter, session_shards[i].sessions);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_source_session *session = (janus_source_session *)value;
+			if (!session->destroyed) {
+				janus_source_session_ref(session);
+				g_ptr_array_add(sessions, session);
+			}
+		}
+		janus_mutex_unlock(&session_shards[i].mutex);
+	}
+
+	GString *families[JANUS_SOURCE_METRIC_MAX];
+	for (int metric = 0; metric < JANUS_SOURCE_METRIC_MAX; metric++) {
+		families[metric] = g_string_new(NULL);
+		metrics_describe(families[metric], janus_source_mount_metrics[metric].name,
+			janus_source_mount_metrics[metric].type, janus_source_mount_metrics[metric].help);
+	}
+
+	guint mounts = 0;
+	for (guint i = 0; i < sessions->len; i++) {
+		janus_source_session *session = (janus_source_session *)g_ptr_array_index(sessions, i);
+		/* The session reference does not cover the mount, which close_session may drop meanwhile */
+		pipeline_callback_data_t *data = janus_source_session_get_callback_data(session);
+		if (!data || !data->id) {
+			if (data) {
+				pipeline_callback_data_unref(data);
+			}
+			continue;
+		}
+		mounts++;
+		/* The mount's own copy of the id, session->id may be freed by close_session meanwhile */
+		const gchar *id = data->id;
+
+		pipeline_suspend_stats suspend;
+		janus_source_get_suspend_stats(data, &suspend);
+		GstState pipeline_state = janus_source_get_pipeline_state(data);
+		bitrate_controller_stats control;
+		bitrate_controller_get_stats(&session->bitrate_control, &control);
+
+		janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_VIEWERS, id, -1,
+			"%d", g_atomic_int_get(&session->viewers));
+		janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_SUSPENDED, id, -1,
+			"%d", suspend.suspended ? 1 : 0);
+		janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_PIPELINE_STATE, id, -1,
+			"%d", (int)pipeline_state);
+		janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_ESTIMATE, id, -1,
+			"%"SCNu64, control.estimate);
+		session_stats_stream_snapshot snapshot[JANUS_SOURCE_STREAM_MAX];
+		guint64 keyframes = 0;
+		gint64 keyframe_interval = 0;
+		session_stats_snapshot(&session->stats, snapshot, &keyframes, &keyframe_interval);
+		for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+			janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_PACKETS, id, stream,
+				"%"SCNu64, snapshot[stream].packets);
+			janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_BYTES, id, stream,
+				"%"SCNu64, snapshot[stream].bytes);
+			janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_LOST, id, stream,
+				"%"SCNu64, snapshot[stream].lost);
+			janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_JITTER, id, stream,
+				"%.6f", snapshot[stream].jitter);
+			janus_source_metrics_sample(families, JANUS_SOURCE_METRIC_FAILURES, id, stream,
+				"%"SCNu64, snapshot[stream].send_failures);
+		}
+		pipeline_callback_data_unref(data);
+	}
+
+	metrics_describe(out, "idilia_source_sessions", "gauge", "Live sessions");
+	g_string_append_printf(out, "idilia_source_sessions %u\n", sessions->len);
+	metrics_describe(out, "idilia_source_mounts", "gauge", "Sessions with an RTSP mount");
+	g_string_append_printf(out, "idilia_source_mounts %u\n", mounts);
+	for (int metric = 0; metric < JANUS_SOURCE_METRIC_MAX; metric++) {
+		g_string_append_len(out, families[metric]->str, families[metric]->len);
+		g_string_free(families[metric], TRUE);
+	}
+	g_ptr_array_free(sessions, TRUE);
+
+	if (ingest_mode == JANUS_SOURCE_INGEST_UDP) {
+		gint in_use = 0, high_water = 0, quarantined = 0;
+		socket_utils_get_ports_stats(&in_use, &high_water, &quarantined);
+		metrics_describe(out, "idilia_source_ports_in_use", "gauge", "Loopback ports taken from the ports pool");
+		g_string_append_printf(out, "idilia_source_ports_in_use %d\n", in_use);
+		metrics_describe(out, "idilia_source_ports_high_water", "gauge", "Most loopback ports ever taken at once");
+		g_string_append_printf(out, "idilia_source_ports_high_water %d\n", high_water);
+		metrics_describe(out, "idilia_source_ports_quarantined", "gauge", "Released ports not reusable yet");
+		g_string_append_printf(out, "idilia_source_ports_quarantined %d\n", quarantined);
+	}
+
+	if (relay_batch_enabled()) {
+		guint64 flushes = 0, packets = 0, dropped = 0;
+		relay_batch_get_totals(&flushes, &packets, &dropped);
+		metrics_describe(out, "idilia_source_relay_batch_flushes_total", "counter", "sendmmsg calls relaying RTP to the pipelines");
+		g_string_append_printf(out, "idilia_source_relay_batch_flushes_total %"SCNu64"\n", flushes);
+		metrics_describe(out, "idilia_source_relay_batch_packets_total", "counter", "RTP packets relayed through a batch");
+		g_string_append_printf(out, "idilia_source_relay_batch_packets_total %"SCNu64"\n", packets);
+		metrics_describe(out, "idilia_source_relay_batch_dropped_total", "counter", "Staged RTP packets the loopback sockets refused");
+		g_string_append_printf(out, "idilia_source_relay_batch_dropped_total %"SCNu64"\n", dropped);
+	}
+
+	metrics_describe(out, "idilia_source_handler_queue_depth", "gauge", "Messages waiting for a handler thread");
+	for (guint i = 0; i < handlers_count; i++) {
+		g_string_append_printf(out, "idilia_source_handler_queue_depth{handler=\"%u\"} %d\n",
+			i, g_async_queue_length(handlers[i].messages));
+	}
+	GString *handled = g_string_new(NULL), *max_depth = g_string_new(NULL);
+	GString *latency = g_string_new(NULL), *max_latency = g_string_new(NULL);
+	metrics_describe(handled, "idilia_source_handler_messages_total", "counter", "Messages handled");
+	metrics_describe(max_depth, "idilia_source_handler_queue_depth_max", "gauge", "Most messages ever waiting for the handler thread");
+	metrics_describe(latency, "idilia_source_handler_latency_seconds_total", "counter", "Time from queueing to the end of handling, over all the messages handled");
+	metrics_describe(max_latency, "idilia_source_handler_latency_seconds_max", "gauge", "Longest time a message took from queueing to the end of handling");
+	for (guint i = 0; i < handlers_count; i++) {
+		janus_mutex_lock(&handlers[i].stats_mutex);
+		g_string_append_printf(handled, "idilia_source_handler_messages_total{handler=\"%u\"} %"SCNu64"\n", i, handlers[i].handled);
+		g_string_append_printf(max_depth, "idilia_source_handler_queue_depth_max{handler=\"%u\"} %u\n", i, handlers[i].max_depth);
+		g_string_append_printf(latency, "idilia_source_handler_latency_seconds_total{handler=\"%u\"} %.6f\n", i, handlers[i].total_latency / 1e6);
+		g_string_append_printf(max_latency, "idilia_source_handler_latency_seconds_max{handler=\"%u\"} %.6f\n", i, handlers[i].max_latency / 1e6);
+		janus_mutex_unlock(&handlers[i].stats_mutex);
+	}
+	GString *handler_families[] = { handled, max_depth, latency, max_latency };
+	for (guint i = 0; i < G_N_ELEMENTS(handler_families); i++) {
+		g_string_append_len(out, handler_families[i]->str, handler_families[i]->len);
+		g_string_free(handler_families[i], TRUE);
+	}
+
+	if (pipeline_pool_enabled()) {
+		guint64 hits = 0, misses = 0;
+		pipeline_pool_get_stats(&hits, &misses);
+		metrics_describe(out, "idilia_source_pipeline_pool_hits_total", "counter", "Mounts that got a prebuilt pipeline");
+		g_string_append_printf(out, "idilia_source_pipeline_pool_hits_total %"SCNu64"\n", hits);
+		metrics_describe(out, "idilia_source_pipeline_pool_misses_total", "counter", "Mounts that had to build their pipeline");
+		g_string_append_printf(out, "idilia_source_pipeline_pool_misses_total %"SCNu64"\n", misses);
+	}
+
+	gint rtsp_max_threads = 0, rtsp_active_threads = 0;
+	janus_source_rtsp_server_get_threads(&rtsp_max_threads, &rtsp_active_threads);
+	metrics_describe(out, "idilia_source_rtsp_threads_active", "gauge", "Threads serving RTSP clients");
+	g_string_append_printf(out, "idilia_source_rtsp_threads_active %d\n", rtsp_active_threads);
+}
+
+janus_source_ingest_mode janus_source_get_ingest_mode(void) {
+	return ingest_mode;
+}
+
+gboolean janus_source_get_rtp_passthrough(void) {
+	return rtp_passthrough && (rtp_mtu == 0 || rtp_mtu >= JANUS_SOURCE_PASSTHROUGH_MIN_MTU);
+}
+
+guint janus_source_get_rtp_mtu(void) {
+	return rtp_mtu;
+}
+
+gsize janus_source_get_gop_cache_size(void) {
+	return gop_cache_size;
+}
+
+guint janus_source_get_media_idle_timeout(void) {
+	return media_idle_timeout;
+}
+
+viewer_feedback_policy janus_source_get_viewer_feedback_policy(void) {
+	return feedback_policy;
+}
+
 void janus_source_send_id_error(janus_plugin_session *handle) {
 	if (g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
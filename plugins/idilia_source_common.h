@@ -6,33 +6,86 @@
 #include "plugin.h"
 #include "rtsp_server.h"
 #include "pipeline_callback_data.h"
+#include "relay_batch.h"
+#include "ingest_appsrc.h"
+#include "keyframe_limiter.h"
+#include "bitrate_controller.h"
+#include "session_stats.h"
+#include "client_queue.h"
 
 #define USE_REGISTRY_SERVICE
 
+/* How RTP/RTCP from the peer reaches the GStreamer pipeline */
+typedef enum
+{
+	JANUS_SOURCE_INGEST_UDP = 0,	/* loopback UDP sockets read by udpsrc */
+	JANUS_SOURCE_INGEST_APPSRC	/* pushed in-process into appsrc */
+} janus_source_ingest_mode;
+
 typedef struct janus_source_session {
 	janus_plugin_session *handle;
 	gboolean audio_active;
 	gboolean video_active;
 	uint64_t bitrate;
+	/* REMB estimate from the publisher's loss, the slow link events and the viewers' reports */
+	bitrate_controller bitrate_control;
+	/* Counters of the publisher's media, atomics and a sequence counter on the packet path */
+	session_stats stats;
 	guint16 slowlink_count;
 	volatile gint hangingup;
 	gint64 destroyed;	/* Time at which this session was marked as destroyed */
 	gchar * db_entry_session_id;
 	gchar * rtsp_url;
 	gchar * id; /* stream id */
-	CURL *curl_handle;	
 	gchar *status_service_url;
 	gchar *keepalive_service_url;
 	const gchar *pid; 
 	idilia_codec codec[JANUS_SOURCE_STREAM_MAX];
 	gint codec_pt[JANUS_SOURCE_STREAM_MAX];
     GHashTable * sockets;
+	/* Raw fds of the loopback client sockets, indexed by stream and relay kind;
+	 * -1 until janus_rtsp_handle_client_callback publishes them */
+	volatile gint relay_fd[JANUS_SOURCE_STREAM_MAX][JANUS_SOURCE_RELAY_MAX];
+	/* RTP staging for sendmmsg, NULL when batching is disabled */
+	relay_batch *relay_batch[JANUS_SOURCE_STREAM_MAX];
+	/* In-process ingest, NULL in UDP ingest mode */
+	ingest_appsrc *ingest;
+	/* Whether the mount keeps a GOP for late joiners, when gop_cache_size allows it */
+	volatile gint gop_cache;
+	/* Keyframe requests to the publisher, from RTSP viewers and from the pipeline */
+	keyframe_limiter keyframe;
+	/* The publisher's video codec takes ccm fir but not nack pli, requests then go out as FIR */
+	gboolean keyframe_fir;
+	volatile gint fir_seq;
+	/* RTSP clients that described or set up the mount, RTP is dropped while there are none and ingest_gating is on */
+	volatile gint viewers;
+	volatile gsize gated_packets;
+	/* Viewers of the mount get RTP from a multicast group, fixed once the mount exists */
+	gboolean multicast;
+	/* Owns the mount's reference, read through janus_source_session_get_callback_data off the RTSP thread */
 	pipeline_callback_data_t * callback_data;
+	janus_mutex mutex;
+	/* One reference for the sessions table, one per message or RTSP task in progress */
+	volatile gint ref;
 } janus_source_session;
 
 
 /* idilia_source.c */
 extern gboolean janus_source_send_rtcp_src_received(GSocket *socket, GIOCondition condition, janus_source_rtcp_cbk_data * data);
+extern void janus_source_rtcp_src_datagram(char *buf, int len, gpointer data);
+extern void janus_source_relay_rtcp_to_peer(janus_source_session *session, gboolean video, char *buf, int len);
+extern void janus_source_request_keyframe(janus_source_session *session, const gchar *reason);
+extern void janus_source_apply_viewer_feedback(janus_source_session *session, viewer_feedback *feedback);
+extern void janus_source_session_ref(janus_source_session *session);
+extern void janus_source_session_unref(janus_source_session *session);
+extern pipeline_callback_data_t *janus_source_session_get_callback_data(janus_source_session *session);
+extern void janus_source_session_set_callback_data(janus_source_session *session, pipeline_callback_data_t *data);
+extern janus_source_ingest_mode janus_source_get_ingest_mode(void);
+extern gboolean janus_source_get_rtp_passthrough(void);
+extern guint janus_source_get_rtp_mtu(void);
+extern gsize janus_source_get_gop_cache_size(void);
+extern guint janus_source_get_media_idle_timeout(void);
+extern viewer_feedback_policy janus_source_get_viewer_feedback_policy(void);
 extern const gchar *janus_source_get_rtsp_ip(void);
 extern void janus_source_hangup_media(janus_plugin_session *handle);
 extern void janus_source_send_id_error(janus_plugin_session *handle); 
@@ -0,0 +1,156 @@
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include "ingest_appsrc.h"
+#include "idilia_source_common.h"
+#include "socket_names.h"
+#include "debug.h"
+
+/* The appsrc/appsink elements reuse the names of the sockets they replace */
+static const gchar * appsrc_names[JANUS_SOURCE_STREAM_MAX][JANUS_SOURCE_RELAY_MAX] = {
+	{ SOCKET_VIDEO_RTP_SRV, SOCKET_VIDEO_RTCP_RCV_SRV },
+	{ SOCKET_AUDIO_RTP_SRV, SOCKET_AUDIO_RTCP_RCV_SRV }
+};
+static const gchar * appsink_names[JANUS_SOURCE_STREAM_MAX] = {
+	SOCKET_VIDEO_RTCP_SND_SRV,
+	SOCKET_AUDIO_RTCP_SND_SRV
+};
+
+static GstFlowReturn ingest_appsrc_feedback_cb(GstElement * appsink, janus_source_rtcp_cbk_data * data)
+{
+	GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(appsink));
+	if (!sample) {
+		return GST_FLOW_EOS;
+	}
+
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstMapInfo map;
+	if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		janus_source_relay_rtcp_to_peer((janus_source_session *)data->session, data->is_video, (char *)map.data, map.size);
+		gst_buffer_unmap(buffer, &map);
+	}
+
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+static void ingest_appsrc_feedback_free(gpointer data, GClosure * closure)
+{
+	janus_source_rtcp_cbk_data *cbk_data = (janus_source_rtcp_cbk_data *)data;
+	janus_source_session_unref((janus_source_session *)cbk_data->session);
+	g_free(cbk_data);
+}
+
+/* Called with the mutex held */
+static void ingest_appsrc_disconnect(ingest_appsrc * ingest, int stream)
+{
+	if (ingest->appsink[stream]) {
+		g_signal_handler_disconnect(ingest->appsink[stream], ingest->feedback_id[stream]);
+		gst_object_unref(ingest->appsink[stream]);
+		ingest->appsink[stream] = NULL;
+		ingest->feedback_id[stream] = 0;
+	}
+}
+
+ingest_appsrc * ingest_appsrc_new(void)
+{
+	ingest_appsrc *ingest = g_new0(ingest_appsrc, 1);
+	janus_mutex_init(&ingest->mutex);
+
+	ingest->pool = gst_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(ingest->pool);
+	gst_buffer_pool_config_set_params(config, NULL, INGEST_APPSRC_BUFFER_SIZE, INGEST_APPSRC_POOL_MIN, 0);
+	if (!gst_buffer_pool_set_config(ingest->pool, config) || !gst_buffer_pool_set_active(ingest->pool, TRUE)) {
+		JANUS_LOG(LOG_WARN, "Unable to activate ingest buffer pool, falling back to plain allocations\n");
+		gst_object_unref(ingest->pool);
+		ingest->pool = NULL;
+	}
+
+	return ingest;
+}
+
+void ingest_appsrc_free(ingest_appsrc * ingest)
+{
+	if (!ingest) {
+		return;
+	}
+
+	ingest_appsrc_detach(ingest);
+
+	if (ingest->pool) {
+		gst_buffer_pool_set_active(ingest->pool, FALSE);
+		gst_object_unref(ingest->pool);
+		ingest->pool = NULL;
+	}
+
+	janus_mutex_destroy(&ingest->mutex);
+	g_free(ingest);
+}
+
+void ingest_appsrc_attach(ingest_appsrc * ingest, GstElement * bin, pipeline_callback_data_t * data)
+{
+	janus_mutex_lock(&ingest->mutex);
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		for (int kind = 0; kind < JANUS_SOURCE_RELAY_MAX; kind++) {
+			/* A new media replaces the elements of the previous one, if any */
+			GstElement *appsrc = gst_bin_get_by_name(GST_BIN(bin), appsrc_names[stream][kind]);
+			if (ingest->appsrc[stream][kind]) {
+				gst_object_unref(ingest->appsrc[stream][kind]);
+			}
+			ingest->appsrc[stream][kind] = appsrc;
+		}
+
+		/* The callback data outlives the mount's: an emission may still be running when it is disconnected */
+		ingest_appsrc_disconnect(ingest, stream);
+		GstElement *appsink = gst_bin_get_by_name(GST_BIN(bin), appsink_names[stream]);
+		if (appsink) {
+			janus_source_rtcp_cbk_data *cbk_data = g_new(janus_source_rtcp_cbk_data, 1);
+			*cbk_data = data->rtcp_cbk_data[stream];
+			janus_source_session_ref((janus_source_session *)cbk_data->session);
+			ingest->appsink[stream] = appsink;
+			ingest->feedback_id[stream] = g_signal_connect_data(appsink, "new-sample",
+				(GCallback)ingest_appsrc_feedback_cb, cbk_data, ingest_appsrc_feedback_free, 0);
+		}
+	}
+	janus_mutex_unlock(&ingest->mutex);
+}
+
+void ingest_appsrc_detach(ingest_appsrc * ingest)
+{
+	janus_mutex_lock(&ingest->mutex);
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		for (int kind = 0; kind < JANUS_SOURCE_RELAY_MAX; kind++) {
+			if (ingest->appsrc[stream][kind]) {
+				gst_object_unref(ingest->appsrc[stream][kind]);
+				ingest->appsrc[stream][kind] = NULL;
+			}
+		}
+		ingest_appsrc_disconnect(ingest, stream);
+	}
+	janus_mutex_unlock(&ingest->mutex);
+}
+
+gboolean ingest_appsrc_push(ingest_appsrc * ingest, int stream, int kind, const char * buf, int len)
+{
+	GstFlowReturn ret = GST_FLOW_FLUSHING;
+	GstBuffer *buffer = NULL;
+
+	if (len <= 0) {
+		return FALSE;
+	}
+
+	janus_mutex_lock(&ingest->mutex);
+	GstElement *appsrc = ingest->appsrc[stream][kind];
+	if (appsrc) {
+		if (len > INGEST_APPSRC_BUFFER_SIZE || !ingest->pool ||
+			gst_buffer_pool_acquire_buffer(ingest->pool, &buffer, NULL) != GST_FLOW_OK) {
+			buffer = gst_buffer_new_allocate(NULL, len, NULL);
+		}
+		gst_buffer_fill(buffer, 0, buf, len);
+		gst_buffer_set_size(buffer, len);
+		/* appsrc takes ownership of the buffer */
+		ret = gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+	}
+	janus_mutex_unlock(&ingest->mutex);
+
+	return ret == GST_FLOW_OK;
+}
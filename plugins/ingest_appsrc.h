@@ -0,0 +1,26 @@
+#pragma once
+
+#include <gst/gst.h>
+#include "mutex.h"
+#include "pipeline_callback_data.h"
+
+/* Size of the pooled buffers, anything larger gets a one-off allocation */
+#define INGEST_APPSRC_BUFFER_SIZE 1500
+/* Buffers preallocated by the pool */
+#define INGEST_APPSRC_POOL_MIN 16
+
+/* In-process ingest: packets from the peer are pushed straight into the media's appsrc elements */
+typedef struct ingest_appsrc {
+	janus_mutex mutex;
+	GstElement *appsrc[JANUS_SOURCE_STREAM_MAX][JANUS_SOURCE_RELAY_MAX];
+	/* Feedback from the pipeline, the handler holds a reference to the session until disconnected */
+	GstElement *appsink[JANUS_SOURCE_STREAM_MAX];
+	gulong feedback_id[JANUS_SOURCE_STREAM_MAX];
+	GstBufferPool *pool;
+} ingest_appsrc;
+
+ingest_appsrc * ingest_appsrc_new(void);
+void ingest_appsrc_free(ingest_appsrc * ingest);
+void ingest_appsrc_attach(ingest_appsrc * ingest, GstElement * bin, pipeline_callback_data_t * data);
+void ingest_appsrc_detach(ingest_appsrc * ingest);
+gboolean ingest_appsrc_push(ingest_appsrc * ingest, int stream, int kind, const char * buf, int len);
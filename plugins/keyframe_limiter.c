@@ -0,0 +1,103 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include "keyframe_limiter.h"
+#include "rtcp.h"
+#include "utils.h"
+
+/* PSFB feedback message types (RFC 4585, RFC 5104) */
+#define KEYFRAME_LIMITER_FMT_PLI 1
+#define KEYFRAME_LIMITER_FMT_FIR 4
+
+void keyframe_limiter_init(keyframe_limiter * kl, guint min_interval_ms)
+{
+	janus_mutex_init(&kl->mutex);
+	kl->min_interval = (gint64)min_interval_ms * 1000;
+	kl->last_sent = 0;
+	kl->requests = 0;
+	kl->sent = 0;
+	g_atomic_int_set(&kl->pending, 0);
+}
+
+void keyframe_limiter_destroy(keyframe_limiter * kl)
+{
+	janus_mutex_destroy(&kl->mutex);
+}
+
+static gboolean keyframe_limiter_due_locked(keyframe_limiter * kl, gint64 now)
+{
+	if (kl->last_sent != 0 && now - kl->last_sent < kl->min_interval) {
+		return FALSE;
+	}
+
+	kl->last_sent = now;
+	kl->sent++;
+	g_atomic_int_set(&kl->pending, 0);
+	return TRUE;
+}
+
+/* TRUE if the caller should send a PLI now, otherwise the request is folded into the next one */
+gboolean keyframe_limiter_request(keyframe_limiter * kl)
+{
+	gint64 now = janus_get_monotonic_time();
+
+	janus_mutex_lock(&kl->mutex);
+	kl->requests++;
+	gboolean send = keyframe_limiter_due_locked(kl, now);
+	if (!send) {
+		g_atomic_int_set(&kl->pending, 1);
+	}
+	janus_mutex_unlock(&kl->mutex);
+
+	return send;
+}
+
+/* TRUE if a folded request is due, cheap enough to be called for every packet */
+gboolean keyframe_limiter_poll(keyframe_limiter * kl)
+{
+	if (!g_atomic_int_get(&kl->pending)) {
+		return FALSE;
+	}
+
+	gint64 now = janus_get_monotonic_time();
+
+	janus_mutex_lock(&kl->mutex);
+	gboolean send = g_atomic_int_get(&kl->pending) && keyframe_limiter_due_locked(kl, now);
+	janus_mutex_unlock(&kl->mutex);
+
+	return send;
+}
+
+void keyframe_limiter_get_stats(keyframe_limiter * kl, guint64 * requests, guint64 * sent)
+{
+	janus_mutex_lock(&kl->mutex);
+	*requests = kl->requests;
+	*sent = kl->sent;
+	janus_mutex_unlock(&kl->mutex);
+}
+
+/* Removes PLI and FIR blocks from a compound RTCP packet in place, returns the length left */
+int keyframe_limiter_strip_rtcp(char * buf, int len)
+{
+	int in = 0, out = 0;
+
+	while (len - in >= (int)sizeof(rtcp_header)) {
+		rtcp_header *rtcp = (rtcp_header *)(buf + in);
+		int plen = (ntohs(rtcp->length) + 1) * 4;
+		if (plen > len - in) {
+			/* Malformed tail, leave it to the receiver */
+			plen = len - in;
+		}
+
+		gboolean keyframe_request = rtcp->type == RTCP_FIR ||
+			(rtcp->type == RTCP_PSFB && (rtcp->rc == KEYFRAME_LIMITER_FMT_PLI || rtcp->rc == KEYFRAME_LIMITER_FMT_FIR));
+		if (!keyframe_request) {
+			if (out != in) {
+				memmove(buf + out, buf + in, plen);
+			}
+			out += plen;
+		}
+		in += plen;
+	}
+
+	return out;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <glib.h>
+#include "mutex.h"
+
+/* Folds the keyframe requests of one stream into at most one PLI per interval.
+ * A request landing inside the interval is deferred, not lost: a single PLI goes out once it expires */
+typedef struct keyframe_limiter {
+	janus_mutex mutex;
+	gint64 min_interval;	/* Microseconds between two PLIs */
+	gint64 last_sent;	/* Monotonic time of the last PLI, 0 before the first one */
+	volatile gint pending;	/* A request was folded and still has to go out */
+	guint64 requests;
+	guint64 sent;
+} keyframe_limiter;
+
+void keyframe_limiter_init(keyframe_limiter * kl, guint min_interval_ms);
+void keyframe_limiter_destroy(keyframe_limiter * kl);
+gboolean keyframe_limiter_request(keyframe_limiter * kl);
+gboolean keyframe_limiter_poll(keyframe_limiter * kl);
+void keyframe_limiter_get_stats(keyframe_limiter * kl, guint64 * requests, guint64 * sent);
+int keyframe_limiter_strip_rtcp(char * buf, int len);
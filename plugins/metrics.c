@@ -0,0 +1,241 @@
+#include <string.h>
+#include <gio/gio.h>
+#include "metrics.h"
+#include "debug.h"
+#include "utils.h"
+
+/* Seconds a scraper gets to send its request and read the answer */
+#define METRICS_TIMEOUT 5
+#define METRICS_REQUEST_SIZE 1024
+
+static const gdouble metrics_bounds[METRICS_HISTOGRAM_BUCKETS] = {
+	0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+static GMainContext *metrics_context = NULL;
+static GMainLoop *metrics_loop = NULL;
+static GThread *metrics_thread = NULL;
+static GSocketService *metrics_service = NULL;
+static metrics_collect_func metrics_collect = NULL;
+
+static volatile gint scrapes = 0;
+static metrics_histogram scrape_duration;
+static volatile gint registry_failures = 0;
+static metrics_histogram registry_latency;
+
+void metrics_histogram_observe(metrics_histogram * histogram, gint64 us)
+{
+	guint bucket = 0;
+	while (bucket < METRICS_HISTOGRAM_BUCKETS && us > metrics_bounds[bucket] * G_USEC_PER_SEC) {
+		bucket++;
+	}
+	g_atomic_int_inc(&histogram->buckets[bucket]);
+	g_atomic_pointer_add(&histogram->sum_us, MAX(us, 0));
+}
+
+/* A registry request completed, failed or not, after us */
+void metrics_registry_request(gint64 us, gboolean success)
+{
+	metrics_histogram_observe(&registry_latency, us);
+	if (!success) {
+		g_atomic_int_inc(&registry_failures);
+	}
+}
+
+void metrics_describe(GString * out, const gchar * name, const gchar * type, const gchar * help)
+{
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Appends name="value", with the value escaped as the text format wants */
+void metrics_append_label(GString * out, const gchar * name, const gchar * value)
+{
+	g_string_append_printf(out, "%s=\"", name);
+	for (const gchar *c = value ? value : ""; *c; c++) {
+		if (*c == '\\' || *c == '"') {
+			g_string_append_c(out, '\\');
+			g_string_append_c(out, *c);
+		} else if (*c == '\n') {
+			g_string_append(out, "\\n");
+		} else {
+			g_string_append_c(out, *c);
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+void metrics_append_histogram(GString * out, const gchar * name, const gchar * help, metrics_histogram * histogram)
+{
+	guint64 cumulated = 0;
+
+	metrics_describe(out, name, "histogram", help);
+	for (guint bucket = 0; bucket <= METRICS_HISTOGRAM_BUCKETS; bucket++) {
+		cumulated += (guint)g_atomic_int_get(&histogram->buckets[bucket]);
+		if (bucket < METRICS_HISTOGRAM_BUCKETS) {
+			g_string_append_printf(out, "%s_bucket{le=\"%g\"} %"SCNu64"\n", name, metrics_bounds[bucket], cumulated);
+		} else {
+			g_string_append_printf(out, "%s_bucket{le=\"+Inf\"} %"SCNu64"\n", name, cumulated);
+		}
+	}
+	g_string_append_printf(out, "%s_sum %.6f\n", name, (gdouble)(gsize)g_atomic_pointer_get(&histogram->sum_us) / G_USEC_PER_SEC);
+	g_string_append_printf(out, "%s_count %"SCNu64"\n", name, cumulated);
+}
+
+static GString *metrics_expose(void)
+{
+	GString *out = g_string_sized_new(16384);
+
+	if (metrics_collect) {
+		metrics_collect(out);
+	}
+	metrics_append_histogram(out, "idilia_source_registry_request_seconds",
+		"Time the registry took to answer a request", &registry_latency);
+	metrics_describe(out, "idilia_source_registry_failures_total", "counter", "Registry requests that failed");
+	g_string_append_printf(out, "idilia_source_registry_failures_total %d\n", g_atomic_int_get(&registry_failures));
+	metrics_append_histogram(out, "idilia_source_scrape_seconds", "Time spent building the previous scrapes", &scrape_duration);
+	metrics_describe(out, "idilia_source_scrapes_total", "counter", "Scrapes served");
+	g_string_append_printf(out, "idilia_source_scrapes_total %d\n", g_atomic_int_get(&scrapes));
+
+	return out;
+}
+
+/* One request per connection: the answer is written and the connection closed */
+static gboolean metrics_incoming(GSocketService * service, GSocketConnection * connection, GObject * source, gpointer user_data)
+{
+	gchar request[METRICS_REQUEST_SIZE];
+	GError *error = NULL;
+
+	g_socket_set_timeout(g_socket_connection_get_socket(connection), METRICS_TIMEOUT);
+	gssize got = g_input_stream_read(g_io_stream_get_input_stream(G_IO_STREAM(connection)),
+		request, sizeof(request) - 1, NULL, &error);
+	if (got <= 0) {
+		if (error) {
+			JANUS_LOG(LOG_VERB, "Metrics request not read: %s\n", error->message);
+			g_error_free(error);
+		}
+		g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+		return TRUE;
+	}
+	request[got] = '\0';
+
+	GString *response = g_string_new(NULL);
+	if (g_str_has_prefix(request, "GET /metrics ") || g_str_has_prefix(request, "GET / ")) {
+		gint64 start = janus_get_monotonic_time();
+		GString *body = metrics_expose();
+		metrics_histogram_observe(&scrape_duration, janus_get_monotonic_time() - start);
+		g_atomic_int_inc(&scrapes);
+		g_string_append_printf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %"G_GSIZE_FORMAT"\r\nConnection: close\r\n\r\n", body->len);
+		g_string_append_len(response, body->str, body->len);
+		g_string_free(body, TRUE);
+	} else {
+		g_string_append(response, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	}
+
+	if (!g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+			response->str, response->len, NULL, NULL, &error)) {
+		JANUS_LOG(LOG_VERB, "Metrics answer not sent: %s\n", error ? error->message : "??");
+		g_clear_error(&error);
+	}
+	g_string_free(response, TRUE);
+	g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+
+	return TRUE;
+}
+
+static gboolean metrics_quit(gpointer data)
+{
+	g_main_loop_quit(metrics_loop);
+	return G_SOURCE_REMOVE;
+}
+
+static void *metrics_loop_thread(void *data)
+{
+	g_main_context_push_thread_default(metrics_context);
+	JANUS_LOG(LOG_INFO, "Metrics listener started\n");
+	g_main_loop_run(metrics_loop);
+	JANUS_LOG(LOG_INFO, "Metrics listener stopped\n");
+	g_main_context_pop_thread_default(metrics_context);
+	return NULL;
+}
+
+void metrics_init(const gchar * address, guint port, metrics_collect_func collect)
+{
+	if (port == 0 || port > 65535) {
+		JANUS_LOG(LOG_VERB, "Metrics listener disabled\n");
+		return;
+	}
+
+	GError *error = NULL;
+	GInetAddress *inet = g_inet_address_new_from_string(address ? address : "127.0.0.1");
+	if (!inet) {
+		JANUS_LOG(LOG_ERR, "Invalid metrics address %s, metrics disabled\n", address);
+		return;
+	}
+
+	metrics_collect = collect;
+	metrics_context = g_main_context_new();
+	metrics_loop = g_main_loop_new(metrics_context, FALSE);
+
+	/* The service accepts on the context that is the thread default when it is set up */
+	g_main_context_push_thread_default(metrics_context);
+	metrics_service = g_socket_service_new();
+	GSocketAddress *socket_address = g_inet_socket_address_new(inet, (guint16)port);
+	gboolean listening = g_socket_listener_add_address(G_SOCKET_LISTENER(metrics_service), socket_address,
+		G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL, NULL, &error);
+	g_object_unref(socket_address);
+	g_object_unref(inet);
+	if (listening) {
+		g_signal_connect(metrics_service, "incoming", G_CALLBACK(metrics_incoming), NULL);
+		g_socket_service_start(metrics_service);
+	}
+	g_main_context_pop_thread_default(metrics_context);
+
+	if (!listening) {
+		JANUS_LOG(LOG_ERR, "Unable to listen for metrics on %s:%u: %s\n", address, port, error ? error->message : "??");
+		g_clear_error(&error);
+		metrics_destroy();
+		return;
+	}
+
+	metrics_thread = g_thread_try_new("source metrics", &metrics_loop_thread, NULL, &error);
+	if (error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the metrics thread...\n", error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		metrics_thread = NULL;
+		metrics_destroy();
+		return;
+	}
+
+	JANUS_LOG(LOG_INFO, "Metrics exposed on http://%s:%u/metrics\n", address, port);
+}
+
+void metrics_destroy(void)
+{
+	if (metrics_thread) {
+		/* Through the context, in case the loop is not running yet */
+		g_main_context_invoke(metrics_context, metrics_quit, NULL);
+		g_thread_join(metrics_thread);
+		metrics_thread = NULL;
+	}
+	if (metrics_service) {
+		g_socket_service_stop(metrics_service);
+		g_socket_listener_close(G_SOCKET_LISTENER(metrics_service));
+		g_object_unref(metrics_service);
+		metrics_service = NULL;
+	}
+	if (metrics_loop) {
+		g_main_loop_unref(metrics_loop);
+		metrics_loop = NULL;
+	}
+	if (metrics_context) {
+		g_main_context_unref(metrics_context);
+		metrics_context = NULL;
+	}
+	metrics_collect = NULL;
+}
+
+gboolean metrics_enabled(void)
+{
+	return metrics_thread != NULL;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glib.h>
+
+/* Upper bounds of the histogram buckets, in seconds, +Inf is implied */
+#define METRICS_HISTOGRAM_BUCKETS 11
+
+/* Cumulated on exposition only, observing is a couple of atomic adds */
+typedef struct metrics_histogram {
+	volatile gint buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+	volatile gsize sum_us;
+} metrics_histogram;
+
+/* Appends the plugin's own families to out, on the metrics thread: it must not block on media threads */
+typedef void (*metrics_collect_func)(GString * out);
+
+void metrics_init(const gchar * address, guint port, metrics_collect_func collect);
+void metrics_destroy(void);
+gboolean metrics_enabled(void);
+
+void metrics_histogram_observe(metrics_histogram * histogram, gint64 us);
+void metrics_registry_request(gint64 us, gboolean success);
+
+/* Prometheus text exposition helpers */
+void metrics_describe(GString * out, const gchar * name, const gchar * type, const gchar * help);
+void metrics_append_label(GString * out, const gchar * name, const gchar * value);
+void metrics_append_histogram(GString * out, const gchar * name, const gchar * help, metrics_histogram * histogram);
@@ -1,4 +1,32 @@
 #include "node_service_access.h"
+#include "debug.h"
+#include "utils.h"
+#include "metrics.h"
+
+/* How long the registry worker sleeps in curl while transfers are running, new requests wait at most that long */
+#define CURL_ASYNC_POLL_MS 50
+#define CURL_ASYNC_TIMEOUT 10
+#define CURL_ASYNC_MAX_CONNECTIONS 8
+
+typedef struct curl_async_req {
+	CURL *easy;
+	struct curl_slist *headers;
+	gchar *url;
+	gchar *request;
+	gchar *requestType;
+	GString *response;
+	gboolean success;
+	json_t *json;
+	GMainContext *context;
+	curl_async_callback callback;
+	gpointer user_data;
+	gint64 queued;	/* Monotonic time the caller asked, the latency includes the wait for the worker */
+} curl_async_req;
+
+static GAsyncQueue *async_requests = NULL;
+static GThread *async_worker = NULL;
+static CURLM *async_multi = NULL;
+static curl_async_req async_worker_exit;
 
 CURL *curl_init(void) {
     return curl_easy_init();
@@ -80,10 +108,12 @@ gboolean curl_request(CURL *curl_handle,const gchar *url, const gchar *request,
     }
 
 
+    gint64 start = janus_get_monotonic_time();
     curl_code = curl_easy_perform(curl_handle);
     if(CURLE_OK != curl_code) {
 	    retValue = FALSE;
     }
+    metrics_registry_request(janus_get_monotonic_time() - start, curl_code == CURLE_OK);
   
     curl_slist_free_all(headers);
     return retValue;  
@@ -95,4 +125,207 @@ void curl_cleanup(CURL *curl_handle) {
 }
 
 
+static size_t curl_async_write(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    g_string_append_len((GString *)userdata, ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static void curl_async_req_free(curl_async_req *req) {
+    if (req->easy) {
+        curl_easy_cleanup(req->easy);
+    }
+    curl_slist_free_all(req->headers);
+    if (req->json) {
+        json_decref(req->json);
+    }
+    if (req->context) {
+        g_main_context_unref(req->context);
+    }
+    g_string_free(req->response, TRUE);
+    g_free(req->url);
+    g_free(req->request);
+    g_free(req->requestType);
+    g_free(req);
+}
+
+static gboolean curl_async_dispatch(gpointer data) {
+    curl_async_req *req = (curl_async_req *)data;
+    if (req->callback) {
+        req->callback(req->success, req->json, req->user_data);
+    }
+    curl_async_req_free(req);
+    return G_SOURCE_REMOVE;
+}
+
+/* Hands the result to the caller, on its own main context when it gave one */
+static void curl_async_complete(curl_async_req *req) {
+    metrics_registry_request(janus_get_monotonic_time() - req->queued, req->success);
+    if (req->success && req->response->len > 0) {
+        json_error_t error;
+        req->json = json_loadb(req->response->str, req->response->len, 0, &error);
+    }
+
+    if (req->context && req->callback) {
+        GSource *source = g_idle_source_new();
+        g_source_set_callback(source, curl_async_dispatch, req, NULL);
+        g_source_attach(source, req->context);
+        g_source_unref(source);
+    } else {
+        curl_async_dispatch(req);
+    }
+}
+
+static gboolean curl_async_setup(curl_async_req *req) {
+    req->easy = curl_easy_init();
+    if (!req->easy) {
+        return FALSE;
+    }
+
+    req->headers = curl_slist_append(req->headers, "Accept: application/json");
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    req->headers = curl_slist_append(req->headers, "charsets: utf-8");
+
+    gboolean ok = TRUE;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_URL, req->url) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_NOPROGRESS, 1L) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_TIMEOUT, CURL_ASYNC_TIMEOUT) == CURLE_OK;
+    /* Signals cannot be used to time out DNS lookups from a thread */
+    ok &= curl_easy_setopt(req->easy, CURLOPT_NOSIGNAL, 1L) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_TCP_KEEPALIVE, 1L) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_CUSTOMREQUEST, req->requestType) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_HTTPHEADER, req->headers) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_WRITEFUNCTION, curl_async_write) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_WRITEDATA, (void *)req->response) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_POSTFIELDS, req->request) == CURLE_OK;
+    ok &= curl_easy_setopt(req->easy, CURLOPT_PRIVATE, (void *)req) == CURLE_OK;
+    return ok;
+}
+
+static void curl_async_start(curl_async_req *req) {
+    if (!curl_async_setup(req) || curl_multi_add_handle(async_multi, req->easy) != CURLM_OK) {
+        JANUS_LOG(LOG_ERR, "Unable to start %s request to %s\n", req->requestType, req->url);
+        curl_async_complete(req);
+    }
+}
+
+static void curl_async_collect(void) {
+    CURLMsg *msg = NULL;
+    int left = 0;
+
+    while ((msg = curl_multi_info_read(async_multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        CURL *easy = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        curl_async_req *req = NULL;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&req);
+        curl_multi_remove_handle(async_multi, easy);
+
+        req->success = (result == CURLE_OK);
+        if (!req->success) {
+            JANUS_LOG(LOG_ERR, "%s request to %s failed: %s\n", req->requestType, req->url, curl_easy_strerror(result));
+        }
+        curl_async_complete(req);
+    }
+}
+
+/* Owns the multi handle: connections to the registry stay open in its cache between requests */
+static void *curl_async_loop(void *data) {
+    JANUS_LOG(LOG_INFO, "Registry worker started\n");
+    gboolean exiting = FALSE;
+    int running = 0;
+
+    while (!exiting || running > 0) {
+        /* Nothing in flight: sleep until someone needs the registry */
+        curl_async_req *req = (running > 0 || exiting) ? g_async_queue_try_pop(async_requests) : g_async_queue_pop(async_requests);
+        while (req != NULL) {
+            if (req == &async_worker_exit) {
+                /* Requests queued before the exit still go out */
+                exiting = TRUE;
+            } else {
+                curl_async_start(req);
+            }
+            req = g_async_queue_try_pop(async_requests);
+        }
+
+        curl_multi_perform(async_multi, &running);
+        curl_async_collect();
+
+        if (running > 0) {
+            curl_multi_wait(async_multi, NULL, 0, CURL_ASYNC_POLL_MS, NULL);
+        }
+    }
+
+    JANUS_LOG(LOG_INFO, "Registry worker stopped\n");
+    return NULL;
+}
+
+void curl_async_init(void) {
+    async_requests = g_async_queue_new();
+    async_multi = curl_multi_init();
+    if (!async_multi) {
+        JANUS_LOG(LOG_ERR, "Unable to create the registry multi handle, registry requests will block\n");
+        return;
+    }
+    curl_multi_setopt(async_multi, CURLMOPT_MAXCONNECTS, (long)CURL_ASYNC_MAX_CONNECTIONS);
+
+    GError *error = NULL;
+    async_worker = g_thread_try_new("source registry", &curl_async_loop, NULL, &error);
+    if (error != NULL) {
+        JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the registry worker thread, registry requests will block\n",
+            error->code, error->message ? error->message : "??");
+        g_error_free(error);
+        async_worker = NULL;
+    }
+}
+
+void curl_async_destroy(void) {
+    if (async_worker) {
+        g_async_queue_push(async_requests, &async_worker_exit);
+        g_thread_join(async_worker);
+        async_worker = NULL;
+    }
+    if (async_multi) {
+        curl_multi_cleanup(async_multi);
+        async_multi = NULL;
+    }
+    if (async_requests) {
+        g_async_queue_unref(async_requests);
+        async_requests = NULL;
+    }
+}
+
+/* Queues a registry request, the callback (if any) runs on context, or on the registry worker when context is NULL */
+void curl_async_request(const gchar *url, const gchar *request, const gchar *requestType,
+    GMainContext *context, curl_async_callback callback, gpointer user_data) {
+
+    curl_async_req *req = g_new0(curl_async_req, 1);
+    req->url = g_strdup(url);
+    req->request = g_strdup(request);
+    req->requestType = g_strdup(requestType);
+    req->response = g_string_new(NULL);
+    req->context = context ? g_main_context_ref(context) : NULL;
+    req->callback = callback;
+    req->user_data = user_data;
+    req->queued = janus_get_monotonic_time();
+
+    if (async_worker) {
+        g_async_queue_push(async_requests, req);
+        return;
+    }
+
+    /* No worker: fall back to a blocking request on the caller's thread */
+    if (curl_async_setup(req)) {
+        CURLcode result = curl_easy_perform(req->easy);
+        req->success = (result == CURLE_OK);
+        if (!req->success) {
+            JANUS_LOG(LOG_ERR, "%s request to %s failed: %s\n", req->requestType, req->url, curl_easy_strerror(result));
+        }
+    }
+    curl_async_complete(req);
+}
+
+
 
@@ -8,3 +8,11 @@ CURL * curl_init(void);
 void curl_cleanup(CURL *curl_handle);
 
 gboolean  curl_request(CURL *curl_handle,const gchar *url, const gchar *request, const gchar*requestType, json_t ** db_entry_ida);
+
+/* Completion of an asynchronous request: response is the JSON body if any, released once the callback returns */
+typedef void (*curl_async_callback)(gboolean success, json_t *response, gpointer user_data);
+
+void curl_async_init(void);
+void curl_async_destroy(void);
+void curl_async_request(const gchar *url, const gchar *request, const gchar *requestType,
+	GMainContext *context, curl_async_callback callback, gpointer user_data);
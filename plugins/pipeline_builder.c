@@ -0,0 +1,216 @@
+#include "pipeline_builder.h"
+#include "socket_names.h"
+#include "debug.h"
+
+
+static const pipeline_codec_desc codecs[] = {
+	{
+		.codec = IDILIA_CODEC_VP8, .media = "video", .encoding_name = "VP8", .clock_rate = 90000, .rtcp_fb = TRUE,
+		.depayloader = "rtpvp8depay", .payloader = "rtpvp8pay",
+		.passthrough_caps = "application/x-rtp",
+		.pt = 96, .ts_step = 3000, .latency = 200
+	},
+	{
+		.codec = IDILIA_CODEC_VP9, .media = "video", .encoding_name = "VP9", .clock_rate = 90000, .rtcp_fb = TRUE,
+		.depayloader = "rtpvp9depay", .payloader = "rtpvp9pay",
+		.passthrough_caps = "application/x-rtp",
+		.pt = 96, .ts_step = 3000, .latency = 200
+	},
+	{
+		.codec = IDILIA_CODEC_H264, .media = "video", .encoding_name = "H264", .clock_rate = 90000, .rtcp_fb = TRUE,
+		.depayloader = "rtph264depay", .payloader = "rtph264pay",
+		/* No depay/pay to tell viewers how the NALs are packetized */
+		.passthrough_caps = "application/x-rtp, packetization-mode=(string)1",
+		.pt = 96, .ts_step = 3000, .latency = 200
+	},
+	{
+		.codec = IDILIA_CODEC_OPUS, .media = "audio", .encoding_name = "OPUS", .clock_rate = 48000, .rtcp_fb = FALSE,
+		.depayloader = "rtpopusdepay", .payloader = "rtpopuspay",
+		.depayloaded_caps = "audio/x-opus, channels=1",
+		.passthrough_caps = "application/x-rtp",
+		.pt = 127, .ts_step = 960, .latency = 200
+	},
+};
+
+/* Element names of each stream, the ingest and feedback ends reuse the names of the sockets they are bound to */
+static const gchar * session_names[JANUS_SOURCE_STREAM_MAX] = { "sess_vid", "sess_aud" };
+static const gchar * rtp_srv_names[JANUS_SOURCE_STREAM_MAX] = { SOCKET_VIDEO_RTP_SRV, SOCKET_AUDIO_RTP_SRV };
+static const gchar * rtcp_rcv_srv_names[JANUS_SOURCE_STREAM_MAX] = { SOCKET_VIDEO_RTCP_RCV_SRV, SOCKET_AUDIO_RTCP_RCV_SRV };
+static const gchar * rtcp_snd_srv_names[JANUS_SOURCE_STREAM_MAX] = { SOCKET_VIDEO_RTCP_SND_SRV, SOCKET_AUDIO_RTCP_SND_SRV };
+
+const pipeline_codec_desc * pipeline_builder_get_codec(idilia_codec codec)
+{
+	for (guint i = 0; i < G_N_ELEMENTS(codecs); i++) {
+		if (codecs[i].codec == codec) {
+			return &codecs[i];
+		}
+	}
+
+	return NULL;
+}
+
+void pipeline_builder_get_pay_index(const pipeline_builder_params * params, gint pay_index[JANUS_SOURCE_STREAM_MAX])
+{
+	gint next = 0;
+
+	/* Video, when present, is always pay0 */
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		pay_index[stream] = pipeline_builder_get_codec(params->codec[stream]) ? next++ : -1;
+	}
+}
+
+static GstElement * pipeline_builder_add(GstBin * bin, const gchar * factory, const gchar * name)
+{
+	GstElement *element = gst_element_factory_make(factory, name);
+
+	if (!element) {
+		JANUS_LOG(LOG_ERR, "Unable to create %s, is its plugin installed?\n", factory);
+		return NULL;
+	}
+
+	gst_bin_add(bin, element);
+	return element;
+}
+
+static void pipeline_builder_pad_added_cb(GstElement * rtpbin, GstPad * pad, GstElement * downstream)
+{
+	if (!g_str_has_prefix(GST_PAD_NAME(pad), "recv_rtp_src_")) {
+		return;
+	}
+
+	/* Same as a delayed gst-launch link: the first SSRC seen feeds the rest of the stream */
+	GstPad *sink = gst_element_get_static_pad(downstream, "sink");
+	if (!gst_pad_is_linked(sink) && GST_PAD_LINK_FAILED(gst_pad_link(pad, sink))) {
+		JANUS_LOG(LOG_ERR, "Unable to link %s to its depayloader\n", GST_PAD_NAME(pad));
+	}
+	gst_object_unref(sink);
+}
+
+static GstCaps * pipeline_builder_ingest_caps(const pipeline_codec_desc * desc, gint pt)
+{
+	GstCaps *caps = gst_caps_new_simple("application/x-rtp",
+		"media", G_TYPE_STRING, desc->media,
+		"payload", G_TYPE_INT, pt,
+		"encoding-name", G_TYPE_STRING, desc->encoding_name,
+		"clock-rate", G_TYPE_INT, desc->clock_rate,
+		NULL);
+
+	if (desc->rtcp_fb) {
+		gst_caps_set_simple(caps,
+			"rtcp-fb-nack-pli", G_TYPE_INT, 1,
+			"rtcp-fb-nack", G_TYPE_INT, 1,
+			"rtcp-fb-ccm-fir", G_TYPE_INT, 1,
+			NULL);
+	}
+	gst_caps_set_simple(caps, "rtp-profile", G_TYPE_INT, 3, NULL);
+
+	return caps;
+}
+
+static gboolean pipeline_builder_add_stream(GstBin * bin, int stream, const pipeline_codec_desc * desc,
+	const pipeline_builder_params * params, const gchar * pay_name)
+{
+	GstElement *rtpbin = pipeline_builder_add(bin, "rtpbin", session_names[stream]);
+	GstElement *rtp_src = pipeline_builder_add(bin, params->use_appsrc ? "appsrc" : "udpsrc", rtp_srv_names[stream]);
+	GstElement *rtcp_src = pipeline_builder_add(bin, params->use_appsrc ? "appsrc" : "udpsrc", rtcp_rcv_srv_names[stream]);
+	GstElement *rtcp_sink = pipeline_builder_add(bin, params->use_appsrc ? "appsink" : "udpsink", rtcp_snd_srv_names[stream]);
+	/* First element after rtpbin, optional caps in between, and the payN element the media streams from */
+	GstElement *head = NULL, *filter = NULL, *pay = NULL;
+
+	if (params->passthrough) {
+		head = pipeline_builder_add(bin, "capssetter", NULL);
+		pay = pipeline_builder_add(bin, "identity", pay_name);
+	} else {
+		head = pipeline_builder_add(bin, desc->depayloader, NULL);
+		if (desc->depayloaded_caps) {
+			filter = pipeline_builder_add(bin, "capsfilter", NULL);
+		}
+		pay = pipeline_builder_add(bin, desc->payloader, pay_name);
+	}
+
+	if (!rtpbin || !rtp_src || !rtcp_src || !rtcp_sink || !head || !pay || (desc->depayloaded_caps && !params->passthrough && !filter)) {
+		return FALSE;
+	}
+
+	gst_util_set_object_arg(G_OBJECT(rtpbin), "rtp-profile", "avpf");
+	g_object_set(rtpbin, "latency", desc->latency, NULL);
+
+	GstCaps *caps = pipeline_builder_ingest_caps(desc, params->codec_pt[stream]);
+	g_object_set(rtp_src, "caps", caps, NULL);
+	gst_caps_unref(caps);
+
+	if (params->use_appsrc) {
+		g_object_set(rtp_src, "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE, NULL);
+
+		caps = gst_caps_new_empty_simple("application/x-rtcp");
+		g_object_set(rtcp_src, "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE, "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		g_object_set(rtcp_sink, "emit-signals", TRUE, "sync", FALSE, "async", FALSE, NULL);
+	} else {
+		g_object_set(rtcp_sink, "port", params->rtcp_port[stream], "sync", FALSE, "async", FALSE, NULL);
+	}
+
+	if (params->passthrough) {
+		caps = gst_caps_from_string(desc->passthrough_caps);
+		gst_caps_set_simple(caps, "payload", G_TYPE_INT, desc->pt, NULL);
+		g_object_set(head, "caps", caps, NULL);
+		gst_caps_unref(caps);
+
+		g_object_set(pay, "silent", TRUE, NULL);
+	} else {
+		if (filter) {
+			caps = gst_caps_from_string(desc->depayloaded_caps);
+			g_object_set(filter, "caps", caps, NULL);
+			gst_caps_unref(caps);
+		}
+
+		g_object_set(pay, "pt", desc->pt, NULL);
+		if (params->mtu > 0) {
+			g_object_set(pay, "mtu", params->mtu, NULL);
+		}
+	}
+
+	if (!gst_element_link_pads(rtp_src, "src", rtpbin, "recv_rtp_sink_0") ||
+		!gst_element_link_pads(rtcp_src, "src", rtpbin, "recv_rtcp_sink_0") ||
+		!gst_element_link_pads(rtpbin, "send_rtcp_src_0", rtcp_sink, "sink")) {
+		JANUS_LOG(LOG_ERR, "Unable to link %s\n", session_names[stream]);
+		return FALSE;
+	}
+
+	if (filter ? !gst_element_link_many(head, filter, pay, NULL) : !gst_element_link(head, pay)) {
+		JANUS_LOG(LOG_ERR, "Unable to link %s to %s\n", GST_ELEMENT_NAME(head), pay_name);
+		return FALSE;
+	}
+
+	/* rtpbin exposes its RTP source pad once the first packet arrives */
+	g_signal_connect(rtpbin, "pad-added", G_CALLBACK(pipeline_builder_pad_added_cb), head);
+
+	return TRUE;
+}
+
+GstElement * pipeline_builder_build(const pipeline_builder_params * params)
+{
+	gint pay_index[JANUS_SOURCE_STREAM_MAX];
+	GstElement *bin = gst_bin_new(NULL);
+
+	pipeline_builder_get_pay_index(params, pay_index);
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		const pipeline_codec_desc *desc = pipeline_builder_get_codec(params->codec[stream]);
+		if (!desc) {
+			continue;
+		}
+
+		gchar *pay_name = g_strdup_printf("pay%d", pay_index[stream]);
+		gboolean built = pipeline_builder_add_stream(GST_BIN(bin), stream, desc, params, pay_name);
+		g_free(pay_name);
+
+		if (!built) {
+			gst_object_unref(gst_object_ref_sink(bin));
+			return NULL;
+		}
+	}
+
+	return bin;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <gst/gst.h>
+#include "sdp_utils.h"
+#include "pipeline_callback_data.h"
+
+/* How the pipeline of one codec is put together, adding a codec means adding an entry to the table */
+typedef struct pipeline_codec_desc {
+	idilia_codec codec;
+	const gchar *media;		/* "video" or "audio" */
+	const gchar *encoding_name;	/* RTP encoding-name of the ingest caps */
+	gint clock_rate;
+	gboolean rtcp_fb;		/* Ingest caps advertise nack, pli and fir feedback */
+	const gchar *depayloader;
+	const gchar *payloader;
+	const gchar *depayloaded_caps;	/* Forced between depayloader and payloader, NULL for none */
+	const gchar *passthrough_caps;	/* Caps viewers need when RTP is passed through untouched */
+	gint pt;			/* Payload type announced to viewers */
+	guint32 ts_step;		/* Typical timestamp increment, bridges publisher SSRC switches */
+	guint latency;			/* rtpbin jitterbuffer latency, ms */
+} pipeline_codec_desc;
+
+/* Session specific input of the builder */
+typedef struct pipeline_builder_params {
+	idilia_codec codec[JANUS_SOURCE_STREAM_MAX];
+	gint codec_pt[JANUS_SOURCE_STREAM_MAX];		/* Payload types negotiated with the peer */
+	gint rtcp_port[JANUS_SOURCE_STREAM_MAX];	/* Feedback udpsink ports, unused with appsrc */
+	gboolean use_appsrc;
+	gboolean passthrough;
+	guint mtu;					/* 0 keeps the payloaders' default */
+} pipeline_builder_params;
+
+const pipeline_codec_desc * pipeline_builder_get_codec(idilia_codec codec);
+void pipeline_builder_get_pay_index(const pipeline_builder_params * params, gint pay_index[JANUS_SOURCE_STREAM_MAX]);
+GstElement * pipeline_builder_build(const pipeline_builder_params * params);
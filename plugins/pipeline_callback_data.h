@@ -1,6 +1,10 @@
 #pragma once
 
 #include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include "rtp_rewriter.h"
+#include "gop_cache.h"
+#include "viewer_feedback.h"
 
 enum
 {
@@ -9,6 +13,14 @@ enum
 	JANUS_SOURCE_STREAM_MAX
 };
 
+/* Kind of packet relayed from the peer into the pipeline */
+enum
+{
+	JANUS_SOURCE_RELAY_RTP = 0,
+	JANUS_SOURCE_RELAY_RTCP,
+	JANUS_SOURCE_RELAY_MAX
+};
+
 
 typedef struct rtcp_callback_data
 {
@@ -16,7 +28,20 @@ typedef struct rtcp_callback_data
 	gboolean is_video;
 } janus_source_rtcp_cbk_data;
 
+/* Idle suspension of the shared media, guarded by clients_mutex */
+typedef struct pipeline_suspend_stats {
+	gboolean suspended;
+	guint suspends;
+	guint resumes;
+	gint64 suspended_since;		/* Monotonic time of the last suspension */
+	gint64 suspended_total;		/* Microseconds spent suspended, the current suspension excluded */
+	guint threads_released;		/* Streaming threads stopped by the last suspension */
+	guint64 bytes_released;		/* GOP cache bytes dropped by all suspensions */
+} pipeline_suspend_stats;
+
 typedef struct {
+	/* One reference for the mount, one per pad probe or pending task using it */
+	volatile gint ref;
     gchar * id;
     gchar *rtsp_url;
 	janus_source_rtcp_cbk_data rtcp_cbk_data[JANUS_SOURCE_STREAM_MAX];
@@ -26,5 +51,31 @@ typedef struct {
     gulong id_rtsp_media_target_state_cb;
 	GList * clients_list;
 	GMutex clients_mutex;
+	/* Clients that set up this mount and have not torn it down yet, guarded by clients_mutex */
+	GHashTable * viewers;
+	/* Last media built for the mount, guarded by clients_mutex. The clients' prepare counts go with their sessions, so a shared
+	 * media would be unprepared along with the last viewer: media_held is the mount's own count, taken
+	 * on the first PLAY and given back when another media replaces it or the mount is removed.
+	 * Suspended once it has had no viewer for media_idle_timeout, resumed by the next DESCRIBE or SETUP */
+	GstRTSPMedia * media;
+	gboolean media_held;
+	GSource * idle_source;
+	pipeline_suspend_stats suspend;
+	/* Index N of the payN element carrying each stream, -1 when absent */
+	gint pay_index[JANUS_SOURCE_STREAM_MAX];
+	/* RTP passthrough: the payN elements' output gets its header rewritten */
+	gboolean passthrough;
+	rtp_rewriter rewriter[JANUS_SOURCE_STREAM_MAX];
+	/* Probes on the payN pads of the last media, removed with the mount, guarded by clients_mutex */
+	GSList * probes;
+	/* Video GOP burst for viewers joining the shared media */
+	gop_cache gop_cache;
+	/* Receiver reports of the viewers of the video, driving the publisher's REMB */
+	viewer_feedback feedback;
+	/* Handlers feeding it, each holding the data: disconnected on remount and with the mount, guarded by clients_mutex */
+	GstRTSPMedia * prepared_media;
+	gulong id_media_prepared_cb;
+	GObject * feedback_session;
+	gulong id_feedback_cb;
 } pipeline_callback_data_t;
 
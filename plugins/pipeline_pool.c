@@ -0,0 +1,204 @@
+#include <inttypes.h>
+#include "pipeline_pool.h"
+#include "mutex.h"
+#include "debug.h"
+
+
+static guint pool_size = 0;
+static pipeline_pool_build_func pool_build = NULL;
+static gboolean pool_ready = FALSE;
+/* Codec combination key -> GQueue of idle pipelines */
+static GHashTable *pools = NULL;
+static janus_mutex pools_mutex;
+/* Combinations waiting to be topped up by the builder thread */
+static GAsyncQueue *refills = NULL;
+static gint builder_exit;
+static GThread *builder = NULL;
+static guint64 pool_hits = 0, pool_misses = 0;
+
+static guint pipeline_pool_key(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX])
+{
+	/* IDILIA_CODEC_INVALID is -1: shift so that every combination, audio or video only included, is non-zero */
+	return ((guint)(codec[JANUS_SOURCE_STREAM_VIDEO] + 2) << 8) | (guint)(codec[JANUS_SOURCE_STREAM_AUDIO] + 2);
+}
+
+static void pipeline_pool_key_to_codec(guint key, idilia_codec codec[JANUS_SOURCE_STREAM_MAX])
+{
+	codec[JANUS_SOURCE_STREAM_VIDEO] = (idilia_codec)((gint)(key >> 8) - 2);
+	codec[JANUS_SOURCE_STREAM_AUDIO] = (idilia_codec)((gint)(key & 0xff) - 2);
+}
+
+static void pipeline_pool_queue_free(GQueue * queue)
+{
+	g_queue_free_full(queue, (GDestroyNotify)pipeline_pool_release);
+}
+
+static GstElement * pipeline_pool_build(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX])
+{
+	GstElement *element = pool_build(codec);
+	if (!element) {
+		JANUS_LOG(LOG_ERR, "Unable to build pooled pipeline\n");
+		return NULL;
+	}
+	gst_object_ref_sink(element);
+
+	if (pool_ready && gst_element_set_state(element, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+		JANUS_LOG(LOG_WARN, "Unable to bring pooled pipeline to READY, keeping it in NULL\n");
+		gst_element_set_state(element, GST_STATE_NULL);
+	}
+
+	return element;
+}
+
+static void *pipeline_pool_builder(void *data) {
+	JANUS_LOG(LOG_INFO, "Pipeline pool builder started\n");
+
+	while (TRUE) {
+		gpointer request = g_async_queue_pop(refills);
+		if (request == &builder_exit) {
+			break;
+		}
+
+		guint key = GPOINTER_TO_UINT(request);
+		idilia_codec codec[JANUS_SOURCE_STREAM_MAX];
+		pipeline_pool_key_to_codec(key, codec);
+
+		while (TRUE) {
+			janus_mutex_lock(&pools_mutex);
+			GQueue *queue = g_hash_table_lookup(pools, GUINT_TO_POINTER(key));
+			if (!queue) {
+				queue = g_queue_new();
+				g_hash_table_insert(pools, GUINT_TO_POINTER(key), queue);
+			}
+			guint idle = g_queue_get_length(queue);
+			janus_mutex_unlock(&pools_mutex);
+
+			if (idle >= pool_size) {
+				break;
+			}
+
+			/* Creating and linking happen outside of the lock, that is what the pool is there to hide */
+			GstElement *element = pipeline_pool_build(codec);
+			if (!element) {
+				break;
+			}
+
+			janus_mutex_lock(&pools_mutex);
+			g_queue_push_tail(queue, element);
+			janus_mutex_unlock(&pools_mutex);
+		}
+	}
+
+	JANUS_LOG(LOG_INFO, "Pipeline pool builder stopped\n");
+	return NULL;
+}
+
+void pipeline_pool_init(guint size, pipeline_pool_build_func build_func, gboolean warm_to_ready)
+{
+	janus_mutex_init(&pools_mutex);
+
+	if (size == 0 || !build_func) {
+		JANUS_LOG(LOG_VERB, "Pipeline pool disabled\n");
+		pool_size = 0;
+		return;
+	}
+
+	pool_build = build_func;
+	pool_ready = warm_to_ready;
+	pools = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)pipeline_pool_queue_free);
+	refills = g_async_queue_new();
+
+	GError *error = NULL;
+	builder = g_thread_try_new("source pipeline pool", &pipeline_pool_builder, NULL, &error);
+	if (error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the pipeline pool thread, pool disabled\n", error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		return;
+	}
+
+	pool_size = MIN(size, PIPELINE_POOL_MAX_SIZE);
+	JANUS_LOG(LOG_INFO, "Pipeline pool: %u pipelines per codec combination%s\n", pool_size, pool_ready ? ", warmed to READY" : "");
+}
+
+void pipeline_pool_destroy(void)
+{
+	if (builder != NULL) {
+		g_async_queue_push(refills, &builder_exit);
+		g_thread_join(builder);
+		builder = NULL;
+	}
+
+	janus_mutex_lock(&pools_mutex);
+	if (pool_hits + pool_misses > 0) {
+		JANUS_LOG(LOG_INFO, "Pipeline pool: %"SCNu64" hits, %"SCNu64" misses\n", pool_hits, pool_misses);
+	}
+	if (pools) {
+		g_hash_table_destroy(pools);
+		pools = NULL;
+	}
+	janus_mutex_unlock(&pools_mutex);
+
+	if (refills) {
+		g_async_queue_unref(refills);
+		refills = NULL;
+	}
+	pool_size = 0;
+}
+
+gboolean pipeline_pool_enabled(void)
+{
+	return pool_size > 0;
+}
+
+void pipeline_pool_warm(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX])
+{
+	if (!pipeline_pool_enabled()) {
+		return;
+	}
+
+	g_async_queue_push(refills, GUINT_TO_POINTER(pipeline_pool_key(codec)));
+}
+
+GstElement * pipeline_pool_checkout(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX])
+{
+	GstElement *element = NULL;
+
+	if (!pipeline_pool_enabled()) {
+		return NULL;
+	}
+
+	janus_mutex_lock(&pools_mutex);
+	GQueue *queue = g_hash_table_lookup(pools, GUINT_TO_POINTER(pipeline_pool_key(codec)));
+	if (queue) {
+		element = g_queue_pop_head(queue);
+	}
+	if (element) {
+		pool_hits++;
+	} else {
+		pool_misses++;
+	}
+	janus_mutex_unlock(&pools_mutex);
+
+	/* Top the combination up again, a miss also makes it known to the pool */
+	pipeline_pool_warm(codec);
+
+	return element;
+}
+
+void pipeline_pool_release(GstElement * element)
+{
+	if (!element) {
+		return;
+	}
+
+	gst_element_set_state(element, GST_STATE_NULL);
+	gst_object_unref(element);
+}
+
+void pipeline_pool_get_stats(guint64 * hits, guint64 * misses)
+{
+	janus_mutex_lock(&pools_mutex);
+	*hits = pool_hits;
+	*misses = pool_misses;
+	janus_mutex_unlock(&pools_mutex);
+}
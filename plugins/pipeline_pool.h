@@ -0,0 +1,19 @@
+#pragma once
+
+#include <gst/gst.h>
+#include "sdp_utils.h"
+#include "pipeline_callback_data.h"
+
+/* Upper bound of pipelines kept per codec combination */
+#define PIPELINE_POOL_MAX_SIZE 16
+
+/* Builds the pipeline of a codec combination, session specific values left as placeholders */
+typedef GstElement * (*pipeline_pool_build_func)(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX]);
+
+void pipeline_pool_init(guint size, pipeline_pool_build_func build_func, gboolean warm_to_ready);
+void pipeline_pool_destroy(void);
+gboolean pipeline_pool_enabled(void);
+void pipeline_pool_warm(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX]);
+GstElement * pipeline_pool_checkout(const idilia_codec codec[JANUS_SOURCE_STREAM_MAX]);
+void pipeline_pool_release(GstElement * element);
+void pipeline_pool_get_stats(guint64 * hits, guint64 * misses);
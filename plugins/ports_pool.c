@@ -1,55 +1,187 @@
 #include <glib.h>
 #include "ports_pool.h"
 
-void ports_pool_init(ports_pool ** pp, port_t min, port_t max)
+#define PORTS_POOL_WORD(off) ((off) / 64)
+#define PORTS_POOL_BIT(off) (G_GUINT64_CONSTANT(1) << ((off) % 64))
+
+static inline gboolean ports_pool_test(guint64 * map, guint off)
+{
+	return (map[PORTS_POOL_WORD(off)] & PORTS_POOL_BIT(off)) != 0;
+}
+
+static inline void ports_pool_set(guint64 * map, guint off)
+{
+	map[PORTS_POOL_WORD(off)] |= PORTS_POOL_BIT(off);
+}
+
+static inline void ports_pool_clear(guint64 * map, guint off)
+{
+	map[PORTS_POOL_WORD(off)] &= ~PORTS_POOL_BIT(off);
+}
+
+static void ports_pool_push_free(ports_pool * pp, guint off)
+{
+	if (ports_pool_test(pp->queued, off)) {
+		return;
+	}
+
+	guint pos = (pp->free_head + pp->free_len) % pp->size;
+	pp->free_ring[pos] = off;
+	pp->free_pos[off] = pos;
+	pp->free_len++;
+	ports_pool_set(pp->queued, off);
+}
+
+/* Moves the ports whose quarantine is over to the free ring */
+static void ports_pool_release_quarantine(ports_pool * pp)
+{
+	if (pp->q_len == 0) {
+		return;
+	}
+
+	gint64 now = g_get_monotonic_time();
+	while (pp->q_len > 0 && now - pp->q_time[pp->q_head] >= pp->quarantine) {
+		guint off = pp->q_ring[pp->q_head];
+		pp->q_head = (pp->q_head + 1) % pp->size;
+		pp->q_len--;
+		ports_pool_clear(pp->quarantined, off);
+		ports_pool_push_free(pp, off);
+	}
+}
+
+/* Drops the ring entry of a port taken directly, it goes through quarantine once returned */
+static void ports_pool_unqueue(ports_pool * pp, guint off)
+{
+	if (!ports_pool_test(pp->queued, off)) {
+		return;
+	}
+
+	/* The head entry fills the hole, the ring order was random to begin with */
+	guint pos = pp->free_pos[off];
+	guint head = pp->free_ring[pp->free_head];
+	pp->free_ring[pos] = head;
+	pp->free_pos[head] = pos;
+	pp->free_head = (pp->free_head + 1) % pp->size;
+	pp->free_len--;
+	ports_pool_clear(pp->queued, off);
+}
+
+static void ports_pool_take(ports_pool * pp, guint off)
 {
-	*pp = g_malloc(sizeof(ports_pool));
-	(**pp).list = NULL;
+	ports_pool_set(pp->used, off);
+	pp->count++;
+	if (pp->count > pp->high_water) {
+		pp->high_water = pp->count;
+	}
+}
+
+void ports_pool_init(ports_pool ** pp, port_t min, port_t max, gint64 quarantine)
+{
+	*pp = g_malloc0(sizeof(ports_pool));
 	(**pp).min = min;
 	(**pp).max = max;
-	(**pp).count = 0;
-	
+	(**pp).size = max >= min ? (guint)(max - min + 1) : 0;
+	(**pp).quarantine = quarantine;
+
+	guint words = PORTS_POOL_WORD((**pp).size) + 1;
+	(**pp).used = g_new0(guint64, words);
+	(**pp).queued = g_new0(guint64, words);
+	(**pp).quarantined = g_new0(guint64, words);
+	(**pp).free_ring = g_new(guint32, (**pp).size + 1);
+	(**pp).free_pos = g_new(guint32, (**pp).size + 1);
+	(**pp).q_ring = g_new(guint32, (**pp).size + 1);
+	(**pp).q_time = g_new(gint64, (**pp).size + 1);
+
+	/* Hand the range out in a shuffled order, as the random picks used to */
+	for (guint off = 0; off < (**pp).size; off++) {
+		guint pick = g_random_int_range(0, off + 1);
+		(**pp).free_ring[off] = (**pp).free_ring[pick];
+		(**pp).free_ring[pick] = off;
+		ports_pool_set((**pp).queued, off);
+	}
+	for (guint pos = 0; pos < (**pp).size; pos++) {
+		(**pp).free_pos[(**pp).free_ring[pos]] = pos;
+	}
+	(**pp).free_len = (**pp).size;
 }
 
 void ports_pool_free(ports_pool * pp)
 {
-	g_list_free(pp->list);
+	g_free(pp->used);
+	g_free(pp->queued);
+	g_free(pp->quarantined);
+	g_free(pp->free_ring);
+	g_free(pp->free_pos);
+	g_free(pp->q_ring);
+	g_free(pp->q_time);
 	g_free(pp);
 	pp = NULL;
 }
 
 gint ports_pool_get(ports_pool * pp, port_t port)
 {
-	if (pp->count >= (pp->max - pp->min))
+	if (pp->count >= (gint)pp->size)
 	{
 		//no free ports
 		return 0;
 	}
 
+	ports_pool_release_quarantine(pp);
+
 	if (port >= pp->min && port <= pp->max) {
-		if (g_list_find(pp->list, (gconstpointer)port)) {
-			port = 0;
+		guint off = port - pp->min;
+		if (ports_pool_test(pp->used, off) || ports_pool_test(pp->quarantined, off)) {
+			return 0;
 		}
+		ports_pool_unqueue(pp, off);
+		ports_pool_take(pp, off);
+		return port;
 	}
-	else
-	{
-		do {
-			
-			port = g_random_int_range(pp->min, pp->max);
-			
-		} while (g_list_find(pp->list, (gconstpointer)port));
-	}
-	
-	if (port > 0) {
-		pp->list = g_list_append(pp->list, (gpointer)port);
-		pp->count++;
+
+	while (pp->free_len > 0) {
+		guint off = pp->free_ring[pp->free_head];
+		pp->free_head = (pp->free_head + 1) % pp->size;
+		pp->free_len--;
+		ports_pool_clear(pp->queued, off);
+
+		if (!ports_pool_test(pp->used, off)) {
+			ports_pool_take(pp, off);
+			return pp->min + off;
+		}
 	}
 
-	return port;
-} 
+	/* Everything left is in quarantine */
+	return 0;
+}
 
 void ports_pool_return(ports_pool * pp, port_t port)
 {
-	pp->list = g_list_remove(pp->list, (gconstpointer)port);
+	if (port < pp->min || port > pp->max) {
+		return;
+	}
+
+	guint off = port - pp->min;
+	if (!ports_pool_test(pp->used, off)) {
+		return;
+	}
+
+	ports_pool_clear(pp->used, off);
 	pp->count--;
+
+	if (pp->quarantine > 0) {
+		guint tail = (pp->q_head + pp->q_len) % pp->size;
+		pp->q_ring[tail] = off;
+		pp->q_time[tail] = g_get_monotonic_time();
+		pp->q_len++;
+		ports_pool_set(pp->quarantined, off);
+	} else {
+		ports_pool_push_free(pp, off);
+	}
+}
+
+void ports_pool_get_stats(ports_pool * pp, gint * in_use, gint * high_water, gint * quarantined)
+{
+	*in_use = pp->count;
+	*high_water = pp->high_water;
+	*quarantined = pp->q_len;
 }
@@ -6,13 +6,27 @@ typedef struct ports_pool
 {
 	port_t   min;
 	port_t   max;
-	GList*   list;
+	guint    size;		/* Ports in [min, max] */
+	guint64* used;		/* Bitmaps indexed by port - min */
+	guint64* queued;	/* Has an entry in the free ring */
+	guint64* quarantined;	/* Waiting in the quarantine ring */
+	guint32* free_ring;	/* Offsets ready to be handed out, oldest first */
+	guint32* free_pos;	/* Position in free_ring of each queued offset */
+	guint    free_head;
+	guint    free_len;
+	guint32* q_ring;	/* Offsets released less than quarantine ago, with their release time */
+	gint64*  q_time;
+	guint    q_head;
+	guint    q_len;
+	gint64   quarantine;	/* Microseconds before a returned port is handed out again */
 	gint     count;
+	gint     high_water;
 } ports_pool;
 
 
 
-void ports_pool_init(ports_pool ** pp, port_t min, port_t max);
+void ports_pool_init(ports_pool ** pp, port_t min, port_t max, gint64 quarantine);
 void ports_pool_free(ports_pool * pp);
 gint ports_pool_get(ports_pool * pp, port_t port);
 void ports_pool_return(ports_pool * pp, port_t port);
+void ports_pool_get_stats(ports_pool * pp, gint * in_use, gint * high_water, gint * quarantined);
@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include "relay_batch.h"
+#include "debug.h"
+#include "utils.h"
+
+
+static guint batch_size = 0;
+static gint64 batch_deadline = 0;
+static GList *batches = NULL;
+static janus_mutex batches_mutex;
+static GThread *flusher = NULL;
+static volatile gint flusher_running = 0;
+/* Batches with staged packets, oldest first, each waiting for its deadline */
+static GQueue deadlines = G_QUEUE_INIT;
+static janus_mutex deadlines_mutex;
+static janus_condition deadlines_cond;
+static relay_batch *flushing = NULL;
+/* Totals of the batches already freed, for the metrics and the average reported on shutdown */
+static guint64 total_flushes = 0, total_packets = 0, total_dropped = 0;
+
+static void relay_batch_flush_locked(relay_batch * batch);
+
+/* Queues the batch for the flusher, keeping the queue ordered by arming time. Called with deadlines_mutex held */
+static void relay_batch_arm_locked(relay_batch * batch, gint64 when)
+{
+	batch->armed = TRUE;
+	batch->armed_at = when;
+
+	GList *prev = deadlines.tail;
+	while (prev != NULL && ((relay_batch *)prev->data)->armed_at > when) {
+		prev = prev->prev;
+	}
+	if (prev == NULL) {
+		g_queue_push_head_link(&deadlines, &batch->deadline_link);
+		janus_condition_signal(&deadlines_cond);
+	} else {
+		/* Links the entry right after prev */
+		batch->deadline_link.prev = prev;
+		batch->deadline_link.next = prev->next;
+		if (prev->next != NULL) {
+			prev->next->prev = &batch->deadline_link;
+		} else {
+			deadlines.tail = &batch->deadline_link;
+		}
+		prev->next = &batch->deadline_link;
+		deadlines.length++;
+	}
+}
+
+/* Waits on the deadline condition until the given monotonic time */
+static void relay_batch_wait_until(gint64 due)
+{
+	gint64 wakeup = g_get_real_time() + (due - janus_get_monotonic_time());
+	struct timespec ts;
+	ts.tv_sec = wakeup / G_USEC_PER_SEC;
+	ts.tv_nsec = (wakeup % G_USEC_PER_SEC) * 1000;
+	janus_condition_timedwait(&deadlines_cond, &deadlines_mutex, &ts);
+}
+
+/* Sends out whatever has been waiting longer than the deadline, for streams that went quiet.
+ * Sleeps until the oldest armed batch is due instead of sweeping every batch */
+static void *relay_batch_flusher(void *data) {
+	JANUS_LOG(LOG_INFO, "Relay batch flusher started\n");
+
+	janus_mutex_lock(&deadlines_mutex);
+	while (g_atomic_int_get(&flusher_running)) {
+		GList *head = deadlines.head;
+		if (head == NULL) {
+			janus_condition_wait(&deadlines_cond, &deadlines_mutex);
+			continue;
+		}
+
+		relay_batch *batch = (relay_batch *)head->data;
+		gint64 now = janus_get_monotonic_time();
+		if (now < batch->armed_at + batch_deadline) {
+			relay_batch_wait_until(batch->armed_at + batch_deadline);
+			continue;
+		}
+
+		g_queue_unlink(&deadlines, head);
+		batch->armed = FALSE;
+		flushing = batch;
+		janus_mutex_unlock(&deadlines_mutex);
+
+		janus_mutex_lock(&batch->mutex);
+		if (batch->count > 0) {
+			if (now - batch->first_staged >= batch_deadline) {
+				relay_batch_flush_locked(batch);
+			} else {
+				/* Flushed and staged again since it was armed, wait for the new deadline */
+				janus_mutex_lock(&deadlines_mutex);
+				relay_batch_arm_locked(batch, batch->first_staged);
+				janus_mutex_unlock(&deadlines_mutex);
+			}
+		}
+		janus_mutex_unlock(&batch->mutex);
+
+		janus_mutex_lock(&deadlines_mutex);
+		flushing = NULL;
+		janus_condition_broadcast(&deadlines_cond);
+	}
+	janus_mutex_unlock(&deadlines_mutex);
+
+	JANUS_LOG(LOG_INFO, "Relay batch flusher stopped\n");
+	return NULL;
+}
+
+void relay_batch_init(guint size, guint deadline_us)
+{
+	janus_mutex_init(&batches_mutex);
+	janus_mutex_init(&deadlines_mutex);
+	janus_condition_init(&deadlines_cond);
+
+	if (size <= 1) {
+		JANUS_LOG(LOG_VERB, "Relay batching disabled\n");
+		batch_size = 0;
+		return;
+	}
+
+	batch_size = MIN(size, RELAY_BATCH_MAX_SIZE);
+	batch_deadline = deadline_us;
+	JANUS_LOG(LOG_INFO, "Relay batching: up to %u packets, deadline %"SCNi64" us\n", batch_size, batch_deadline);
+
+	GError *error = NULL;
+	g_atomic_int_set(&flusher_running, 1);
+	flusher = g_thread_try_new("source relay flusher", &relay_batch_flusher, NULL, &error);
+	if (error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the relay flusher thread, batching disabled\n", error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		g_atomic_int_set(&flusher_running, 0);
+		batch_size = 0;
+	}
+}
+
+void relay_batch_destroy(void)
+{
+	if (flusher != NULL) {
+		janus_mutex_lock(&deadlines_mutex);
+		g_atomic_int_set(&flusher_running, 0);
+		janus_condition_broadcast(&deadlines_cond);
+		janus_mutex_unlock(&deadlines_mutex);
+		g_thread_join(flusher);
+		flusher = NULL;
+	}
+	g_queue_init(&deadlines);
+
+	janus_mutex_lock(&batches_mutex);
+	if (total_flushes > 0) {
+		JANUS_LOG(LOG_INFO, "Relay batching: %"SCNu64" packets in %"SCNu64" flushes (%.2f per sendmmsg)\n",
+			total_packets, total_flushes, (double)total_packets / total_flushes);
+	}
+	g_list_free(batches);
+	batches = NULL;
+	janus_mutex_unlock(&batches_mutex);
+	batch_size = 0;
+}
+
+gboolean relay_batch_enabled(void)
+{
+	return batch_size > 1;
+}
+
+relay_batch * relay_batch_new(int fd)
+{
+	if (!relay_batch_enabled() || fd < 0) {
+		return NULL;
+	}
+
+	relay_batch *batch = g_new0(relay_batch, 1);
+	janus_mutex_init(&batch->mutex);
+	batch->fd = fd;
+	batch->slots = g_malloc(batch_size * RELAY_BATCH_SLOT_SIZE);
+	batch->deadline_link.data = batch;
+
+	for (guint i = 0; i < batch_size; i++) {
+		batch->iovs[i].iov_base = batch->slots + i * RELAY_BATCH_SLOT_SIZE;
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	janus_mutex_lock(&batches_mutex);
+	batches = g_list_prepend(batches, batch);
+	janus_mutex_unlock(&batches_mutex);
+
+	return batch;
+}
+
+void relay_batch_free(relay_batch * batch)
+{
+	if (!batch) {
+		return;
+	}
+
+	janus_mutex_lock(&batches_mutex);
+	batches = g_list_remove(batches, batch);
+
+	/* Out of the deadline queue, and out of the flusher's hands */
+	janus_mutex_lock(&deadlines_mutex);
+	while (flushing == batch) {
+		janus_condition_wait(&deadlines_cond, &deadlines_mutex);
+	}
+	if (batch->armed) {
+		g_queue_unlink(&deadlines, &batch->deadline_link);
+		batch->armed = FALSE;
+	}
+	janus_mutex_unlock(&deadlines_mutex);
+
+	janus_mutex_lock(&batch->mutex);
+	relay_batch_flush_locked(batch);
+	total_flushes += batch->flushes;
+	total_packets += batch->packets;
+	total_dropped += batch->dropped;
+	janus_mutex_unlock(&batch->mutex);
+	janus_mutex_unlock(&batches_mutex);
+
+	janus_mutex_destroy(&batch->mutex);
+	g_free(batch->slots);
+	g_free(batch);
+}
+
+void relay_batch_push(relay_batch * batch, const char * buf, int len, gboolean frame_end)
+{
+	if (len <= 0) {
+		return;
+	}
+
+	janus_mutex_lock(&batch->mutex);
+
+	if (len > RELAY_BATCH_SLOT_SIZE) {
+		/* Doesn't fit in a slot: keep the ordering and send it on its own */
+		relay_batch_flush_locked(batch);
+		if (send(batch->fd, buf, len, MSG_DONTWAIT) >= 0) {
+			batch->flushes++;
+			batch->packets++;
+		} else {
+			batch->dropped++;
+		}
+		janus_mutex_unlock(&batch->mutex);
+		return;
+	}
+
+	gint64 now = janus_get_monotonic_time();
+	if (batch->count == 0) {
+		batch->first_staged = now;
+		janus_mutex_lock(&deadlines_mutex);
+		if (!batch->armed) {
+			relay_batch_arm_locked(batch, now);
+		}
+		janus_mutex_unlock(&deadlines_mutex);
+	}
+
+	memcpy(batch->iovs[batch->count].iov_base, buf, len);
+	batch->iovs[batch->count].iov_len = len;
+	batch->count++;
+
+	if (batch->count >= batch_size || frame_end || now - batch->first_staged >= batch_deadline) {
+		relay_batch_flush_locked(batch);
+	}
+
+	janus_mutex_unlock(&batch->mutex);
+}
+
+void relay_batch_flush(relay_batch * batch)
+{
+	janus_mutex_lock(&batch->mutex);
+	relay_batch_flush_locked(batch);
+	janus_mutex_unlock(&batch->mutex);
+}
+
+void relay_batch_get_stats(relay_batch * batch, guint64 * flushes, guint64 * packets, guint64 * dropped)
+{
+	janus_mutex_lock(&batch->mutex);
+	*flushes = batch->flushes;
+	*packets = batch->packets;
+	*dropped = batch->dropped;
+	janus_mutex_unlock(&batch->mutex);
+}
+
+void relay_batch_get_totals(guint64 * flushes, guint64 * packets, guint64 * dropped)
+{
+	janus_mutex_lock(&batches_mutex);
+	*flushes = total_flushes;
+	*packets = total_packets;
+	*dropped = total_dropped;
+	for (GList *l = batches; l != NULL; l = l->next) {
+		relay_batch *batch = (relay_batch *)l->data;
+		janus_mutex_lock(&batch->mutex);
+		*flushes += batch->flushes;
+		*packets += batch->packets;
+		*dropped += batch->dropped;
+		janus_mutex_unlock(&batch->mutex);
+	}
+	janus_mutex_unlock(&batches_mutex);
+}
+
+static void relay_batch_flush_locked(relay_batch * batch)
+{
+	guint sent = 0;
+
+	if (batch->count == 0) {
+		return;
+	}
+
+	while (sent < batch->count) {
+		int res = sendmmsg(batch->fd, &batch->msgs[sent], batch->count - sent, MSG_DONTWAIT);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			/* Loopback socket full or closed, whatever is left is dropped */
+			break;
+		}
+		sent += res;
+	}
+
+	/* Only what the socket took counts as relayed */
+	if (sent > 0) {
+		batch->flushes++;
+	}
+	batch->packets += sent;
+	batch->dropped += batch->count - sent;
+	batch->count = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glib.h>
+#include <sys/socket.h>
+#include "mutex.h"
+
+/* Upper bound for the configurable batch size */
+#define RELAY_BATCH_MAX_SIZE 64
+/* Room reserved per staged packet, anything larger is sent right away */
+#define RELAY_BATCH_SLOT_SIZE 1500
+
+/* Stages RTP packets for one loopback socket and sends them with a single sendmmsg */
+typedef struct relay_batch {
+	janus_mutex mutex;
+	int fd;
+	guint count;
+	gint64 first_staged;	/* Monotonic time the oldest staged packet was queued */
+	/* Deadline queue entry, guarded by the flusher's mutex */
+	gboolean armed;
+	gint64 armed_at;
+	GList deadline_link;
+	char *slots;
+	struct iovec iovs[RELAY_BATCH_MAX_SIZE];
+	struct mmsghdr msgs[RELAY_BATCH_MAX_SIZE];
+	guint64 flushes;	/* sendmmsg or send calls that relayed at least one packet */
+	guint64 packets;
+	guint64 dropped;	/* Staged but refused by the socket */
+} relay_batch;
+
+void relay_batch_init(guint size, guint deadline_us);
+void relay_batch_destroy(void);
+gboolean relay_batch_enabled(void);
+
+relay_batch * relay_batch_new(int fd);
+void relay_batch_free(relay_batch * batch);
+void relay_batch_push(relay_batch * batch, const char * buf, int len, gboolean frame_end);
+void relay_batch_flush(relay_batch * batch);
+void relay_batch_get_stats(relay_batch * batch, guint64 * flushes, guint64 * packets, guint64 * dropped);
+/* Node-wide, over the live batches and the ones already freed */
+void relay_batch_get_totals(guint64 * flushes, guint64 * packets, guint64 * dropped);
@@ -0,0 +1,308 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "rtcp_reactor.h"
+#include "debug.h"
+
+#define RTCP_REACTOR_MAX_EVENTS 64
+
+typedef struct rtcp_reactor_thread {
+	guint index;
+	GThread *thread;
+	int epfd;
+	int wakeup_fd;			/* Written to stop the thread or to have it free removed watches */
+	/* Held while a batch of events is dispatched, guards the counters below */
+	janus_mutex dispatch_mutex;
+	/* Watches removed from the epoll set, freed by the thread after the batch that may still hold them */
+	janus_mutex removed_mutex;
+	GSList *removed;
+	char *slots;
+	struct iovec iovs[RTCP_REACTOR_BATCH];
+	struct mmsghdr msgs[RTCP_REACTOR_BATCH];
+	volatile gint sockets;
+	guint64 wakeups;
+	guint64 datagrams;
+	guint max_batch;
+} rtcp_reactor_thread;
+
+static rtcp_reactor_thread *reactors = NULL;
+static guint reactors_count = 0;
+static volatile gint next_reactor = 0;
+static volatile gint running = 0;
+
+static void rtcp_reactor_watch_free(rtcp_reactor_watch * watch)
+{
+	close(watch->fd);
+	if (watch->notify) {
+		watch->notify(watch->user_data);
+	}
+	g_free(watch);
+}
+
+static void rtcp_reactor_free_removed(rtcp_reactor_thread * reactor)
+{
+	janus_mutex_lock(&reactor->removed_mutex);
+	GSList *removed = reactor->removed;
+	reactor->removed = NULL;
+	janus_mutex_unlock(&reactor->removed_mutex);
+
+	g_slist_free_full(removed, (GDestroyNotify)rtcp_reactor_watch_free);
+}
+
+/* Reads everything the socket has queued, RTCP_REACTOR_BATCH datagrams per system call */
+static void rtcp_reactor_drain(rtcp_reactor_thread * reactor, rtcp_reactor_watch * watch)
+{
+	int received;
+
+	do {
+		for (int i = 0; i < RTCP_REACTOR_BATCH; i++) {
+			reactor->iovs[i].iov_len = RTCP_REACTOR_SLOT_SIZE;
+			reactor->msgs[i].msg_len = 0;
+		}
+
+		received = recvmmsg(watch->fd, reactor->msgs, RTCP_REACTOR_BATCH, MSG_DONTWAIT, NULL);
+		if (received <= 0) {
+			if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				JANUS_LOG(LOG_WARN, "recvmmsg on fd %d failed: %s\n", watch->fd, g_strerror(errno));
+			}
+			return;
+		}
+
+		reactor->datagrams += received;
+		reactor->max_batch = MAX(reactor->max_batch, (guint)received);
+		for (int i = 0; i < received; i++) {
+			/* A removed watch still has its user data, it is no use feeding it though */
+			if (reactor->msgs[i].msg_len > 0 && !g_atomic_int_get(&watch->removed)) {
+				watch->func((char *)reactor->iovs[i].iov_base, reactor->msgs[i].msg_len, watch->user_data);
+			}
+		}
+	} while (received == RTCP_REACTOR_BATCH);
+}
+
+static void *rtcp_reactor_loop(void *data)
+{
+	rtcp_reactor_thread *reactor = (rtcp_reactor_thread *)data;
+	struct epoll_event events[RTCP_REACTOR_MAX_EVENTS];
+
+	JANUS_LOG(LOG_INFO, "RTCP reactor %u started\n", reactor->index);
+
+	while (g_atomic_int_get(&running)) {
+		int ready = epoll_wait(reactor->epfd, events, RTCP_REACTOR_MAX_EVENTS, -1);
+		if (ready < 0) {
+			if (errno != EINTR) {
+				JANUS_LOG(LOG_ERR, "epoll_wait failed: %s\n", g_strerror(errno));
+				break;
+			}
+			continue;
+		}
+
+		janus_mutex_lock(&reactor->dispatch_mutex);
+		reactor->wakeups++;
+		for (int i = 0; i < ready; i++) {
+			rtcp_reactor_watch *watch = (rtcp_reactor_watch *)events[i].data.ptr;
+			if (watch == NULL) {
+				/* The wakeup eventfd: the loop condition and the removed list tell why */
+				guint64 count;
+				if (read(reactor->wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+					JANUS_LOG(LOG_WARN, "Unable to read the wakeup of RTCP reactor %u: %s\n", reactor->index, g_strerror(errno));
+				}
+				continue;
+			}
+			if (!g_atomic_int_get(&watch->removed)) {
+				rtcp_reactor_drain(reactor, watch);
+			}
+		}
+		janus_mutex_unlock(&reactor->dispatch_mutex);
+
+		/* No event past this batch can point to them, they were out of the epoll set before being queued */
+		rtcp_reactor_free_removed(reactor);
+	}
+
+	JANUS_LOG(LOG_INFO, "RTCP reactor %u stopped\n", reactor->index);
+	return NULL;
+}
+
+void rtcp_reactor_init(guint threads)
+{
+	if (threads == 0) {
+		JANUS_LOG(LOG_VERB, "RTCP reactor disabled, feedback sockets are polled from the main context\n");
+		return;
+	}
+
+	reactors_count = MIN(threads, RTCP_REACTOR_MAX_THREADS);
+	reactors = g_new0(rtcp_reactor_thread, reactors_count);
+	g_atomic_int_set(&running, 1);
+
+	for (guint i = 0; i < reactors_count; i++) {
+		rtcp_reactor_thread *reactor = &reactors[i];
+		reactor->index = i;
+		janus_mutex_init(&reactor->dispatch_mutex);
+		janus_mutex_init(&reactor->removed_mutex);
+		reactor->slots = g_malloc(RTCP_REACTOR_BATCH * RTCP_REACTOR_SLOT_SIZE);
+		for (int s = 0; s < RTCP_REACTOR_BATCH; s++) {
+			reactor->iovs[s].iov_base = reactor->slots + s * RTCP_REACTOR_SLOT_SIZE;
+			reactor->msgs[s].msg_hdr.msg_iov = &reactor->iovs[s];
+			reactor->msgs[s].msg_hdr.msg_iovlen = 1;
+		}
+
+		reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+		reactor->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+		if (reactor->epfd < 0 || reactor->wakeup_fd < 0 ||
+			epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakeup_fd, &event) < 0) {
+			JANUS_LOG(LOG_FATAL, "Unable to set up RTCP reactor %u: %s\n", i, g_strerror(errno));
+			continue;
+		}
+
+		GError *error = NULL;
+		gchar *name = g_strdup_printf("source rtcp %u", i);
+		reactor->thread = g_thread_try_new(name, &rtcp_reactor_loop, reactor, &error);
+		g_free(name);
+		if (error != NULL) {
+			JANUS_LOG(LOG_FATAL, "Got error %d (%s) trying to launch the RTCP reactor thread...\n", error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			reactor->thread = NULL;
+		}
+	}
+
+	JANUS_LOG(LOG_INFO, "RTCP reactor: %u threads\n", reactors_count);
+}
+
+void rtcp_reactor_destroy(void)
+{
+	if (!reactors) {
+		return;
+	}
+
+	g_atomic_int_set(&running, 0);
+	for (guint i = 0; i < reactors_count; i++) {
+		rtcp_reactor_thread *reactor = &reactors[i];
+		if (reactor->thread) {
+			guint64 one = 1;
+			if (write(reactor->wakeup_fd, &one, sizeof(one)) < 0) {
+				JANUS_LOG(LOG_WARN, "Unable to wake up RTCP reactor %u: %s\n", i, g_strerror(errno));
+			}
+			g_thread_join(reactor->thread);
+		}
+		rtcp_reactor_free_removed(reactor);
+		JANUS_LOG(LOG_INFO, "RTCP reactor %u: %"SCNu64" datagrams in %"SCNu64" wakeups, up to %u per recvmmsg\n",
+			i, reactor->datagrams, reactor->wakeups, reactor->max_batch);
+		if (reactor->epfd >= 0) {
+			close(reactor->epfd);
+		}
+		if (reactor->wakeup_fd >= 0) {
+			close(reactor->wakeup_fd);
+		}
+		janus_mutex_destroy(&reactor->dispatch_mutex);
+		janus_mutex_destroy(&reactor->removed_mutex);
+		g_free(reactor->slots);
+	}
+
+	g_free(reactors);
+	reactors = NULL;
+	reactors_count = 0;
+}
+
+gboolean rtcp_reactor_enabled(void)
+{
+	return reactors_count > 0;
+}
+
+guint rtcp_reactor_get_threads(void)
+{
+	return reactors_count;
+}
+
+/* Sockets are spread over the running threads in turn, the callback runs on the one the socket got.
+ * NULL if no thread is running, the caller then reads the socket itself; notify frees user_data
+ * once the reactor is done with it */
+rtcp_reactor_watch * rtcp_reactor_add(int fd, rtcp_reactor_func func, gpointer user_data, GDestroyNotify notify)
+{
+	if (!rtcp_reactor_enabled() || fd < 0) {
+		return NULL;
+	}
+
+	/* Reactors that failed to start would never read their sockets */
+	guint first = (guint)g_atomic_int_add(&next_reactor, 1) % reactors_count;
+	rtcp_reactor_thread *reactor = NULL;
+	for (guint i = 0; i < reactors_count && !reactor; i++) {
+		reactor = reactors[(first + i) % reactors_count].thread ? &reactors[(first + i) % reactors_count] : NULL;
+	}
+	if (!reactor) {
+		return NULL;
+	}
+
+	/* The socket may be closed right after the watch is removed, before the reactor lets go of it */
+	int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (dup_fd < 0) {
+		JANUS_LOG(LOG_ERR, "Unable to duplicate fd %d for RTCP: %s\n", fd, g_strerror(errno));
+		return NULL;
+	}
+
+	rtcp_reactor_watch *watch = g_new0(rtcp_reactor_watch, 1);
+	watch->fd = dup_fd;
+	watch->thread = reactor->index;
+	watch->func = func;
+	watch->user_data = user_data;
+
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = watch };
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, dup_fd, &event) < 0) {
+		JANUS_LOG(LOG_ERR, "Unable to watch fd %d for RTCP: %s\n", fd, g_strerror(errno));
+		rtcp_reactor_watch_free(watch);
+		return NULL;
+	}
+	/* Only now, a failed add leaves user_data to the caller */
+	watch->notify = notify;
+	g_atomic_int_inc(&reactor->sockets);
+
+	return watch;
+}
+
+/* A callback already running may finish after this returns, user_data lives until the reactor frees
+ * the watch. The socket can be closed as soon as this returns */
+void rtcp_reactor_remove(rtcp_reactor_watch * watch)
+{
+	if (!watch) {
+		return;
+	}
+	if (!reactors) {
+		/* Shut down already, nothing reads the socket any more */
+		rtcp_reactor_watch_free(watch);
+		return;
+	}
+
+	rtcp_reactor_thread *reactor = &reactors[watch->thread];
+	g_atomic_int_set(&watch->removed, 1);
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, watch->fd, NULL) < 0) {
+		JANUS_LOG(LOG_WARN, "Unable to stop watching fd %d: %s\n", watch->fd, g_strerror(errno));
+	}
+	g_atomic_int_add(&reactor->sockets, -1);
+
+	janus_mutex_lock(&reactor->removed_mutex);
+	reactor->removed = g_slist_prepend(reactor->removed, watch);
+	janus_mutex_unlock(&reactor->removed_mutex);
+
+	guint64 one = 1;
+	if (write(reactor->wakeup_fd, &one, sizeof(one)) < 0) {
+		JANUS_LOG(LOG_WARN, "Unable to wake up RTCP reactor %u: %s\n", reactor->index, g_strerror(errno));
+	}
+}
+
+void rtcp_reactor_get_stats(guint thread, rtcp_reactor_stats * stats)
+{
+	memset(stats, 0, sizeof(rtcp_reactor_stats));
+	if (thread >= reactors_count) {
+		return;
+	}
+
+	rtcp_reactor_thread *reactor = &reactors[thread];
+	stats->sockets = g_atomic_int_get(&reactor->sockets);
+	janus_mutex_lock(&reactor->dispatch_mutex);
+	stats->wakeups = reactor->wakeups;
+	stats->datagrams = reactor->datagrams;
+	stats->max_batch = reactor->max_batch;
+	janus_mutex_unlock(&reactor->dispatch_mutex);
+}
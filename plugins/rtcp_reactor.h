@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glib.h>
+#include <sys/socket.h>
+#include "mutex.h"
+
+/* Upper bound for the configurable number of reactor threads */
+#define RTCP_REACTOR_MAX_THREADS 16
+/* Datagrams read from a socket with a single recvmmsg */
+#define RTCP_REACTOR_BATCH 16
+#define RTCP_REACTOR_SLOT_SIZE 1500
+
+typedef void (*rtcp_reactor_func)(char * buf, int len, gpointer user_data);
+
+/* A socket is watched by exactly one reactor thread, which alone reads it and runs its callback.
+ * The watch reads a duplicate of the socket's fd and is freed on that thread once removed */
+typedef struct rtcp_reactor_watch {
+	int fd;
+	guint thread;
+	volatile gint removed;
+	rtcp_reactor_func func;
+	gpointer user_data;
+	GDestroyNotify notify;
+} rtcp_reactor_watch;
+
+typedef struct rtcp_reactor_stats {
+	guint sockets;
+	guint64 wakeups;
+	guint64 datagrams;
+	guint max_batch;
+} rtcp_reactor_stats;
+
+void rtcp_reactor_init(guint threads);
+void rtcp_reactor_destroy(void);
+gboolean rtcp_reactor_enabled(void);
+guint rtcp_reactor_get_threads(void);
+
+rtcp_reactor_watch * rtcp_reactor_add(int fd, rtcp_reactor_func func, gpointer user_data, GDestroyNotify notify);
+void rtcp_reactor_remove(rtcp_reactor_watch * watch);
+void rtcp_reactor_get_stats(guint thread, rtcp_reactor_stats * stats);
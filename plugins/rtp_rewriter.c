@@ -0,0 +1,68 @@
+#include <arpa/inet.h>
+#include <string.h>
+#include "rtp_rewriter.h"
+#include "rtp.h"
+
+void rtp_rewriter_init(rtp_rewriter * rw, guint32 ssrc, guint8 pt, guint32 ts_step)
+{
+	memset(rw, 0, sizeof(rtp_rewriter));
+	rw->ssrc = ssrc;
+	rw->pt = pt;
+	rw->ts_step = ts_step;
+}
+
+void rtp_rewriter_process(rtp_rewriter * rw, char * buf, gsize len)
+{
+	if (len < RTP_HEADER_SIZE) {
+		return;
+	}
+
+	rtp_header *rtp = (rtp_header *)buf;
+	guint32 ssrc = ntohl(rtp->ssrc);
+	guint16 seq = ntohs(rtp->seq_number);
+	guint32 ts = ntohl(rtp->timestamp);
+
+	if (!rw->started) {
+		/* Keep the publisher's numbering until it changes */
+		rw->started = TRUE;
+		rw->in_ssrc = ssrc;
+		rw->seq_offset = 0;
+		rw->ts_offset = 0;
+		rw->last_seq = seq - 1;
+		rw->last_ts = ts - rw->ts_step;
+	} else if (ssrc != rw->in_ssrc) {
+		/* Publisher restarted: carry on right after the last packet viewers got */
+		rw->in_ssrc = ssrc;
+		rw->seq_offset = (guint16)(rw->last_seq + 1 - seq);
+		rw->ts_offset = rw->last_ts + rw->ts_step - ts;
+	}
+
+	guint16 out_seq = seq + rw->seq_offset;
+	guint32 out_ts = ts + rw->ts_offset;
+
+	if ((gint16)(out_seq - rw->last_seq) > 0) {
+		rw->last_seq = out_seq;
+		rw->last_ts = out_ts;
+	}
+
+	rtp->ssrc = htonl(rw->ssrc);
+	rtp->seq_number = htons(out_seq);
+	rtp->timestamp = htonl(out_ts);
+	rtp->type = rw->pt;
+}
+
+GstPadProbeReturn rtp_rewriter_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	rtp_rewriter *rw = (rtp_rewriter *)user_data;
+	GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+	GstMapInfo map;
+
+	GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+	if (gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+		rtp_rewriter_process(rw, (char *)map.data, map.size);
+		gst_buffer_unmap(buffer, &map);
+	}
+
+	return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <gst/gst.h>
+
+/* Keeps the RTP forwarded as-is to RTSP viewers looking like a single continuous stream:
+ * fixed SSRC and payload type, sequence numbers and timestamps rebased when the publisher's SSRC changes */
+typedef struct rtp_rewriter {
+	guint32 ssrc;		/* SSRC announced to viewers */
+	guint8 pt;		/* Payload type announced to viewers */
+	gboolean started;
+	guint32 in_ssrc;	/* SSRC currently received from the publisher */
+	guint16 seq_offset;
+	guint32 ts_offset;
+	guint16 last_seq;	/* Last sequence number and timestamp sent, after rewriting */
+	guint32 last_ts;
+	guint32 ts_step;	/* Timestamp gap inserted at an SSRC switch */
+} rtp_rewriter;
+
+void rtp_rewriter_init(rtp_rewriter * rw, guint32 ssrc, guint8 pt, guint32 ts_step);
+void rtp_rewriter_process(rtp_rewriter * rw, char * buf, gsize len);
+GstPadProbeReturn rtp_rewriter_probe_cb(GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
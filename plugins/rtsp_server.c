@@ -1,3 +1,5 @@
+#include <pthread.h>
+#include <sched.h>
 #include "rtsp_server.h"
 #include "queue_callbacks.h"
 #include "gst_utils.h"
@@ -5,11 +7,16 @@
 
 
 static const char *RTSP_PORT_NUMBER = "3554"; 
+/* Client threads of the pool, counted as they start and stop serving */
+static volatile gint rtsp_threads_max = 0;
+static volatile gint rtsp_threads_active = 0;
+static volatile gint rtsp_threads_next_cpu = 0;
 static GstRTSPFilterResult janus_source_close_rtsp_sessions(GstRTSPSessionPool *pool, GstRTSPSession *session, gpointer user_data);
 static void janus_source_close_all_rtsp_sessions_for_mountpoint(GstRTSPServer *rtsp_server, gchar *uri);
 
 void janus_source_create_rtsp_server_and_queue(janus_source_rtsp_server_data *rtsp_server, GMainContext *context){
 	rtsp_server->rtsp_server = gst_rtsp_server_new();
+	rtsp_server->context = context;
 	
 	/* Allocate random port */
 	gst_rtsp_server_set_service(rtsp_server->rtsp_server, RTSP_PORT_NUMBER);
@@ -22,7 +29,95 @@ void janus_source_create_rtsp_server_and_queue(janus_source_rtsp_server_data *rt
 	rtsp_server->rtsp_async_queue =  g_async_queue_new();
 }
 
-GstRTSPMediaFactory * janus_source_rtsp_factory(janus_source_rtsp_server_data *rtsp_server, const gchar * local_ip, gchar * launch_pipe) {
+static void janus_source_rtsp_thread_enter(GstRTSPThreadPool *pool, GstRTSPThread *thread) {
+	g_atomic_int_inc(&rtsp_threads_active);
+}
+
+static void janus_source_rtsp_thread_leave(GstRTSPThreadPool *pool, GstRTSPThread *thread) {
+	g_atomic_int_add(&rtsp_threads_active, -1);
+}
+
+/* Runs in the new client thread, which gets the next CPU in turn */
+static void janus_source_rtsp_thread_enter_pinned(GstRTSPThreadPool *pool, GstRTSPThread *thread) {
+	guint cpu = (guint)g_atomic_int_add(&rtsp_threads_next_cpu, 1) % g_get_num_processors();
+	cpu_set_t cpuset;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+	if (res != 0) {
+		JANUS_LOG(LOG_WARN, "Unable to pin RTSP client thread to CPU %u: %s\n", cpu, g_strerror(res));
+	} else {
+		JANUS_LOG(LOG_VERB, "RTSP client thread pinned to CPU %u\n", cpu);
+	}
+	janus_source_rtsp_thread_enter(pool, thread);
+}
+
+/* With no threads clients are served on the server's context, otherwise on up to max_threads threads of their own */
+void janus_source_rtsp_server_set_threads(janus_source_rtsp_server_data *rtsp_server, guint max_threads, gboolean pin) {
+	if (max_threads == 0) {
+		return;
+	}
+
+	GstRTSPThreadPool *pool = gst_rtsp_thread_pool_new();
+	gst_rtsp_thread_pool_set_max_threads(pool, max_threads);
+
+	GstRTSPThreadPoolClass *klass = GST_RTSP_THREAD_POOL_GET_CLASS(pool);
+	klass->thread_enter = pin ? janus_source_rtsp_thread_enter_pinned : janus_source_rtsp_thread_enter;
+	klass->thread_leave = janus_source_rtsp_thread_leave;
+
+	gst_rtsp_server_set_thread_pool(rtsp_server->rtsp_server, pool);
+	g_object_unref(pool);
+	g_atomic_int_set(&rtsp_threads_max, max_threads);
+
+	JANUS_LOG(LOG_INFO, "Serving RTSP clients on up to %u threads%s\n", max_threads, pin ? ", pinned to CPUs" : "");
+}
+
+void janus_source_rtsp_server_get_threads(gint *max_threads, gint *active_threads) {
+	*max_threads = g_atomic_int_get(&rtsp_threads_max);
+	*active_threads = g_atomic_int_get(&rtsp_threads_active);
+}
+
+/* address_range is "first-last", the pool must hold an address and port pair per stream of every multicast mount */
+gboolean janus_source_rtsp_server_set_multicast(janus_source_rtsp_server_data *rtsp_server, const gchar * address_range,
+	guint16 min_port, guint16 max_port, guint ttl, const gchar * iface) {
+	gchar ** addresses = g_strsplit(address_range, "-", 2);
+	const gchar * min_address = addresses[0];
+	const gchar * max_address = addresses[0] && addresses[1] ? addresses[1] : addresses[0];
+
+	GstRTSPAddressPool *pool = gst_rtsp_address_pool_new();
+	gboolean added = min_address && gst_rtsp_address_pool_add_range(pool,
+		g_strstrip((gchar *)min_address), g_strstrip((gchar *)max_address), min_port, max_port, (guint8)MIN(ttl, 255));
+
+	if (!added) {
+		JANUS_LOG(LOG_ERR, "Invalid multicast range %s, ports %u-%u\n", address_range, min_port, max_port);
+		g_object_unref(pool);
+		g_strfreev(addresses);
+		return FALSE;
+	}
+
+	JANUS_LOG(LOG_INFO, "Multicast groups %s-%s, ports %u-%u, TTL %u%s%s\n", min_address, max_address,
+		min_port, max_port, ttl, iface ? ", interface " : "", iface ? iface : "");
+	rtsp_server->address_pool = pool;
+	rtsp_server->multicast_iface = g_strdup(iface);
+	g_strfreev(addresses);
+	return TRUE;
+}
+
+void janus_source_rtsp_server_clear_multicast(janus_source_rtsp_server_data *rtsp_server) {
+	/* NULL when the RTSP thread stopped before creating the server */
+	if (!rtsp_server) {
+		return;
+	}
+	if (rtsp_server->address_pool) {
+		g_object_unref(rtsp_server->address_pool);
+		rtsp_server->address_pool = NULL;
+	}
+	g_free(rtsp_server->multicast_iface);
+	rtsp_server->multicast_iface = NULL;
+}
+
+GstRTSPMediaFactory * janus_source_rtsp_factory(janus_source_rtsp_server_data *rtsp_server, const gchar * local_ip, gboolean multicast) {
 	GstRTSPMediaFactory * factory;
 	gst_rtsp_server_set_address(rtsp_server->rtsp_server, local_ip);
 	factory = gst_rtsp_media_factory_new();
@@ -30,9 +125,16 @@ GstRTSPMediaFactory * janus_source_rtsp_factory(janus_source_rtsp_server_data *r
 	gst_rtsp_media_factory_set_profiles(factory, GST_RTSP_PROFILE_AVPF);
 	/* store up to 100ms of retransmission data */
 	gst_rtsp_media_factory_set_retransmission_time(factory, 100 * GST_MSECOND);	
-	gst_rtsp_media_factory_set_launch(factory, launch_pipe);	
 	/* media created from this factory can be shared between clients */
 	gst_rtsp_media_factory_set_shared(factory, TRUE);
+	/* The shared media then sends each packet once to its group whatever the number of viewers */
+	if (multicast && rtsp_server->address_pool) {
+		gst_rtsp_media_factory_set_address_pool(factory, rtsp_server->address_pool);
+		gst_rtsp_media_factory_set_protocols(factory, GST_RTSP_LOWER_TRANS_UDP_MCAST);
+		if (rtsp_server->multicast_iface) {
+			gst_rtsp_media_factory_set_multicast_iface(factory, rtsp_server->multicast_iface);
+		}
+	}
 	return factory;
 }
 
@@ -98,13 +200,26 @@ void janus_source_attach_rtsp_queue_callback(janus_source_rtsp_server_data *rtsp
 	g_assert(rtsp_server->rtsp_queue_source);
 	g_source_attach(rtsp_server->rtsp_queue_source, context) ;
 	g_source_set_callback(rtsp_server->rtsp_queue_source, callback, NULL, NULL) ;
+	rtsp_server->queue_context = context ? g_main_context_ref(context) : NULL;
 }
 
 void janus_source_deattach_rtsp_queue_callback(janus_source_rtsp_server_data *rtsp_server) {
-	g_source_destroy(rtsp_server->rtsp_queue_source);
-	g_source_unref(rtsp_server->rtsp_queue_source);
+	if (rtsp_server->rtsp_queue_source) {
+		g_source_destroy(rtsp_server->rtsp_queue_source);
+		g_source_unref(rtsp_server->rtsp_queue_source);
+	}
 	g_async_queue_unref (rtsp_server->rtsp_async_queue);
 	rtsp_server->rtsp_queue_source = NULL;
+	if (rtsp_server->queue_context) {
+		g_main_context_unref(rtsp_server->queue_context);
+		rtsp_server->queue_context = NULL;
+	}
+}
+
+/* The queue source sets no timeout in prepare: the loop running it only looks again once woken */
+void janus_source_rtsp_queue_push(janus_source_rtsp_server_data *rtsp_server, gpointer data) {
+	g_async_queue_push(rtsp_server->rtsp_async_queue, data);
+	g_main_context_wakeup(rtsp_server->queue_context);
 }
 
 void janus_source_rtsp_create_and_run_main_loop(janus_source_rtsp_server_data *rtsp_server, GMainContext * context) {
@@ -123,6 +238,58 @@ void janus_source_rtsp_clean_and_quit_main_loop(janus_source_rtsp_server_data *r
 	}
 }
 
+static gpointer janus_source_rtsp_setup_thread(gpointer user_data) {
+	janus_source_rtsp_server_data *rtsp_server = (janus_source_rtsp_server_data *)user_data;
+
+	/* The registry requests made while setting up complete on the thread default context */
+	g_main_context_push_thread_default(rtsp_server->setup_context);
+	g_main_loop_run(rtsp_server->setup_loop);
+	g_main_context_pop_thread_default(rtsp_server->setup_context);
+
+	return NULL;
+}
+
+/* Runs the setup queue on a new thread, so a slow setup or registry call never holds up RTSP clients */
+gboolean janus_source_rtsp_setup_thread_start(janus_source_rtsp_server_data *rtsp_server, GSourceFunc callback) {
+	GError *error = NULL;
+
+	rtsp_server->setup_context = g_main_context_new();
+	rtsp_server->setup_loop = g_main_loop_new(rtsp_server->setup_context, FALSE);
+	janus_source_attach_rtsp_queue_callback(rtsp_server, callback, rtsp_server->setup_context);
+
+	rtsp_server->setup_thread = g_thread_try_new("source rtsp setup", janus_source_rtsp_setup_thread, rtsp_server, &error);
+	if (error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTSP setup thread...\n", error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		g_source_destroy(rtsp_server->rtsp_queue_source);
+		g_source_unref(rtsp_server->rtsp_queue_source);
+		rtsp_server->rtsp_queue_source = NULL;
+		g_main_context_unref(rtsp_server->queue_context);
+		rtsp_server->queue_context = NULL;
+		janus_source_rtsp_setup_thread_stop(rtsp_server);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Leaves the setup queue attached, janus_source_deattach_rtsp_queue_callback frees it */
+void janus_source_rtsp_setup_thread_stop(janus_source_rtsp_server_data *rtsp_server) {
+	if (rtsp_server->setup_thread) {
+		g_main_loop_quit(rtsp_server->setup_loop);
+		g_thread_join(rtsp_server->setup_thread);
+		rtsp_server->setup_thread = NULL;
+	}
+	if (rtsp_server->setup_loop) {
+		g_main_loop_unref(rtsp_server->setup_loop);
+		rtsp_server->setup_loop = NULL;
+	}
+	if (rtsp_server->setup_context) {
+		g_main_context_unref(rtsp_server->setup_context);
+		rtsp_server->setup_context = NULL;
+	}
+}
+
 void janus_source_close_all_rtsp_sessions(janus_source_rtsp_server_data *rtsp_server) {
 	JANUS_LOG(LOG_VERB, "janus_source_close_all_rtsp_sessions\n");
 	GList * sessions_list;
@@ -10,16 +10,35 @@ typedef struct janus_source_rtsp_server_data
 	GstRTSPServer *rtsp_server;
 	GAsyncQueue *rtsp_async_queue;
 	GSource *rtsp_queue_source ;
+	/* Context the setup queue is attached to, woken on every push */
+	GMainContext *queue_context;
 	GMainLoop *loop;
+	/* Context the server accepts connections on, clients may be served elsewhere */
+	GMainContext *context;
+	/* Session setup and the registry replies run on a thread of their own, off the clients' contexts */
+	GMainContext *setup_context;
+	GMainLoop *setup_loop;
+	GThread *setup_thread;
+	/* Multicast groups handed out to mounts set up for multicast, NULL when it is not configured */
+	GstRTSPAddressPool *address_pool;
+	gchar *multicast_iface;
 } janus_source_rtsp_server_data;
 
 void janus_source_attach_rtsp_queue_callback(janus_source_rtsp_server_data *rtsp_server,  GSourceFunc callback, GMainContext *context);
 void janus_source_deattach_rtsp_queue_callback(janus_source_rtsp_server_data *rtsp_server);
+void janus_source_rtsp_queue_push(janus_source_rtsp_server_data *rtsp_server, gpointer data);
 void janus_source_rtsp_create_and_run_main_loop(janus_source_rtsp_server_data *rtsp_server, GMainContext * context);
 void janus_source_rtsp_clean_and_quit_main_loop(janus_source_rtsp_server_data *rtsp_server);
+gboolean janus_source_rtsp_setup_thread_start(janus_source_rtsp_server_data *rtsp_server, GSourceFunc callback);
+void janus_source_rtsp_setup_thread_stop(janus_source_rtsp_server_data *rtsp_server);
 
 void janus_source_create_rtsp_server_and_queue(janus_source_rtsp_server_data *rtsp_server, GMainContext *context);
-GstRTSPMediaFactory * janus_source_rtsp_factory(janus_source_rtsp_server_data *rtsp_server, const gchar * local_ip, gchar * launch_pipe);
+void janus_source_rtsp_server_set_threads(janus_source_rtsp_server_data *rtsp_server, guint max_threads, gboolean pin);
+void janus_source_rtsp_server_get_threads(gint *max_threads, gint *active_threads);
+gboolean janus_source_rtsp_server_set_multicast(janus_source_rtsp_server_data *rtsp_server, const gchar * address_range,
+	guint16 min_port, guint16 max_port, guint ttl, const gchar * iface);
+void janus_source_rtsp_server_clear_multicast(janus_source_rtsp_server_data *rtsp_server);
+GstRTSPMediaFactory * janus_source_rtsp_factory(janus_source_rtsp_server_data *rtsp_server, const gchar * local_ip, gboolean multicast);
 void janus_source_rtsp_add_mountpoint(janus_source_rtsp_server_data *rtsp_server , GstRTSPMediaFactory *factory, gchar * id);
 void janus_source_rtsp_remove_mountpoint(janus_source_rtsp_server_data *rtsp_server, gchar * id, pipeline_callback_data_t *data);
 int janus_source_rtsp_server_port(janus_source_rtsp_server_data *rtsp_server);
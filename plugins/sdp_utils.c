@@ -18,10 +18,8 @@ codec_name_mapping_t codec_name_mapping[] =
 	{ "INVALID", IDILIA_CODEC_INVALID }
 };
 
-static gchar * str_replace_once(const gchar * input, const gchar * old_string, const gchar * new_string);
-static gint sdp_get_codec_pt_for_type(const gchar * sdp, const gchar * type);
-static idilia_codec sdp_pt_to_codec_id(const char * sdp, gint pt);
-static idilia_codec sdp_pt_to_codec_id(const char * sdp, gint pt);
+#define SDP_HAS_PREFIX(p, end, prefix) ((gsize)((end) - (p)) >= sizeof(prefix) - 1 && !strncmp((p), (prefix), sizeof(prefix) - 1))
+
 
 const gchar * get_codec_name(idilia_codec codec)
 {
@@ -45,179 +43,454 @@ idilia_codec sdp_codec_name_to_id(const gchar * name)
 	return IDILIA_CODEC_INVALID;
 }
 
-gint sdp_get_codec_pt(const gchar * sdp, idilia_codec codec)
+/* Reads the unsigned decimal at *p, -1 if there is none */
+static gint sdp_read_int(const gchar ** p, const gchar * end)
+{
+	gint value = -1;
+
+	while (*p < end && g_ascii_isdigit(**p)) {
+		value = (value < 0 ? 0 : value * 10) + (**p - '0');
+		(*p)++;
+	}
+
+	return value;
+}
+
+static gboolean sdp_skip_blanks(const gchar ** p, const gchar * end)
+{
+	const gchar * start = *p;
+
+	while (*p < end && (**p == ' ' || **p == '\t')) {
+		(*p)++;
+	}
+
+	return *p != start;
+}
+
+/* Copies the token at *p, truncated to fit out; rtpmap encoding names also end at '/' */
+static void sdp_read_token(const gchar ** p, const gchar * end, gchar * out, gsize size, gboolean stop_at_slash)
+{
+	gsize n = 0;
+
+	while (*p < end && **p != ' ' && **p != '\t' && !(stop_at_slash && **p == '/')) {
+		if (n + 1 < size) {
+			out[n++] = **p;
+		}
+		(*p)++;
+	}
+	out[n] = '\0';
+}
+
+static sdp_media * sdp_parse_mline(sdp_model * model, const gchar * p, const gchar * end)
+{
+	if (model->media_count == SDP_MAX_MEDIA) {
+		return NULL;
+	}
+
+	sdp_media * media = &model->media[model->media_count++];
+	gchar proto[32];
+
+	p += strlen("m=");
+	sdp_read_token(&p, end, media->type, sizeof(media->type), FALSE);
+	sdp_skip_blanks(&p, end);
+	media->port = sdp_read_int(&p, end);
+	sdp_skip_blanks(&p, end);
+	sdp_read_token(&p, end, proto, sizeof(proto), FALSE);
+	media->savpf = !strcmp(proto, "UDP/TLS/RTP/SAVPF");
+	sdp_skip_blanks(&p, end);
+
+	media->fmts_start = p - model->text;
+	media->fmts_end = media->fmts_start;
+	while (media->fmts_count < SDP_MAX_FORMATS) {
+		gint pt = sdp_read_int(&p, end);
+		if (pt < 0) {
+			break;
+		}
+		media->fmts[media->fmts_count++] = pt;
+		media->fmts_end = p - model->text;
+		sdp_skip_blanks(&p, end);
+	}
+
+	return media;
+}
+
+static void sdp_parse_rtpmap(sdp_media * media, const gchar * p, const gchar * end)
+{
+	p += strlen("a=rtpmap:");
+	gint pt = sdp_read_int(&p, end);
+
+	if (pt < 0 || !sdp_skip_blanks(&p, end) || media->formats_count == SDP_MAX_FORMATS) {
+		return;
+	}
+
+	sdp_format * format = &media->formats[media->formats_count++];
+	format->pt = pt;
+	format->apt = -1;
+	format->rtcp_fb = 0;
+	sdp_read_token(&p, end, format->name, sizeof(format->name), TRUE);
+	format->clock_rate = -1;
+	if (p < end && *p == '/') {
+		p++;
+		format->clock_rate = sdp_read_int(&p, end);
+	}
+}
+
+static const sdp_format * sdp_media_get_format(const sdp_media * media, gint pt)
+{
+	for (guint i = 0; i < media->formats_count; i++) {
+		if (media->formats[i].pt == pt) {
+			return &media->formats[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void sdp_parse_fmtp(sdp_media * media, const gchar * p, const gchar * end)
+{
+	p += strlen("a=fmtp:");
+	sdp_format * format = (sdp_format *)sdp_media_get_format(media, sdp_read_int(&p, end));
+	const gchar * apt = format ? g_strstr_len(p, end - p, "apt=") : NULL;
+
+	if (apt) {
+		apt += strlen("apt=");
+		format->apt = sdp_read_int(&apt, end);
+	}
+}
+
+static const struct {
+	const gchar *line;
+	sdp_rtcp_fb flag;
+} sdp_rtcp_fb_types[] = {
+	{ "nack", SDP_RTCP_FB_NACK },
+	{ "nack pli", SDP_RTCP_FB_NACK_PLI },
+	{ "ccm fir", SDP_RTCP_FB_CCM_FIR },
+	{ "goog-remb", SDP_RTCP_FB_GOOG_REMB },
+	{ "transport-cc", SDP_RTCP_FB_TRANSPORT_CC }
+};
+
+/* a=rtcp-fb:<pt> <type>, where a * applies the type to the formats mapped so far */
+static void sdp_parse_rtcp_fb(sdp_media * media, const gchar * p, const gchar * end)
 {
+	p += strlen("a=rtcp-fb:");
+	gboolean wildcard = p < end && *p == '*';
 	gint pt = -1;
-	const gchar * codec_str = get_codec_name(codec);
-	gchar * expr_str = g_strdup_printf("a=rtpmap:[0-9]+[ \t]+%s/", codec_str);
-	
-	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
-	g_free(expr_str);
 
-	if (regex != NULL) {
-		GMatchInfo *matchInfo;
-		g_regex_match(regex, sdp, 0, &matchInfo);
-	
-		if (g_match_info_matches(matchInfo)) {
-			gchar *result = g_match_info_fetch(matchInfo, 0);
-		
-			if (result) {
-				gchar * sscanf_str = g_strdup_printf("a=rtpmap:%%d%%*[ \t]%s/", codec_str);
-				sscanf(result, sscanf_str, &pt);
-				
-				g_free(sscanf_str);
-				g_free(result);
-			}
+	if (wildcard) {
+		p++;
+	} else if ((pt = sdp_read_int(&p, end)) < 0) {
+		return;
+	}
+	if (!sdp_skip_blanks(&p, end)) {
+		return;
+	}
+
+	guint flag = 0;
+	for (guint i = 0; i < G_N_ELEMENTS(sdp_rtcp_fb_types); i++) {
+		const gchar * type = sdp_rtcp_fb_types[i].line;
+		if ((gsize)(end - p) == strlen(type) && !strncmp(p, type, strlen(type))) {
+			flag = sdp_rtcp_fb_types[i].flag;
+			break;
 		}
-		g_regex_unref(regex);
 	}
 
-	return pt;
+	for (guint i = 0; flag && i < media->formats_count; i++) {
+		if (wildcard || media->formats[i].pt == pt) {
+			media->formats[i].rtcp_fb |= flag;
+		}
+	}
 }
 
-idilia_codec sdp_get_video_codec(const gchar * sdp)
+sdp_model * sdp_parse(const gchar * sdp)
 {
-	gint codec_pt = sdp_get_codec_pt_for_type(sdp, "video");
-	
-	return sdp_pt_to_codec_id(sdp, codec_pt);
+	sdp_model * model = g_new0(sdp_model, 1);
+	sdp_media * media = NULL;
+
+	model->text = sdp ? sdp : "";
+	model->len = strlen(model->text);
+
+	const gchar * line = model->text;
+	const gchar * text_end = model->text + model->len;
+
+	while (line < text_end) {
+		const gchar * eol = memchr(line, '\n', text_end - line);
+		const gchar * next = eol ? eol + 1 : text_end;
+		const gchar * end = eol ? eol : text_end;
+
+		if (end > line && end[-1] == '\r') {
+			end--;
+		}
+
+		if (SDP_HAS_PREFIX(line, end, "m=")) {
+			/* Attributes of media past the limit are ignored along with it */
+			media = sdp_parse_mline(model, line, end);
+		} else if (media && SDP_HAS_PREFIX(line, end, "a=rtpmap:")) {
+			sdp_parse_rtpmap(media, line, end);
+		} else if (media && SDP_HAS_PREFIX(line, end, "a=fmtp:")) {
+			sdp_parse_fmtp(media, line, end);
+		} else if (media && SDP_HAS_PREFIX(line, end, "a=rtcp-fb:")) {
+			sdp_parse_rtcp_fb(media, line, end);
+		} else if (end - line == strlen("a=recvonly") && SDP_HAS_PREFIX(line, end, "a=recvonly")) {
+			model->recvonly = TRUE;
+		}
+
+		line = next;
+	}
+
+	return model;
 }
 
-idilia_codec sdp_get_audio_codec(const gchar * sdp)
+void sdp_model_free(sdp_model * model)
 {
-	gint codec_pt = sdp_get_codec_pt_for_type(sdp, "audio");
-	
-	return sdp_pt_to_codec_id(sdp, codec_pt);
+	g_free(model);
 }
 
-gchar * sdp_set_video_codec(const gchar * sdp_offer, idilia_codec video_codec) {
-	
-	gchar * sdp_answer = NULL;
-	
-	gint current_codec_pt = sdp_get_codec_pt_for_type(sdp_offer, "video");
-	gint desired_codec_pt = sdp_get_codec_pt(sdp_offer, video_codec);
-	
-	/* do nothing in case the preferred codec is already selected, or if it does not exist in the SDP */
-	if (current_codec_pt == desired_codec_pt || video_codec == IDILIA_CODEC_INVALID) {
-		
-		return g_strdup(sdp_offer);
-		
-	} else {
-		gchar *result = NULL;		
-		GRegex *regex = g_regex_new("m=video[ \t]+[0-9]+[ \t]+UDP/TLS/RTP/SAVPF[ \t]+[0-9]+[ \t]+[0-9]+", 0, 0, NULL);
-		gint codec1 = -1, codec2 = -1;
-		gint port_video = -1;
-		if (regex != NULL) {
-			GMatchInfo *matchInfo;
-			g_regex_match(regex, sdp_offer, 0, &matchInfo);
-			
-			if (g_match_info_matches(matchInfo)) {
-				result = g_match_info_fetch(matchInfo, 0);
-				
-				if (result) {					
-					sscanf(result,"m=video%*[ \t]%d%*[ \t]UDP/TLS/RTP/SAVPF%*[ \t]%d%*[ \t]%d" ,&port_video,&codec1,&codec2);
-					if (codec2 != desired_codec_pt) {
-						codec1 = codec2;
-					}
-					
-					gchar *new_line = g_strdup_printf("m=video %d UDP/TLS/RTP/SAVPF %d %d",port_video, desired_codec_pt, codec1);
-					
-					sdp_answer = str_replace_once(sdp_offer, result, new_line);
-					
-					g_free(new_line);
-					g_free(result);
-				}
-			}
-			else {
-				sdp_answer = g_strdup(sdp_offer);
-			}
-			
-			g_regex_unref(regex);
+/* First media of the type in the profile WebRTC peers use */
+static const sdp_media * sdp_model_get_media(const sdp_model * model, const gchar * type)
+{
+	for (guint i = 0; i < model->media_count; i++) {
+		const sdp_media * media = &model->media[i];
+		if (media->savpf && media->fmts_count > 0 && !strcmp(media->type, type)) {
+			return media;
 		}
 	}
-	
-	return sdp_answer;
+
+	return NULL;
 }
 
-static idilia_codec sdp_pt_to_codec_id(const char * sdp, gint pt)
+static gint sdp_media_get_codec_pt(const sdp_media * media, const gchar * name)
 {
-	gchar *name = NULL;
-	gchar * expr_str = g_strdup_printf("a=rtpmap:%d[ \t]+[a-zA-Z0-9]+", pt);
-	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
-	
-	g_free(expr_str);
+	for (guint i = 0; i < media->formats_count; i++) {
+		if (!strcmp(media->formats[i].name, name)) {
+			return media->formats[i].pt;
+		}
+	}
 
-	if (regex != NULL) {
-		GMatchInfo *matchInfo;
-		g_regex_match(regex, sdp, 0, &matchInfo);
-	
-		if (g_match_info_matches(matchInfo))
-		{
-			gchar *result = g_match_info_fetch(matchInfo, 0);
-			
-			if (result)
-			{
-				gchar * sscanf_str = g_strdup_printf("a=rtpmap:%d%%*[ \t]%%s", pt);				
-				name = g_malloc(strlen(result));
-				sscanf(result, sscanf_str, name);
-				g_free(sscanf_str);
-				g_free(result);
-			}
+	return -1;
+}
+
+gint sdp_model_get_codec_pt(const sdp_model * model, idilia_codec codec)
+{
+	if (codec == IDILIA_CODEC_INVALID) {
+		return -1;
+	}
+
+	for (guint i = 0; i < model->media_count; i++) {
+		gint pt = sdp_media_get_codec_pt(&model->media[i], get_codec_name(codec));
+		if (pt >= 0) {
+			return pt;
 		}
-		g_regex_unref(regex);
 	}
-	
-	idilia_codec codec = sdp_codec_name_to_id(name);
-	
-	if (name) {
-		g_free(name);
+
+	return -1;
+}
+
+/* a=rtcp-fb flags of the payload type in the first media that maps it, 0 when none does */
+guint sdp_model_get_rtcp_fb(const sdp_model * model, gint pt)
+{
+	for (guint i = 0; pt >= 0 && i < model->media_count; i++) {
+		const sdp_format * format = sdp_media_get_format(&model->media[i], pt);
+		if (format) {
+			return format->rtcp_fb;
+		}
 	}
-	
-	return codec;
+
+	return 0;
 }
 
-static gchar * str_replace_once(const gchar * input, const gchar * old_string, const gchar * new_string)
-{			
-	gchar * result = NULL;
-	gchar * first_occurence = strstr(input, old_string);
-	
-	if (first_occurence)
-	{
-		gchar * prefix = g_strndup(input, first_occurence - input);
-		gchar * postfix = first_occurence + strlen(old_string);
-		result  = g_strconcat(prefix, new_string, postfix, NULL);
-		g_free(prefix);
+static idilia_codec sdp_model_get_codec_for_type(const sdp_model * model, const gchar * type)
+{
+	const sdp_media * media = sdp_model_get_media(model, type);
+	const sdp_format * format = media ? sdp_media_get_format(media, media->fmts[0]) : NULL;
+
+	return format ? sdp_codec_name_to_id(format->name) : IDILIA_CODEC_INVALID;
+}
+
+idilia_codec sdp_model_get_video_codec(const sdp_model * model)
+{
+	return sdp_model_get_codec_for_type(model, "video");
+}
+
+idilia_codec sdp_model_get_audio_codec(const sdp_model * model)
+{
+	return sdp_model_get_codec_for_type(model, "audio");
+}
+
+/* Payload type of the rtx format bound by its apt to pt, -1 if there is none */
+static gint sdp_media_get_rtx_pt(const sdp_media * media, gint pt)
+{
+	for (guint i = 0; i < media->formats_count; i++) {
+		if (media->formats[i].apt == pt && !g_ascii_strcasecmp(media->formats[i].name, "rtx")) {
+			return media->formats[i].pt;
+		}
 	}
-													
-	return result;
+
+	return -1;
 }
 
-static gint sdp_get_codec_pt_for_type(const gchar * sdp, const gchar * type)
+/* Moves the video codec to the front of the video m-line, followed by its rtx when it has one;
+ * the other payload types keep their order */
+gchar * sdp_model_set_video_codec(const sdp_model * model, idilia_codec video_codec)
 {
-	gchar *result = NULL;
-	gchar * expr_str = g_strdup_printf("m=%s[ \t]+[0-9]+[ \t]+UDP/TLS/RTP/SAVPF[ \t]+[0-9]+", type);
-	GRegex *regex = g_regex_new(expr_str, 0, 0, NULL);
-	gint codec_pt = -1;
-	
-	g_free(expr_str);
-	
-	if (regex != NULL) {
-		GMatchInfo *matchInfo;
-		g_regex_match(regex, sdp, 0, &matchInfo);
-	
-		if (g_match_info_matches(matchInfo)) {
-			result = g_match_info_fetch(matchInfo, 0);
-				
-			if (result) {							
-				gchar * sscanf_str = g_strdup_printf("m=%s%%*[ \t]%%*d%%*[ \t]UDP/TLS/RTP/SAVPF%%*[ \t]%%d", type);	 
-				sscanf(result, sscanf_str, &codec_pt);
-				 
-				g_free(sscanf_str);
-				g_free(result);
+	const sdp_media * media = sdp_model_get_media(model, "video");
+	gint desired_codec_pt = (media && video_codec != IDILIA_CODEC_INVALID) ? sdp_media_get_codec_pt(media, get_codec_name(video_codec)) : -1;
+
+	/* do nothing in case the preferred codec is already selected, or if it does not exist in the SDP */
+	if (desired_codec_pt < 0 || media->fmts[0] == desired_codec_pt) {
+		return g_strndup(model->text, model->len);
+	}
+
+	gint rtx_pt = sdp_media_get_rtx_pt(media, desired_codec_pt);
+	GString * answer = g_string_sized_new(model->len + 1);
+	g_string_append_len(answer, model->text, media->fmts_start);
+	g_string_append_printf(answer, "%d", desired_codec_pt);
+	if (rtx_pt >= 0) {
+		g_string_append_printf(answer, " %d", rtx_pt);
+	}
+	for (guint i = 0; i < media->fmts_count; i++) {
+		if (media->fmts[i] != desired_codec_pt && media->fmts[i] != rtx_pt) {
+			g_string_append_printf(answer, " %d", media->fmts[i]);
+		}
+	}
+	g_string_append_len(answer, model->text + media->fmts_end, model->len - media->fmts_end);
+
+	return g_string_free(answer, FALSE);
+}
+
+/* Redundancy, FEC and retransmission formats, the pipelines only take the media codecs */
+static const gchar * sdp_scrubbed_formats[] = { "red", "ulpfec", "flexfec-03", "rtx" };
+
+static gboolean sdp_media_is_scrubbed(const sdp_media * media, gint pt)
+{
+	const sdp_format * format = sdp_media_get_format(media, pt);
+
+	if (!format) {
+		return FALSE;
+	}
+
+	for (guint i = 0; i < G_N_ELEMENTS(sdp_scrubbed_formats); i++) {
+		if (!g_ascii_strcasecmp(format->name, sdp_scrubbed_formats[i])) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Payload type of an a=rtpmap, a=fmtp or a=rtcp-fb line, -1 for any other line */
+static gint sdp_line_get_pt(const gchar * line, const gchar * end)
+{
+	const gchar * p = line;
+
+	if (SDP_HAS_PREFIX(line, end, "a=rtpmap:")) {
+		p += strlen("a=rtpmap:");
+	} else if (SDP_HAS_PREFIX(line, end, "a=fmtp:")) {
+		p += strlen("a=fmtp:");
+	} else if (SDP_HAS_PREFIX(line, end, "a=rtcp-fb:")) {
+		p += strlen("a=rtcp-fb:");
+	} else {
+		return -1;
+	}
+
+	return sdp_read_int(&p, end);
+}
+
+/* Copies the SDP in a single pass, dropping the scrubbed formats from the m-lines along with their attributes.
+ * Directions are flipped for media bounced back: recvonly turns inactive, otherwise sendonly turns recvonly.
+ * Nothing grows, so the output fits in one allocation the size of the input */
+gchar * sdp_model_scrub(const sdp_model * model)
+{
+	gchar * out = g_malloc(model->len + 1);
+	gsize n = 0;
+	guint media_index = 0;
+	const sdp_media * media = NULL;
+
+	const gchar * line = model->text;
+	const gchar * text_end = model->text + model->len;
+
+	while (line < text_end) {
+		const gchar * eol = memchr(line, '\n', text_end - line);
+		const gchar * next = eol ? eol + 1 : text_end;
+		const gchar * end = eol ? eol : text_end;
+
+		if (end > line && end[-1] == '\r') {
+			end--;
+		}
+
+		if (SDP_HAS_PREFIX(line, end, "m=")) {
+			media = media_index < model->media_count ? &model->media[media_index++] : NULL;
+			if (media) {
+				const gchar * fmts_start = model->text + media->fmts_start;
+				memcpy(out + n, line, fmts_start - line);
+				n += fmts_start - line;
+
+				gboolean first = TRUE;
+				for (guint i = 0; i < media->fmts_count; i++) {
+					if (!sdp_media_is_scrubbed(media, media->fmts[i])) {
+						n += g_snprintf(out + n, model->len + 1 - n, first ? "%d" : " %d", media->fmts[i]);
+						first = FALSE;
+					}
+				}
+
+				line = model->text + media->fmts_end;
+			}
+		} else if (media && sdp_media_is_scrubbed(media, sdp_line_get_pt(line, end))) {
+			line = next;
+			continue;
+		} else if (end - line == strlen("a=recvonly")) {
+			/* FIXME We should also actually not echo sendonly media back, though... */
+			if (model->recvonly && SDP_HAS_PREFIX(line, end, "a=recvonly")) {
+				memcpy(out + n, "a=inactive", strlen("a=inactive"));
+				n += strlen("a=inactive");
+				line = end;
+			} else if (!model->recvonly && SDP_HAS_PREFIX(line, end, "a=sendonly")) {
+				memcpy(out + n, "a=recvonly", strlen("a=recvonly"));
+				n += strlen("a=recvonly");
+				line = end;
 			}
 		}
-			
-		g_regex_unref(regex);
+
+		memcpy(out + n, line, next - line);
+		n += next - line;
+		line = next;
 	}
-	
-	return codec_pt;
+
+	out[n] = '\0';
+	return out;
+}
+
+gint sdp_get_codec_pt(const gchar * sdp, idilia_codec codec)
+{
+	sdp_model * model = sdp_parse(sdp);
+	gint pt = sdp_model_get_codec_pt(model, codec);
+
+	sdp_model_free(model);
+	return pt;
+}
+
+idilia_codec sdp_get_video_codec(const gchar * sdp)
+{
+	sdp_model * model = sdp_parse(sdp);
+	idilia_codec codec = sdp_model_get_video_codec(model);
+
+	sdp_model_free(model);
+	return codec;
+}
+
+idilia_codec sdp_get_audio_codec(const gchar * sdp)
+{
+	sdp_model * model = sdp_parse(sdp);
+	idilia_codec codec = sdp_model_get_audio_codec(model);
+
+	sdp_model_free(model);
+	return codec;
+}
+
+gchar * sdp_set_video_codec(const gchar * sdp_offer, idilia_codec video_codec)
+{
+	sdp_model * model = sdp_parse(sdp_offer);
+	gchar * sdp_answer = sdp_model_set_video_codec(model, video_codec);
+
+	sdp_model_free(model);
+	return sdp_answer;
 }
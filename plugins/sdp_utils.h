@@ -13,6 +13,62 @@ typedef enum
 	IDILIA_CODEC_INVALID = -1
 } idilia_codec;
 
+#define SDP_MAX_MEDIA 8
+#define SDP_MAX_FORMATS 32
+#define SDP_NAME_LEN 16
+
+/* a=rtcp-fb types a payload type accepts, the ones the plugin has a use for */
+typedef enum
+{
+	SDP_RTCP_FB_NACK = 1 << 0,
+	SDP_RTCP_FB_NACK_PLI = 1 << 1,
+	SDP_RTCP_FB_CCM_FIR = 1 << 2,
+	SDP_RTCP_FB_GOOG_REMB = 1 << 3,
+	SDP_RTCP_FB_TRANSPORT_CC = 1 << 4
+} sdp_rtcp_fb;
+
+/* a=rtpmap of one payload type, with the apt of its a=fmtp when it has one and its a=rtcp-fb lines */
+typedef struct sdp_format
+{
+	gint pt;
+	gchar name[SDP_NAME_LEN];
+	gint clock_rate;
+	gint apt;
+	guint rtcp_fb;	/* sdp_rtcp_fb flags */
+} sdp_format;
+
+typedef struct sdp_media
+{
+	gchar type[SDP_NAME_LEN];
+	gint port;
+	gboolean savpf;			/* UDP/TLS/RTP/SAVPF, the only profile the queries look at */
+	gint fmts[SDP_MAX_FORMATS];	/* Payload types of the m-line, in order */
+	guint fmts_count;
+	sdp_format formats[SDP_MAX_FORMATS];	/* In order of appearance */
+	guint formats_count;
+	gsize fmts_start;		/* Offsets of the payload type list in the text */
+	gsize fmts_end;
+} sdp_media;
+
+/* SDP parsed in one pass; it points into the text, which must outlive it */
+typedef struct sdp_model
+{
+	const gchar *text;
+	gsize len;
+	sdp_media media[SDP_MAX_MEDIA];
+	guint media_count;
+	gboolean recvonly;		/* Some media is a=recvonly */
+} sdp_model;
+
+sdp_model * sdp_parse(const gchar * sdp);
+void sdp_model_free(sdp_model * model);
+gint sdp_model_get_codec_pt(const sdp_model * model, idilia_codec codec);
+guint sdp_model_get_rtcp_fb(const sdp_model * model, gint pt);
+idilia_codec sdp_model_get_video_codec(const sdp_model * model);
+idilia_codec sdp_model_get_audio_codec(const sdp_model * model);
+gchar * sdp_model_set_video_codec(const sdp_model * model, idilia_codec video_codec);
+gchar * sdp_model_scrub(const sdp_model * model);
+
 gint sdp_get_codec_pt(const gchar * sdp, idilia_codec codec);
 idilia_codec sdp_get_video_codec(const gchar * sdp);
 idilia_codec sdp_get_audio_codec(const gchar * sdp);
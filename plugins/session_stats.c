@@ -0,0 +1,164 @@
+#include <string.h>
+#include "session_stats.h"
+#include "gop_cache.h"
+#include "rtp.h"
+#include "utils.h"
+
+/* What the readers get of a stream in one consistent read */
+typedef struct session_stats_published {
+	guint32 expected;
+	guint32 received;
+	gsize jitter_us;
+	gsize packet_rate;
+	gsize bitrate;
+	gint64 window_end;
+} session_stats_published;
+
+static void session_stats_clear(session_stats * ss)
+{
+	gint64 now = janus_get_monotonic_time();
+
+	memset(ss->stream, 0, sizeof(ss->stream));
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		/* Opus is the only audio codec negotiated */
+		ss->stream[stream].rtcp.tb = stream == JANUS_SOURCE_STREAM_VIDEO ? 90000 : 48000;
+		ss->stream[stream].window_start = now;
+		ss->stream[stream].window_end = now;
+	}
+	ss->last_keyframe_ts = 0;
+	ss->last_keyframe = 0;
+	g_atomic_pointer_set(&ss->keyframes, 0);
+	g_atomic_pointer_set(&ss->keyframe_interval, 0);
+}
+
+void session_stats_init(session_stats * ss)
+{
+	session_stats_clear(ss);
+}
+
+/* Only while no media flows, for a new PeerConnection on the same session */
+void session_stats_reset(session_stats * ss)
+{
+	session_stats_clear(ss);
+}
+
+/* Called by the writer of the stream only, with the counters as of this packet */
+static void session_stats_publish(session_stats_stream * s, guint64 packets, guint64 bytes, gint64 now)
+{
+	gint64 elapsed = now - s->window_start;
+	gboolean closed = elapsed >= SESSION_STATS_RATE_WINDOW;
+
+	g_atomic_int_inc(&s->seq);
+	g_atomic_pointer_set(&s->expected, session_stats_expected(&s->rtcp));
+	g_atomic_pointer_set(&s->received, s->rtcp.received);
+	g_atomic_pointer_set(&s->jitter_us, (gsize)(s->rtcp.jitter * G_USEC_PER_SEC / s->rtcp.tb));
+	if (closed) {
+		g_atomic_pointer_set(&s->packet_rate, (packets - s->window_packets) * G_USEC_PER_SEC / elapsed);
+		g_atomic_pointer_set(&s->bitrate, (bytes - s->window_bytes) * 8 * G_USEC_PER_SEC / elapsed);
+		g_atomic_pointer_set(&s->window_end, now);
+	}
+	g_atomic_int_inc(&s->seq);
+
+	if (closed) {
+		s->window_start = now;
+		s->window_packets = packets;
+		s->window_bytes = bytes;
+	}
+}
+
+/* Retries while the writer is halfway through publishing */
+static void session_stats_read(session_stats_stream * s, session_stats_published * out)
+{
+	gint seq;
+
+	do {
+		seq = g_atomic_int_get(&s->seq);
+		out->expected = g_atomic_pointer_get(&s->expected);
+		out->received = g_atomic_pointer_get(&s->received);
+		out->jitter_us = g_atomic_pointer_get(&s->jitter_us);
+		out->packet_rate = g_atomic_pointer_get(&s->packet_rate);
+		out->bitrate = g_atomic_pointer_get(&s->bitrate);
+		out->window_end = g_atomic_pointer_get(&s->window_end);
+	} while ((seq & 1) || seq != g_atomic_int_get(&s->seq));
+}
+
+/* Hot path, on every packet of the publisher; ingest, if not NULL, gets the totals as of this packet */
+void session_stats_rtp(session_stats * ss, int stream, idilia_codec codec, char * buf, int len, session_stats_ingest * ingest)
+{
+	session_stats_stream *s = &ss->stream[stream];
+	gint64 now = janus_get_monotonic_time();
+	gboolean keyframe = stream == JANUS_SOURCE_STREAM_VIDEO && codec != IDILIA_CODEC_INVALID &&
+		len >= RTP_HEADER_SIZE && gop_cache_is_keyframe(codec, buf, len);
+	guint32 ts = len >= RTP_HEADER_SIZE ? ntohl(((rtp_header *)buf)->timestamp) : 0;
+
+	/* The writer is the only one adding, it can read its own counters back without a race */
+	guint64 packets = g_atomic_pointer_get(&s->packets) + 1;
+	guint64 bytes = g_atomic_pointer_get(&s->bytes) + len;
+	g_atomic_pointer_set(&s->packets, packets);
+	g_atomic_pointer_set(&s->bytes, bytes);
+	janus_rtcp_process_incoming_rtp(&s->rtcp, buf, len);
+	session_stats_publish(s, packets, bytes, now);
+
+	if (keyframe && (g_atomic_pointer_get(&ss->keyframes) == 0 || ts != ss->last_keyframe_ts)) {
+		if (ss->last_keyframe > 0) {
+			g_atomic_pointer_set(&ss->keyframe_interval, now - ss->last_keyframe);
+		}
+		ss->last_keyframe = now;
+		ss->last_keyframe_ts = ts;
+		g_atomic_pointer_add(&ss->keyframes, 1);
+	}
+
+	if (ingest) {
+		session_stats_stream *video = &ss->stream[JANUS_SOURCE_STREAM_VIDEO];
+		ingest->bytes = g_atomic_pointer_get(&ss->stream[JANUS_SOURCE_STREAM_AUDIO].bytes) + g_atomic_pointer_get(&video->bytes);
+		if (stream == JANUS_SOURCE_STREAM_VIDEO) {
+			ingest->expected = session_stats_expected(&video->rtcp);
+			ingest->received = video->rtcp.received;
+		} else {
+			session_stats_published published;
+			session_stats_read(video, &published);
+			ingest->expected = published.expected;
+			ingest->received = published.received;
+		}
+	}
+}
+
+/* Packets the publisher sent so far, from the extended highest sequence number (RFC 3550 A.3) */
+guint32 session_stats_expected(const rtcp_context * rtcp)
+{
+	if (!rtcp->rtp_recvd) {
+		return 0;
+	}
+	return ((guint32)rtcp->seq_cycle << 16) + rtcp->last_seq_nr - rtcp->base_seq + 1;
+}
+
+void session_stats_snapshot(session_stats * ss, session_stats_stream_snapshot snapshot[JANUS_SOURCE_STREAM_MAX],
+	guint64 * keyframes, gint64 * keyframe_interval)
+{
+	gint64 now = janus_get_monotonic_time();
+
+	for (int stream = 0; stream < JANUS_SOURCE_STREAM_MAX; stream++) {
+		session_stats_stream *s = &ss->stream[stream];
+		session_stats_stream_snapshot *out = &snapshot[stream];
+		session_stats_published published;
+
+		session_stats_read(s, &published);
+		out->packets = g_atomic_pointer_get(&s->packets);
+		out->bytes = g_atomic_pointer_get(&s->bytes);
+		/* A stream that stopped has not closed a window since */
+		gboolean stale = now - published.window_end >= 2 * SESSION_STATS_RATE_WINDOW;
+		out->packet_rate = stale ? 0 : published.packet_rate;
+		out->bitrate = stale ? 0 : published.bitrate;
+
+		out->lost = published.expected > published.received ? published.expected - published.received : 0;
+		out->loss = published.expected > 0 ? (gdouble)out->lost / published.expected : 0.0;
+		out->jitter = (gdouble)published.jitter_us / G_USEC_PER_SEC;
+		out->jitter_ms = (guint)(published.jitter_us / 1000);
+		out->send_failures = g_atomic_pointer_get(&s->send_failures);
+		out->rtcp_in = g_atomic_pointer_get(&s->rtcp_in);
+		out->rtcp_out = g_atomic_pointer_get(&s->rtcp_out);
+		out->rtcp_failures = g_atomic_pointer_get(&s->rtcp_failures);
+	}
+	*keyframes = g_atomic_pointer_get(&ss->keyframes);
+	*keyframe_interval = g_atomic_pointer_get(&ss->keyframe_interval);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glib.h>
+#include "rtcp.h"
+#include "sdp_utils.h"
+#include "pipeline_callback_data.h"
+
+/* Rates are measured over windows of this length, whoever reads them and however often */
+#define SESSION_STATS_RATE_WINDOW G_USEC_PER_SEC
+
+/* Counters of one stream of a publisher. Janus hands all the RTP of a handle to one thread, which is
+ * the only writer of the stream; readers never block it */
+typedef struct session_stats_stream {
+	/* Private to the writer */
+	rtcp_context rtcp;		/* Sequence numbers and jitter of the publisher's RTP */
+	gint64 window_start;
+	guint64 window_packets;		/* Counters at window_start */
+	guint64 window_bytes;
+	/* Read atomically */
+	volatile gsize packets;
+	volatile gsize bytes;
+	/* Published together with each packet: seq is odd while the writer is updating them */
+	volatile gint seq;
+	volatile gsize expected;
+	volatile gsize received;
+	volatile gsize jitter_us;
+	volatile gsize packet_rate;	/* Over the last complete window */
+	volatile gsize bitrate;
+	volatile gsize window_end;	/* Monotonic time the last window was closed */
+	/* Bumped atomically from the threads relaying RTCP and feeding the pipeline */
+	volatile gsize send_failures;	/* RTP the pipeline could not be handed */
+	volatile gsize rtcp_in;		/* RTCP from the publisher */
+	volatile gsize rtcp_failures;	/* Of that RTCP, what the pipeline could not be handed */
+	volatile gsize rtcp_out;	/* RTCP relayed to the publisher */
+} session_stats_stream;
+
+typedef struct session_stats {
+	session_stats_stream stream[JANUS_SOURCE_STREAM_MAX];
+	/* Video keyframes, written with the RTP. Every packet of a keyframe looks like one, the frame is
+	 * counted once by its RTP timestamp */
+	guint32 last_keyframe_ts;
+	gint64 last_keyframe;
+	volatile gsize keyframes;
+	volatile gsize keyframe_interval;	/* Microseconds between the last two keyframes */
+} session_stats;
+
+/* What the bitrate controller needs, read along with the update */
+typedef struct session_stats_ingest {
+	guint64 bytes;			/* Audio and video */
+	guint32 expected;		/* Video packets the publisher sent */
+	guint32 received;
+} session_stats_ingest;
+
+typedef struct session_stats_stream_snapshot {
+	guint64 packets;
+	guint64 bytes;
+	guint64 packet_rate;		/* Per second, over the last complete window */
+	guint64 bitrate;
+	guint64 lost;
+	gdouble loss;			/* Fraction of the expected packets lost, 0 to 1 */
+	guint jitter_ms;
+	gdouble jitter;			/* Seconds */
+	guint64 send_failures;
+	guint64 rtcp_in;
+	guint64 rtcp_out;
+	guint64 rtcp_failures;
+} session_stats_stream_snapshot;
+
+void session_stats_init(session_stats * ss);
+void session_stats_reset(session_stats * ss);
+void session_stats_rtp(session_stats * ss, int stream, idilia_codec codec, char * buf, int len, session_stats_ingest * ingest);
+guint32 session_stats_expected(const rtcp_context * rtcp);
+void session_stats_snapshot(session_stats * ss, session_stats_stream_snapshot snapshot[JANUS_SOURCE_STREAM_MAX],
+	guint64 * keyframes, gint64 * keyframe_interval);
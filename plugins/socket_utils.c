@@ -9,16 +9,21 @@ static ports_pool * pp;
 
 static janus_source_socket * socket_utils_create_socket(gboolean is_client, int req_port);
 
-void socket_utils_init(uint16_t udp_min_port, uint16_t udp_max_port)
+void socket_utils_init(uint16_t udp_min_port, uint16_t udp_max_port, guint quarantine_ms)
 {
 	janus_mutex_init(&ports_pool_mutex);
-	ports_pool_init(&pp, udp_min_port, udp_max_port);
+	ports_pool_init(&pp, udp_min_port, udp_max_port, (gint64)quarantine_ms * 1000);
 }
 
 void socket_utils_destroy(void)
 {
 	janus_mutex_lock(&ports_pool_mutex);
+	gint in_use = 0, high_water = 0, quarantined = 0;
+	ports_pool_get_stats(pp, &in_use, &high_water, &quarantined);
+	JANUS_LOG(LOG_INFO, "Ports pool high-water mark: %d of %u ports\n", high_water, pp->size);
 	ports_pool_free(pp);
+	/* Sessions reclaimed after this close their sockets without returning the ports */
+	pp = NULL;
 	janus_mutex_unlock(&ports_pool_mutex);
 }
 
@@ -91,7 +96,7 @@ static janus_source_socket * socket_utils_create_socket(gboolean is_client, int
 			}
 		}
 
-		if (!result) {
+		if (!result && !req_port) {
 			janus_mutex_lock(&ports_pool_mutex);
 			ports_pool_return(pp, port);
 			janus_mutex_unlock(&ports_pool_mutex);
@@ -114,29 +119,61 @@ static janus_source_socket * socket_utils_create_socket(gboolean is_client, int
 }
 
 
-void socket_utils_close_socket(janus_source_socket * sck) {
-	
+void socket_utils_detach(janus_source_socket * sck) {
 	if (sck->source) {
 		socket_utils_deattach_callback(sck);
 	}
+
+	if (sck->watch) {
+		rtcp_reactor_remove(sck->watch);
+		sck->watch = NULL;
+	}
+}
+
+void socket_utils_close_socket(janus_source_socket * sck) {
+	
+	socket_utils_detach(sck);
 	
 	if (sck->socket) {
 		g_socket_close(sck->socket, NULL);
 		g_clear_object(&sck->socket);
 	}
 	
+	/* Client sockets only borrow the port of the server socket they are connected to */
+	if (!sck->is_client) {
+		janus_mutex_lock(&ports_pool_mutex);
+		if (pp)
+			ports_pool_return(pp, sck->port);
+		janus_mutex_unlock(&ports_pool_mutex);
+	}
+}
+
+void socket_utils_get_ports_stats(gint * in_use, gint * high_water, gint * quarantined) {
 	janus_mutex_lock(&ports_pool_mutex);
-	ports_pool_return(pp, sck->port);
+	ports_pool_get_stats(pp, in_use, high_water, quarantined);
 	janus_mutex_unlock(&ports_pool_mutex);
 }
 
-void socket_utils_attach_callback(janus_source_socket * sck, GSourceFunc func, gpointer * user_data) {
+int socket_utils_get_fd(janus_source_socket * sck) {
+	if (!sck || !sck->socket) {
+		return -1;
+	}
+
+	return g_socket_get_fd(sck->socket);
+}
+
+void socket_utils_attach_callback(janus_source_socket * sck, GSourceFunc func, gpointer user_data, GDestroyNotify notify) {
 	sck->source = g_socket_create_source(sck->socket, G_IO_IN, NULL);
 	g_assert(sck->source);
-	g_source_set_callback(sck->source, func, user_data, NULL);
+	g_source_set_callback(sck->source, func, user_data, notify);
 	g_source_attach(sck->source, g_main_context_default());
 }
 
+gboolean socket_utils_attach_reactor(janus_source_socket * sck, rtcp_reactor_func func, gpointer user_data, GDestroyNotify notify) {
+	sck->watch = rtcp_reactor_add(socket_utils_get_fd(sck), func, user_data, notify);
+	return sck->watch != NULL;
+}
+
 void socket_utils_deattach_callback(janus_source_socket * sck) {
 	g_source_destroy(sck->source);
 	g_source_unref(sck->source);
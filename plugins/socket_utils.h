@@ -2,18 +2,25 @@
 
 #include <gio/gio.h>
 #include <stdint.h>
+#include "rtcp_reactor.h"
 
 typedef struct janus_source_socket {
 	int port;
 	GSocket *socket;
 	gboolean is_client;
 	GSource *source;
+	rtcp_reactor_watch *watch;	/* Instead of source when the RTCP reactor reads the socket */
 } janus_source_socket;
 
-void socket_utils_init(uint16_t udp_min_port, uint16_t udp_max_port);
+void socket_utils_init(uint16_t udp_min_port, uint16_t udp_max_port, guint quarantine_ms);
 void socket_utils_destroy(void);
 janus_source_socket * socket_utils_create_client_socket(int port_to_connect);
 janus_source_socket * socket_utils_create_server_socket(void);
+/* Stops reading the socket, it stays open until socket_utils_close_socket */
+void socket_utils_detach(janus_source_socket * sck);
 void socket_utils_close_socket(janus_source_socket * sck);
-void socket_utils_attach_callback(janus_source_socket * sck, GSourceFunc func, gpointer * user_data);
+int socket_utils_get_fd(janus_source_socket * sck);
+void socket_utils_get_ports_stats(gint * in_use, gint * high_water, gint * quarantined);
+void socket_utils_attach_callback(janus_source_socket * sck, GSourceFunc func, gpointer user_data, GDestroyNotify notify);
 void socket_utils_deattach_callback(janus_source_socket * sck);
+gboolean socket_utils_attach_reactor(janus_source_socket * sck, rtcp_reactor_func func, gpointer user_data, GDestroyNotify notify);
@@ -0,0 +1,180 @@
+#include <arpa/inet.h>
+#include "viewer_feedback.h"
+#include "rtcp.h"
+#include "debug.h"
+#include "utils.h"
+
+/* A viewer that has not reported for this long is gone or no longer receiving */
+#define VIEWER_FEEDBACK_STALE (10 * G_USEC_PER_SEC)
+
+typedef struct viewer_report {
+	gdouble loss;
+	guint32 jitter;		/* RTP timestamp units */
+	gint64 updated;
+} viewer_report;
+
+static int viewer_feedback_compare(const void *a, const void *b)
+{
+	gdouble la = ((const viewer_report *)a)->loss, lb = ((const viewer_report *)b)->loss;
+	return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static int viewer_feedback_compare_double(const void *a, const void *b)
+{
+	gdouble da = *(const gdouble *)a, db = *(const gdouble *)b;
+	return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+void viewer_feedback_init(viewer_feedback * vf, guint32 clock_rate)
+{
+	janus_mutex_init(&vf->mutex);
+	vf->viewers = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	vf->clock_rate = clock_rate ? clock_rate : 90000;
+	vf->last_aggregate = 0;
+	vf->count = 0;
+	vf->loss = 0.0;
+	vf->jitter_ms = 0;
+}
+
+void viewer_feedback_destroy(viewer_feedback * vf)
+{
+	janus_mutex_lock(&vf->mutex);
+	g_hash_table_destroy(vf->viewers);
+	vf->viewers = NULL;
+	janus_mutex_unlock(&vf->mutex);
+	janus_mutex_destroy(&vf->mutex);
+}
+
+/* Picks the first report block of every SR and RR in the compound packet a viewer sent */
+void viewer_feedback_process_rtcp(viewer_feedback * vf, const char * buf, int len)
+{
+	gint64 now = janus_get_monotonic_time();
+
+	while (len >= (int)sizeof(rtcp_header)) {
+		const rtcp_header *header = (const rtcp_header *)buf;
+		int plen = (ntohs(header->length) + 1) * 4;
+		if (header->version != 2 || plen > len) {
+			break;
+		}
+
+		int offset = header->type == RTCP_SR ? 28 : (header->type == RTCP_RR ? 8 : 0);
+		if (offset > 0 && header->rc > 0 && plen >= offset + (int)sizeof(report_block)) {
+			guint32 ssrc = ntohl(*(const guint32 *)(buf + 4));
+			const report_block *rb = (const report_block *)(buf + offset);
+
+			janus_mutex_lock(&vf->mutex);
+			viewer_report *report = g_hash_table_lookup(vf->viewers, GUINT_TO_POINTER(ssrc));
+			if (!report) {
+				report = g_new0(viewer_report, 1);
+				g_hash_table_insert(vf->viewers, GUINT_TO_POINTER(ssrc), report);
+			}
+			report->loss = (ntohl(rb->flcnpl) >> 24) / 256.0;
+			report->jitter = ntohl(rb->jitter);
+			report->updated = now;
+			janus_mutex_unlock(&vf->mutex);
+		}
+
+		buf += plen;
+		len -= plen;
+	}
+}
+
+static gboolean viewer_feedback_is_stale(gpointer key, gpointer value, gpointer user_data)
+{
+	return *(gint64 *)user_data - ((viewer_report *)value)->updated > VIEWER_FEEDBACK_STALE;
+}
+
+/* Folds the fresh reports with policy, at most once per interval. TRUE if there was something to fold */
+gboolean viewer_feedback_aggregate(viewer_feedback * vf, viewer_feedback_policy policy, guint percentile, gint64 interval)
+{
+	gint64 now = janus_get_monotonic_time();
+
+	janus_mutex_lock(&vf->mutex);
+	if (policy == VIEWER_FEEDBACK_OFF || now - vf->last_aggregate < interval) {
+		janus_mutex_unlock(&vf->mutex);
+		return FALSE;
+	}
+	vf->last_aggregate = now;
+
+	g_hash_table_foreach_remove(vf->viewers, viewer_feedback_is_stale, &now);
+	guint n = g_hash_table_size(vf->viewers);
+	vf->count = n;
+	if (n == 0) {
+		janus_mutex_unlock(&vf->mutex);
+		return FALSE;
+	}
+
+	viewer_report *reports = g_new(viewer_report, n);
+	GHashTableIter iter;
+	gpointer value;
+	guint i = 0;
+	g_hash_table_iter_init(&iter, vf->viewers);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		reports[i++] = *(viewer_report *)value;
+	}
+	qsort(reports, n, sizeof(viewer_report), viewer_feedback_compare);
+
+	guint pick = n - 1;
+	if (policy == VIEWER_FEEDBACK_PERCENTILE) {
+		guint rank = (MIN(percentile, 100) * n + 99) / 100;
+		pick = rank > 0 ? rank - 1 : 0;
+	} else if (policy == VIEWER_FEEDBACK_TRIMMED) {
+		/* Median absolute deviation, with a floor so that identical viewers do not make everybody else an outlier */
+		gdouble median = reports[n / 2].loss;
+		gdouble *deviations = g_new(gdouble, n);
+		for (i = 0; i < n; i++) {
+			deviations[i] = reports[i].loss > median ? reports[i].loss - median : median - reports[i].loss;
+		}
+		qsort(deviations, n, sizeof(gdouble), viewer_feedback_compare_double);
+		gdouble limit = median + 3 * MAX(deviations[n / 2], 0.01);
+		g_free(deviations);
+		while (pick > n / 2 && reports[pick].loss > limit) {
+			pick--;
+		}
+	}
+
+	vf->loss = reports[pick].loss;
+	vf->jitter_ms = (guint)((guint64)reports[pick].jitter * 1000 / vf->clock_rate);
+	g_free(reports);
+	janus_mutex_unlock(&vf->mutex);
+
+	return TRUE;
+}
+
+void viewer_feedback_get(viewer_feedback * vf, guint * count, gdouble * loss, guint * jitter_ms)
+{
+	janus_mutex_lock(&vf->mutex);
+	*count = vf->count;
+	*loss = vf->loss;
+	*jitter_ms = vf->jitter_ms;
+	janus_mutex_unlock(&vf->mutex);
+}
+
+viewer_feedback_policy viewer_feedback_parse_policy(const gchar * name)
+{
+	if (!g_ascii_strcasecmp(name, "worst")) {
+		return VIEWER_FEEDBACK_WORST;
+	} else if (!g_ascii_strcasecmp(name, "percentile")) {
+		return VIEWER_FEEDBACK_PERCENTILE;
+	} else if (!g_ascii_strcasecmp(name, "trimmed")) {
+		return VIEWER_FEEDBACK_TRIMMED;
+	} else if (g_ascii_strcasecmp(name, "off")) {
+		JANUS_LOG(LOG_WARN, "Unknown viewer feedback policy %s, ignoring viewers' reports\n", name);
+	}
+	return VIEWER_FEEDBACK_OFF;
+}
+
+const gchar * viewer_feedback_policy_name(viewer_feedback_policy policy)
+{
+	switch (policy)
+	{
+	case VIEWER_FEEDBACK_WORST:
+		return "worst";
+	case VIEWER_FEEDBACK_PERCENTILE:
+		return "percentile";
+	case VIEWER_FEEDBACK_TRIMMED:
+		return "trimmed";
+	default:
+		return "off";
+	}
+}
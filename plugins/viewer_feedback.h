@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glib.h>
+#include "mutex.h"
+
+/* How the reports of a mount's viewers are folded into one */
+typedef enum
+{
+	VIEWER_FEEDBACK_OFF = 0,
+	VIEWER_FEEDBACK_WORST,		/* The viewer with the most loss */
+	VIEWER_FEEDBACK_PERCENTILE,	/* The viewer at the configured loss percentile */
+	VIEWER_FEEDBACK_TRIMMED		/* The worst viewer once those far off the median are left out */
+} viewer_feedback_policy;
+
+/* Latest receiver report of each RTSP viewer of a mount's video, keyed by the viewer's SSRC */
+typedef struct viewer_feedback {
+	janus_mutex mutex;
+	GHashTable *viewers;
+	guint32 clock_rate;
+	gint64 last_aggregate;		/* Monotonic time the reports were last folded */
+	/* Result of the last aggregation */
+	guint count;
+	gdouble loss;			/* Fraction of packets lost, 0 to 1 */
+	guint jitter_ms;
+} viewer_feedback;
+
+void viewer_feedback_init(viewer_feedback * vf, guint32 clock_rate);
+void viewer_feedback_destroy(viewer_feedback * vf);
+void viewer_feedback_process_rtcp(viewer_feedback * vf, const char * buf, int len);
+gboolean viewer_feedback_aggregate(viewer_feedback * vf, viewer_feedback_policy policy, guint percentile, gint64 interval);
+void viewer_feedback_get(viewer_feedback * vf, guint * count, gdouble * loss, guint * jitter_ms);
+viewer_feedback_policy viewer_feedback_parse_policy(const gchar * name);
+const gchar * viewer_feedback_policy_name(viewer_feedback_policy policy);